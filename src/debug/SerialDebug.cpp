@@ -1,5 +1,9 @@
 #include "SerialDebug.h"
 
+#include "lua/load_sd.h"
+#include "lua/require_sd.h"
+#include "services/ImageService.h"
+
 enum State {
     IDLE, READING_HEADER, READING_PAYLOAD
 };
@@ -18,6 +22,14 @@ uint8_t rxBuffer[1024];
 
 uint8_t ack[] = {0xAA, 0x06, 0x00, 0x00, 0x00}; // 0x06 is the universal ACK response
 
+// Commands 0x01-0x03 may write to SD. Caches keyed on size + mtime can't see a
+// same-size rewrite within FAT's 2 s mtime step, so drop them outright.
+static void invalidateSdCaches() {
+    lua_cardstock_require_invalidate();
+    lua_cardstock_loadfile_invalidate();
+    ImageService::invalidate(nullptr);
+}
+
 namespace SerialDebug {
 
 int handleSerialInput() {
@@ -90,19 +102,21 @@ int processPacket(PacketHeader& header, uint8_t* data) {
             if (!debugMode) {
                 return 0x00;
             }
-            
+            invalidateSdCaches();
             break;
         case 0x02:
             // Handle command 0x02
             if (!debugMode) {
                 return 0x00;
             }
+            invalidateSdCaches();
             break;
         case 0x03:
             // Handle command 0x03
             if (!debugMode) {
                 return 0x00;
             }
+            invalidateSdCaches();
             break;
         case 0x04: // Device wants to initiate dev mode
             debugMode = true;
@@ -0,0 +1,365 @@
+#include "bench_gfx.h"
+
+#include <Arduino.h>
+
+#include "services/GfxService.h"
+
+namespace {
+
+struct GfxCase {
+  const char* name;
+  const char* code;
+};
+
+// Shared launcher layout: header bar and title, ten rows of background,
+// title, subtitle and divider, footer bar (43 primitives per frame). Each case
+// returns the Lua->C calls it made and the primitives it drew.
+#define CARDSTOCK_BENCH_LAUNCHER_SETUP                                                   \
+  "local frames, rows = 60, 10\n"                                                        \
+  "local names, subs = {}, {}\n"                                                         \
+  "for r = 1, rows do names[r] = 'App ' .. r subs[r] = '/apps/app' .. r .. '/main.lua' end\n"
+
+// 240x135 background of 8x8 tiles (30x17 cells) rendered into an off-screen
+// sprite, so only binding and fill cost is measured.
+#define CARDSTOCK_BENCH_TILES_SETUP                                                      \
+  "local frames, cols, rows = 30, 30, 17\n"                                               \
+  "local bg = gfx.newSprite(240, 135)\n"                                                  \
+  "local glyphs = {'.', '#', '~', '^', '=', '+', '*', 'o'}\n"                              \
+  "local function tile(cx, cy) return (cx * 7 + cy * 3) % 8 + 1 end\n"
+
+// A 64x64 sprite (and a 128x128 atlas of four 64x64 frames) composed into a
+// 240x135 off-screen sprite in each blit mode.
+#define CARDSTOCK_BENCH_BLIT_SETUP                                                       \
+  "local n = 200\n"                                                                       \
+  "local scene = gfx.newSprite(240, 135)\n"                                               \
+  "local spr = gfx.newSprite(64, 64)\n"                                                   \
+  "spr:clear(0xF81F) spr:drawString('cardstock', 2, 28)\n"                                \
+  "local atlas = gfx.newSprite(128, 128)\n"                                               \
+  "local function done() scene:free() spr:free() atlas:free() return n, n end\n"
+
+// Line chart over 48 samples: shaded area under the curve, the polyline,
+// a marker dot per sample and 12 bars along the bottom. The "emulated" case
+// builds everything out of gfx.fillRect the way apps had to before the
+// primitives existed.
+#define CARDSTOCK_BENCH_CHART_SETUP                                                      \
+  "local frames, n = 10, 48\n"                                                            \
+  "local xs, ys = {}, {}\n"                                                               \
+  "for i = 1, n do xs[i] = 4 + (i - 1) * 5 ys[i] = 60 + math.floor(math.sin(i / 5) * 40) end\n"
+
+// Console of 12 lines of 11px in a 240x135 off-screen sprite, appending 200
+// lines: redrawn from scratch per line, or scrolled up one line and only the
+// new line drawn. Draws count lines appended.
+#define CARDSTOCK_BENCH_CONSOLE_SETUP                                                    \
+  "local n, rows, lh = 200, 12, 11\n"                                                     \
+  "local con = gfx.newSprite(240, 135)\n"                                                 \
+  "local lines = {}\n"                                                                    \
+  "for i = 1, n do lines[i] = string.format('%5d ok /apps/log/main.lua', i) end\n"
+
+static const GfxCase kCases[] = {
+    {"per-call",
+     CARDSTOCK_BENCH_LAUNCHER_SETUP
+     "for f = 1, frames do\n"
+     "  gfx.fillRect(0, 0, 240, 12, 0x18E3)\n"
+     "  gfx.setTextColor(0xFFFF)\n"
+     "  gfx.drawString('cardstock', 4, 2)\n"
+     "  for r = 1, rows do\n"
+     "    local y = 12 + (r - 1) * 11\n"
+     "    local sel = r == (f % rows) + 1\n"
+     "    gfx.fillRect(0, y, 240, 11, sel and 0x041F or 0x0000)\n"
+     "    gfx.setTextColor(0xFFFF)\n"
+     "    gfx.drawString(names[r], 4, y + 1)\n"
+     "    gfx.setTextColor(0x8410)\n"
+     "    gfx.drawString(subs[r], 80, y + 1)\n"
+     "    gfx.fillRect(0, y + 10, 240, 1, 0x2104)\n"
+     "  end\n"
+     "  gfx.fillRect(0, 123, 240, 12, 0x18E3)\n"
+     "end\n"
+     "return frames * (4 + rows * 6), frames * (3 + rows * 4)"},
+    {"batch rebuilt",
+     CARDSTOCK_BENCH_LAUNCHER_SETUP
+     "local b = gfx.newBatch(64)\n"
+     "for f = 1, frames do\n"
+     "  b:reset()\n"
+     "  b:fillRect(0, 0, 240, 12, 0x18E3)\n"
+     "  b:text('cardstock', 4, 2, 0xFFFF)\n"
+     "  for r = 1, rows do\n"
+     "    local y = 12 + (r - 1) * 11\n"
+     "    local sel = r == (f % rows) + 1\n"
+     "    b:fillRect(0, y, 240, 11, sel and 0x041F or 0x0000)\n"
+     "    b:text(names[r], 4, y + 1, 0xFFFF)\n"
+     "    b:text(subs[r], 80, y + 1, 0x8410)\n"
+     "    b:fillRect(0, y + 10, 240, 1, 0x2104)\n"
+     "  end\n"
+     "  b:fillRect(0, 123, 240, 12, 0x18E3)\n"
+     "  b:submit()\n"
+     "end\n"
+     "return frames * (5 + rows * 4), frames * (3 + rows * 4)"},
+    {"batch retained",
+     CARDSTOCK_BENCH_LAUNCHER_SETUP
+     "local b = gfx.newBatch(64)\n"
+     "b:fillRect(0, 0, 240, 12, 0x18E3)\n"
+     "b:text('cardstock', 4, 2, 0xFFFF)\n"
+     "for r = 1, rows do\n"
+     "  local y = 12 + (r - 1) * 11\n"
+     "  b:fillRect(0, y, 240, 11, 0x0000)\n"
+     "  b:text(names[r], 4, y + 1, 0xFFFF)\n"
+     "  b:text(subs[r], 80, y + 1, 0x8410)\n"
+     "  b:fillRect(0, y + 10, 240, 1, 0x2104)\n"
+     "end\n"
+     "b:fillRect(0, 123, 240, 12, 0x18E3)\n"
+     "for f = 1, frames do b:submit() end\n"
+     "return frames, frames * (3 + rows * 4)"},
+    {"tiles per-cell",
+     CARDSTOCK_BENCH_TILES_SETUP
+     "for f = 1, frames do\n"
+     "  for cy = 0, rows - 1 do\n"
+     "    for cx = 0, cols - 1 do bg:drawString(glyphs[tile(cx, cy)], cx * 8, cy * 8) end\n"
+     "  end\n"
+     "end\n"
+     "bg:free()\n"
+     "return frames * cols * rows, frames * cols * rows"},
+    {"tiles native",
+     CARDSTOCK_BENCH_TILES_SETUP
+     "local ts = gfx.newSprite(64, 8)\n"
+     "for i = 1, 8 do ts:drawString(glyphs[i], (i - 1) * 8, 0) end\n"
+     "local map = gfx.newTilemap(ts, cols, rows, 8, 8)\n"
+     "for cy = 0, rows - 1 do\n"
+     "  for cx = 0, cols - 1 do map:set(cx, cy, tile(cx, cy)) end\n"
+     "end\n"
+     "local drawn = 0\n"
+     "for f = 1, frames do drawn = drawn + map:draw(bg) end\n"
+     "bg:free() ts:free()\n"
+     "return frames, drawn"},
+    {"blit 64x64",
+     CARDSTOCK_BENCH_BLIT_SETUP
+     "for i = 1, n do spr:blit(scene, i % 176, 35) end\n"
+     "return done()"},
+    {"blit 64x64 keyed",
+     CARDSTOCK_BENCH_BLIT_SETUP
+     "for i = 1, n do spr:blit(scene, i % 176, 35, 0xF81F) end\n"
+     "return done()"},
+    {"blit atlas 64x64",
+     CARDSTOCK_BENCH_BLIT_SETUP
+     "for i = 1, n do atlas:blitRegion(scene, i % 176, 35, (i % 2) * 64, (i // 2 % 2) * 64, 64, 64) end\n"
+     "return done()"},
+    {"blit 64x64 rotate",
+     CARDSTOCK_BENCH_BLIT_SETUP
+     "for i = 1, n do spr:blitRotateZoom(scene, 120, 67, i * 7, 1.0) end\n"
+     "return done()"},
+    {"blit 64x64 zoom 2x",
+     CARDSTOCK_BENCH_BLIT_SETUP
+     "for i = 1, n do spr:blitRotateZoom(scene, 120, 67, 0, 2.0) end\n"
+     "return done()"},
+    {"push 64x64 screen",
+     CARDSTOCK_BENCH_BLIT_SETUP
+     "for i = 1, n do spr:push(i % 176, 35) end\n"
+     "return done()"},
+    {"chart emulated",
+     CARDSTOCK_BENCH_CHART_SETUP
+     "local calls, fill = 0, gfx.fillRect\n"
+     "local function line(x0, y0, x1, y1, c)\n"
+     "  local dx, dy = math.abs(x1 - x0), -math.abs(y1 - y0)\n"
+     "  local sx, sy = x0 < x1 and 1 or -1, y0 < y1 and 1 or -1\n"
+     "  local err = dx + dy\n"
+     "  while true do\n"
+     "    fill(x0, y0, 1, 1, c) calls = calls + 1\n"
+     "    if x0 == x1 and y0 == y1 then return end\n"
+     "    local e2 = 2 * err\n"
+     "    if e2 >= dy then err = err + dy x0 = x0 + sx end\n"
+     "    if e2 <= dx then err = err + dx y0 = y0 + sy end\n"
+     "  end\n"
+     "end\n"
+     "for f = 1, frames do\n"
+     "  for i = 1, n - 1 do\n"
+     "    for x = xs[i], xs[i + 1] - 1 do\n"
+     "      local y = ys[i] + (ys[i + 1] - ys[i]) * (x - xs[i]) // 5\n"
+     "      fill(x, y, 1, 120 - y, 0x0210) calls = calls + 1\n"
+     "    end\n"
+     "  end\n"
+     "  for i = 1, n - 1 do line(xs[i], ys[i], xs[i + 1], ys[i + 1], 0x07FF) end\n"
+     "  for i = 1, n do\n"
+     "    for dy = -3, 3 do\n"
+     "      local hw = math.floor(math.sqrt(9 - dy * dy))\n"
+     "      fill(xs[i] - hw, ys[i] + dy, hw * 2 + 1, 1, 0xFFE0) calls = calls + 1\n"
+     "    end\n"
+     "  end\n"
+     "  for b = 0, 11 do fill(4 + b * 20, 122, 16, 12, 0xF800) calls = calls + 1 end\n"
+     "end\n"
+     "return calls, frames * ((n - 1) * 2 + n + 12)"},
+    {"chart native",
+     CARDSTOCK_BENCH_CHART_SETUP
+     "local area = {}\n"
+     "for i = 1, n do area[#area + 1] = xs[i] area[#area + 1] = ys[i] end\n"
+     "area[#area + 1] = xs[n] area[#area + 1] = 120\n"
+     "area[#area + 1] = xs[1] area[#area + 1] = 120\n"
+     "for f = 1, frames do\n"
+     "  gfx.fillPolygon(area, 0x0210)\n"
+     "  for i = 1, n - 1 do gfx.drawLine(xs[i], ys[i], xs[i + 1], ys[i + 1], 0x07FF) end\n"
+     "  for i = 1, n do gfx.fillCircle(xs[i], ys[i], 3, 0xFFE0) end\n"
+     "  for b = 0, 11 do gfx.fillRect(4 + b * 20, 122, 16, 12, 0xF800) end\n"
+     "end\n"
+     "return frames * (1 + (n - 1) + n + 12), frames * ((n - 1) * 2 + n + 12)"},
+    {"console redraw",
+     CARDSTOCK_BENCH_CONSOLE_SETUP
+     "local calls = 0\n"
+     "for i = 1, n do\n"
+     "  local first = math.max(1, i - rows + 1)\n"
+     "  con:clear(0x0000)\n"
+     "  for r = first, i do con:drawString(lines[r], 0, (r - first) * lh) end\n"
+     "  calls = calls + 1 + i - first + 1\n"
+     "end\n"
+     "con:free()\n"
+     "return calls, n"},
+    {"console scroll",
+     CARDSTOCK_BENCH_CONSOLE_SETUP
+     "for i = 1, n do\n"
+     "  con:scroll(0, -lh)\n"
+     "  con:drawString(lines[i], 0, (rows - 1) * lh)\n"
+     "end\n"
+     "con:free()\n"
+     "return n * 2, n"},
+    // Four temporary sprites created, drawn, blitted and freed per frame;
+    // compare against a build with -DCARDSTOCK_BUFFER_POOL_BYTES=0.
+    {"temp sprites",
+     "local frames = 100\n"
+     "local scene = gfx.newSprite(240, 135)\n"
+     "for f = 1, frames do\n"
+     "  for i = 0, 3 do\n"
+     "    local s = gfx.newSprite(64, 32)\n"
+     "    s:drawString('frame ' .. f, 2, 12)\n"
+     "    s:blit(scene, i * 60, 50)\n"
+     "    s:free()\n"
+     "  end\n"
+     "end\n"
+     "scene:free()\n"
+     "return frames * 16, frames * 4"},
+};
+
+#undef CARDSTOCK_BENCH_CONSOLE_SETUP
+#undef CARDSTOCK_BENCH_LAUNCHER_SETUP
+#undef CARDSTOCK_BENCH_CHART_SETUP
+#undef CARDSTOCK_BENCH_BLIT_SETUP
+#undef CARDSTOCK_BENCH_TILES_SETUP
+
+// Frame pipeline: returns a tick (game-logic stand-in: 2000 particle updates
+// in Lua) and a draw (clear, 40 bars and 10 labels to the screen). Run by
+// bench_frames() in each render mode with GfxService::endFrame() between
+// frames, so threaded mode shows tick of frame N+1 overlapping the render
+// task's raster and flush of frame N.
+static const char kFrameCode[] =
+    "local n = 2000\n"
+    "local xs, vs = {}, {}\n"
+    "for i = 1, n do xs[i] = i % 240 vs[i] = (i % 7) - 3 end\n"
+    "local function tick()\n"
+    "  for i = 1, n do\n"
+    "    local x = xs[i] + vs[i]\n"
+    "    if x < 0 or x > 239 then vs[i] = -vs[i] x = xs[i] end\n"
+    "    xs[i] = x\n"
+    "  end\n"
+    "end\n"
+    "local function draw()\n"
+    "  gfx.clear(0x0000)\n"
+    "  for i = 0, 39 do gfx.fillRect(i * 6, 135 - xs[i + 1] % 120, 5, xs[i + 1] % 120, 0x07E0) end\n"
+    "  for r = 0, 9 do gfx.drawString('particle ' .. xs[r + 1], 4, r * 12) end\n"
+    "end\n"
+    "return tick, draw";
+
+static const int kFrames = 60;
+
+static void bench_frames(lua_State* L, GfxService::RenderMode mode, const char* name) {
+  if (luaL_loadstring(L, kFrameCode) != LUA_OK || lua_pcall(L, 0, 2, 0) != LUA_OK) {
+    Serial.println(String("bench gfx frames ") + name + ": error: " + lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return;
+  }
+  const int tick = lua_gettop(L) - 1;
+  const int draw = tick + 1;
+
+  const GfxService::RenderMode prev = GfxService::renderMode();
+  if (GfxService::setRenderMode(mode) != mode) {
+    Serial.println(String("bench gfx frames ") + name + ": unavailable");
+    lua_pop(L, 2);
+    return;
+  }
+  uint32_t tick_us = 0;
+  uint32_t draw_us = 0;
+  uint32_t end_us = 0;
+  int rc = LUA_OK;
+  const uint32_t t0 = micros();
+  for (int f = 0; f < kFrames && rc == LUA_OK; f++) {
+    uint32_t t = micros();
+    lua_pushvalue(L, tick);
+    rc = lua_pcall(L, 0, 0, 0);
+    tick_us += micros() - t;
+    if (rc != LUA_OK) break;
+
+    t = micros();
+    lua_pushvalue(L, draw);
+    rc = lua_pcall(L, 0, 0, 0);
+    draw_us += micros() - t;
+    if (rc != LUA_OK) break;
+
+    t = micros();
+    GfxService::endFrame();
+    end_us += micros() - t;
+  }
+  GfxService::sync();
+  const uint32_t elapsed = micros() - t0;
+  const GfxService::RenderStats after = GfxService::renderStats();
+  GfxService::setRenderMode(prev);
+
+  String line = String("bench gfx frames ") + name;
+  if (rc != LUA_OK) {
+    line += ": error: ";
+    line += lua_tostring(L, -1);
+    lua_pop(L, 1);
+  } else {
+    line += ": " + String(static_cast<unsigned long>(elapsed / kFrames)) + " us/frame";
+    line += " (tick " + String(static_cast<unsigned long>(tick_us / kFrames));
+    line += ", draw " + String(static_cast<unsigned long>(draw_us / kFrames));
+    line += ", endFrame " + String(static_cast<unsigned long>(end_us / kFrames)) + ")";
+    if (mode == GfxService::RenderMode::kThreaded) {
+      line += ", last frame: render " + String(static_cast<unsigned long>(after.render_us));
+      line += " us, blocked " + String(static_cast<unsigned long>(after.wait_us));
+      line += " us, " + String(static_cast<unsigned long>(after.commands));
+      line += " cmds; ring peak " + String(static_cast<unsigned long>(after.ring_peak)) + " B";
+    }
+  }
+  Serial.println(line);
+  lua_pop(L, 2);  // tick, draw
+}
+
+}  // namespace
+
+void lua_cardstock_bench_gfx(lua_State* L) {
+  for (const GfxCase& c : kCases) {
+    if (luaL_loadstring(L, c.code) != LUA_OK) {
+      Serial.println(String("bench gfx: load failed: ") + c.name);
+      lua_pop(L, 1);
+      continue;
+    }
+
+    const uint32_t t0 = micros();
+    const int rc = lua_pcall(L, 0, 2, 0);
+    const uint32_t elapsed = micros() - t0;
+
+    String line = "bench gfx ";
+    line += c.name;
+    if (rc != LUA_OK) {
+      line += ": error: ";
+      line += lua_tostring(L, -1);
+    } else {
+      const uint64_t us = elapsed ? elapsed : 1;
+      const uint64_t calls = static_cast<uint64_t>(lua_tointeger(L, -2));
+      const uint64_t prims = static_cast<uint64_t>(lua_tointeger(L, -1));
+      line += ": " + String(static_cast<unsigned long>(elapsed)) + " us, ";
+      line += String(static_cast<unsigned long>(calls * 1000000 / us)) + " calls/s, ";
+      line += String(static_cast<unsigned long>(prims * 1000000 / us)) + " draws/s";
+    }
+    Serial.println(line);
+    lua_pop(L, rc == LUA_OK ? 2 : 1);  // results or error
+  }
+
+  bench_frames(L, GfxService::RenderMode::kSync, "sync");
+  bench_frames(L, GfxService::RenderMode::kThreaded, "threaded");
+}
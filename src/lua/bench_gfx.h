@@ -0,0 +1,20 @@
+#pragma once
+
+#include "lua.hpp"
+
+// Draw-call benchmark for the gfx bindings: renders a launcher-style screen
+// (header, ten list rows with title/subtitle/divider, footer) with one gfx
+// call per primitive, with a gfx.newBatch() rebuilt every frame, and with a
+// retained batch submitted as-is; then fills a 240x135 background of 8x8
+// tiles with one sprite:drawString per cell and with a native gfx.tilemap;
+// then times each sprite blit mode (plain, colour-keyed, atlas region,
+// rotate, zoom, and a push to the panel) on a 64x64 sprite; then draws a
+// line chart from gfx.fillRect alone and from the native vector primitives;
+// then appends lines to a console by redrawing it and by sprite:scroll;
+// then creates, draws and frees four temporary sprites per frame.
+// Logs Lua->C calls/sec and primitives (tiles, console lines) drawn/sec for
+// each to Serial. Finally runs 60 tick+draw frames to the screen in sync and
+// in threaded render mode and logs us/frame with the tick, draw, endFrame and
+// render-task split for each.
+// Needs the gfx module registered as a global; leaves the Lua stack unchanged.
+void lua_cardstock_bench_gfx(lua_State* L);
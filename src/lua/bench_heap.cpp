@@ -0,0 +1,69 @@
+#include "bench_heap.h"
+#include "lua_heap.h"
+
+#include <Arduino.h>
+
+namespace {
+
+// Churns short-lived tables and strings: a 25-slot ring of small records
+// overwritten 20000 times, then 50 rounds of building and joining 50 number
+// strings. Peaks at ~70 KB on the host, under the default 96 KB arena; a
+// nonzero fallback count means the arena is too small for it.
+// Returns a checksum so the work can't be skipped.
+static const char kWorkload[] =
+    "local ring = {}\n"
+    "for i = 1, 20000 do\n"
+    "  ring[i % 25 + 1] = {x = i, y = i * 2, name = 'item' .. i, tags = {i, i + 1}}\n"
+    "end\n"
+    "local sum = 0\n"
+    "for r = 1, 50 do\n"
+    "  local parts = {}\n"
+    "  for i = 1, 50 do parts[i] = tostring(i * r) end\n"
+    "  sum = sum + #table.concat(parts, ',')\n"
+    "end\n"
+    "return sum + #ring";
+
+// Runs the workload in `L` and returns the elapsed microseconds, or 0 on
+// failure. The caller closes `L`.
+static uint32_t run_workload(lua_State* L, const char* name) {
+  if (!L) {
+    Serial.println(String("bench heap ") + name + ": newstate failed");
+    return 0;
+  }
+  luaL_openlibs(L);
+  if (luaL_loadstring(L, kWorkload) != LUA_OK) {
+    Serial.println(String("bench heap ") + name + ": load failed: " + lua_tostring(L, -1));
+    return 0;
+  }
+  const uint32_t t0 = micros();
+  const int rc = lua_pcall(L, 0, 1, 0);
+  const uint32_t elapsed = micros() - t0;
+  if (rc != LUA_OK) {
+    Serial.println(String("bench heap ") + name + ": error: " + lua_tostring(L, -1));
+    return 0;
+  }
+  return elapsed ? elapsed : 1;
+}
+
+}  // namespace
+
+void lua_cardstock_bench_heap() {
+  lua_State* L = lua_cardstock_heap_newstate();
+  const bool on_arena = lua_cardstock_heap_stats().enabled;
+  const uint32_t arena_us = run_workload(L, "arena");
+  const LuaHeapStats arena_stats = lua_cardstock_heap_stats();  // before close resets the arena
+  lua_cardstock_heap_close(L);
+
+  L = luaL_newstate();
+  const uint32_t default_us = run_workload(L, "default");
+  if (L) lua_close(L);
+
+  String line = "bench heap: arena ";
+  line += on_arena ? String(static_cast<unsigned long>(arena_us)) + " us" : String("unavailable");
+  line += ", default " + String(static_cast<unsigned long>(default_us)) + " us";
+  if (on_arena) {
+    line += " (arena peak " + String(static_cast<unsigned long>(arena_stats.peak_bytes)) + " B, ";
+    line += String(static_cast<unsigned long>(arena_stats.fallback_allocs)) + " fallbacks)";
+  }
+  Serial.println(line);
+}
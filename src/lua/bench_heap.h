@@ -0,0 +1,10 @@
+#pragma once
+
+#include "lua.hpp"
+
+// Allocator benchmark: runs the same GC-heavy table/string workload in a
+// fresh state on the Lua arena (lua_heap.h) and in one on the default
+// realloc-based allocator (luaL_newstate), and logs the time of each to
+// Serial with the arena's peak use and fallback count. Needs the arena free,
+// so call it while no state created by lua_cardstock_heap_newstate() is open.
+void lua_cardstock_bench_heap();
@@ -0,0 +1,79 @@
+#include "bench_input.h"
+
+#include <Arduino.h>
+
+namespace {
+
+struct InputCase {
+  const char* name;
+  const char* code;
+};
+
+// WASD, space, the arrow cluster (; , . /) and three action keys. Each case
+// returns the frames it ran.
+#define CARDSTOCK_BENCH_INPUT_SETUP                                                      \
+  "local frames = 2000\n"                                                                 \
+  "local names = {'w', 'a', 's', 'd', ' ', ';', ',', '.', '/', 'j', 'k', 'l'}\n"          \
+  "local held = 0\n"
+
+static const InputCase kCases[] = {
+    {"isKeyPressed x12",
+     CARDSTOCK_BENCH_INPUT_SETUP
+     "local isKeyPressed = keyboard.isKeyPressed\n"
+     "for f = 1, frames do\n"
+     "  for k = 1, #names do if isKeyPressed(names[k]) then held = held + 1 end end\n"
+     "end\n"
+     "return frames"},
+    {"state",
+     CARDSTOCK_BENCH_INPUT_SETUP
+     "local state, byte = keyboard.state, string.byte\n"
+     "local bytes, bits = {}, {}\n"
+     "for k = 1, #names do\n"
+     "  local i = keyboard.keyIndex(names[k])\n"
+     "  bytes[k], bits[k] = i // 8 + 1, 1 << (i % 8)\n"
+     "end\n"
+     "for f = 1, frames do\n"
+     "  local keys = state()\n"
+     "  for k = 1, #names do if byte(keys, bytes[k]) & bits[k] ~= 0 then held = held + 1 end end\n"
+     "end\n"
+     "return frames"},
+    {"pressedKeys",
+     CARDSTOCK_BENCH_INPUT_SETUP
+     "local pressedKeys, down = keyboard.pressedKeys, {}\n"
+     "for f = 1, frames do\n"
+     "  pressedKeys(down)\n"
+     "  for k = 1, #names do if down[names[k]] then held = held + 1 end end\n"
+     "end\n"
+     "return frames"},
+};
+
+#undef CARDSTOCK_BENCH_INPUT_SETUP
+
+}  // namespace
+
+void lua_cardstock_bench_input(lua_State* L) {
+  for (const InputCase& c : kCases) {
+    if (luaL_loadstring(L, c.code) != LUA_OK) {
+      Serial.println(String("bench input: load failed: ") + c.name);
+      lua_pop(L, 1);
+      continue;
+    }
+
+    const uint32_t t0 = micros();
+    const int rc = lua_pcall(L, 0, 1, 0);
+    const uint32_t elapsed = micros() - t0;
+
+    String line = "bench input ";
+    line += c.name;
+    if (rc != LUA_OK) {
+      line += ": error: ";
+      line += lua_tostring(L, -1);
+    } else {
+      const lua_Integer frames = lua_tointeger(L, -1);
+      line += ": " + String(static_cast<unsigned long>(elapsed)) + " us, ";
+      line += String(frames > 0 ? static_cast<float>(elapsed) / static_cast<float>(frames) : 0.0f, 2) + " us/frame";
+    }
+    Serial.println(line);
+    lua_pop(L, 1);  // result or error
+  }
+}
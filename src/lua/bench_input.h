@@ -0,0 +1,10 @@
+#pragma once
+
+#include "lua.hpp"
+
+// Per-frame input cost for a game polling 12 keys: 12 keyboard.isKeyPressed
+// calls, one keyboard.state() decoded with bit tests, and one
+// keyboard.pressedKeys() into a reused table followed by 12 field reads.
+// Logs the cost per frame of each to Serial. Needs the keyboard module
+// registered as a global; leaves the Lua stack unchanged.
+void lua_cardstock_bench_input(lua_State* L);
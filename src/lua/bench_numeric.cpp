@@ -0,0 +1,70 @@
+#include "bench_numeric.h"
+
+#include <Arduino.h>
+
+namespace {
+
+struct NumericCase {
+  const char* name;
+  const char* code;
+};
+
+// Each chunk returns a value so the loop can't be treated as dead code by a
+// future optimizing VM; iteration counts keep each case around 100 ms on the
+// double build.
+static const NumericCase kCases[] = {
+    {"float mul-add",
+     "local x = 0.0 for i = 1, 20000 do x = x * 0.999 + 1.5 end return x"},
+    {"float div",
+     "local x = 0.0 for i = 1, 20000 do x = x + i / 3 end return x"},
+    {"int arith",
+     "local x = 0 for i = 1, 20000 do x = (x + i * 3) % 65521 end return x"},
+    {"physics step",
+     "local px, py, vx, vy, dt = 0.0, 0.0, 40.0, -90.0, 0.016\n"
+     "for i = 1, 10000 do\n"
+     "  vy = vy + 300.0 * dt\n"
+     "  px, py = px + vx * dt, py + vy * dt\n"
+     "  if py > 135.0 then py = 135.0 vy = -vy * 0.8 end\n"
+     "  if px > 240.0 or px < 0.0 then vx = -vx end\n"
+     "end return px + py"},
+    {"math lib",
+     "local s, sin, sqrt = 0.0, math.sin, math.sqrt\n"
+     "for i = 1, 5000 do s = s + sin(i * 0.01) * sqrt(i) end return s"},
+    {"float->int",
+     "local s = 0 for i = 1, 20000 do s = s + math.floor(i * 0.75) end return s"},
+};
+
+}  // namespace
+
+void lua_cardstock_bench_numeric(lua_State* L) {
+  String header = "bench num: lua_Number ";
+  header += String(static_cast<unsigned>(sizeof(lua_Number))) + " B, lua_Integer ";
+  header += String(static_cast<unsigned>(sizeof(lua_Integer))) + " B";
+  Serial.println(header);
+
+  uint32_t total_us = 0;
+  for (const NumericCase& c : kCases) {
+    if (luaL_loadstring(L, c.code) != LUA_OK) {
+      Serial.println(String("bench num: load failed: ") + c.name);
+      lua_pop(L, 1);
+      continue;
+    }
+
+    const uint32_t t0 = micros();
+    const int rc = lua_pcall(L, 0, 1, 0);
+    const uint32_t elapsed = micros() - t0;
+
+    String line = "bench num ";
+    line += c.name;
+    if (rc != LUA_OK) {
+      line += ": error: ";
+      line += lua_tostring(L, -1);
+    } else {
+      total_us += elapsed;
+      line += ": " + String(static_cast<unsigned long>(elapsed)) + " us";
+    }
+    Serial.println(line);
+    lua_pop(L, 1);  // result or error
+  }
+  Serial.println(String("bench num total: ") + String(static_cast<unsigned long>(total_us)) + " us");
+}
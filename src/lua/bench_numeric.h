@@ -0,0 +1,9 @@
+#pragma once
+
+#include "lua.hpp"
+
+// Numeric microbenchmarks for comparing Lua number configurations (e.g. the
+// default double/int64 build against -DLUA_32BITS). Runs a fixed set of
+// arithmetic loops in `L` and logs the time of each to Serial together with
+// the lua_Number/lua_Integer widths. Leaves the Lua stack unchanged.
+void lua_cardstock_bench_numeric(lua_State* L);
@@ -1,31 +1,64 @@
 #include "lua_gfx.h"
 
+#include "services/BufferService.h"
 #include "services/GfxService.h"
+#include "services/ImageService.h"
+#include "services/PixelService.h"
+#include "services/TextService.h"
 #include "M5Cardputer.h"
 
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
 // -------------------------------
 // gfx.sprite userdata (M5Canvas)
 // -------------------------------
 
 static const char* kSpriteMT = "gfx.sprite";
 
+// Sprites from gfx.newSprite construct their canvas in `storage` and draw
+// into a BufferService buffer, so creating and freeing one touches the heap
+// only while the pool warms up. Loaded images own a heap canvas instead
+// (`buffer` is null).
 struct LuaSprite {
   M5Canvas* canvas = nullptr;
+  void* buffer = nullptr;
+  size_t buffer_bytes = 0;
+  alignas(M5Canvas) unsigned char storage[sizeof(M5Canvas)];
 };
 
 static LuaSprite* lua_check_sprite(lua_State* L, int idx) {
   return static_cast<LuaSprite*>(luaL_checkudata(L, idx, kSpriteMT));
 }
 
+// The canvas, for drawing into or reading. Waits for the render task, which
+// may still be reading it for a queued screen blit.
 static M5Canvas* lua_sprite_require_alive(lua_State* L, LuaSprite* s) {
+  if (!s || !s->canvas) luaL_error(L, "sprite is freed");
+  GfxService::sync();
+  return s->canvas;
+}
+
+// The canvas as the source of a blit: no wait, queued commands only read it.
+static M5Canvas* lua_sprite_source(lua_State* L, LuaSprite* s) {
   if (!s || !s->canvas) luaL_error(L, "sprite is freed");
   return s->canvas;
 }
 
 static void lua_sprite_free(LuaSprite* s) {
   if (!s || !s->canvas) return;
-  s->canvas->deleteSprite();
-  delete s->canvas;
+  GfxService::sync();
+  s->canvas->deleteSprite();  // drops the palette; a pooled buffer isn't freed
+  if (s->canvas == reinterpret_cast<M5Canvas*>(s->storage)) {
+    s->canvas->~M5Canvas();
+    BufferService::release(s->buffer, s->buffer_bytes);
+    s->buffer = nullptr;
+  } else {
+    delete s->canvas;
+  }
   s->canvas = nullptr;
 }
 
@@ -86,7 +119,7 @@ static int l_sprite_draw_string(lua_State* L) {
   const char* text = luaL_checkstring(L, 2);
   int32_t x = static_cast<int32_t>(luaL_checkinteger(L, 3));
   int32_t y = static_cast<int32_t>(luaL_checkinteger(L, 4));
-  int32_t w = c->drawString(text, x, y);
+  int32_t w = GfxService::drawString(c, text, x, y);
   lua_pushinteger(L, static_cast<lua_Integer>(w));
   return 1;
 }
@@ -102,15 +135,659 @@ static int l_sprite_draw_center_string(lua_State* L) {
   return 1;
 }
 
+// Optional RGB565 colour key at `idx`; -1 when absent.
+static int32_t lua_opt_transparent(lua_State* L, int idx) {
+  if (lua_gettop(L) < idx || lua_isnil(L, idx)) return -1;
+  return static_cast<int32_t>(lua_check_u16(L, idx));
+}
+
+// Blit destination at `idx`: a sprite, or nil for the screen.
+static M5Canvas* lua_opt_target(lua_State* L, int idx) {
+  if (lua_isnoneornil(L, idx)) return nullptr;
+  return lua_sprite_require_alive(L, lua_check_sprite(L, idx));
+}
+
+// sprite:push(x, y[, transparent])
 static int l_sprite_push(lua_State* L) {
   LuaSprite* s = lua_check_sprite(L, 1);
-  M5Canvas* c = lua_sprite_require_alive(L, s);
+  M5Canvas* c = lua_sprite_source(L, s);
   int32_t x = static_cast<int32_t>(luaL_checkinteger(L, 2));
   int32_t y = static_cast<int32_t>(luaL_checkinteger(L, 3));
-  c->pushSprite(x, y);
+  GfxService::pushSprite(c, x, y, lua_opt_transparent(L, 4));
+  return 0;
+}
+
+// sprite:blit(dst, x, y[, transparent]); dst nil = screen
+static int l_sprite_blit(lua_State* L) {
+  LuaSprite* s = lua_check_sprite(L, 1);
+  M5Canvas* c = lua_sprite_source(L, s);
+  M5Canvas* dst = lua_opt_target(L, 2);
+  int32_t x = static_cast<int32_t>(luaL_checkinteger(L, 3));
+  int32_t y = static_cast<int32_t>(luaL_checkinteger(L, 4));
+  GfxService::blit(c, 0, 0, c->width(), c->height(), dst, x, y, lua_opt_transparent(L, 5));
+  return 0;
+}
+
+// sprite:blitRegion(dst, x, y, sx, sy, sw, sh[, transparent]) copies one
+// frame of an atlas.
+static int l_sprite_blit_region(lua_State* L) {
+  LuaSprite* s = lua_check_sprite(L, 1);
+  M5Canvas* c = lua_sprite_source(L, s);
+  M5Canvas* dst = lua_opt_target(L, 2);
+  int32_t x = static_cast<int32_t>(luaL_checkinteger(L, 3));
+  int32_t y = static_cast<int32_t>(luaL_checkinteger(L, 4));
+  int32_t sx = static_cast<int32_t>(luaL_checkinteger(L, 5));
+  int32_t sy = static_cast<int32_t>(luaL_checkinteger(L, 6));
+  int32_t sw = static_cast<int32_t>(luaL_checkinteger(L, 7));
+  int32_t sh = static_cast<int32_t>(luaL_checkinteger(L, 8));
+  GfxService::blit(c, sx, sy, sw, sh, dst, x, y, lua_opt_transparent(L, 9));
+  return 0;
+}
+
+// sprite:blitRotateZoom(dst, cx, cy, angle, zoom[, zoom_y[, transparent]])
+// draws the sprite centred on (cx, cy), rotated by `angle` degrees.
+static int l_sprite_blit_rotate_zoom(lua_State* L) {
+  LuaSprite* s = lua_check_sprite(L, 1);
+  M5Canvas* c = lua_sprite_source(L, s);
+  M5Canvas* dst = lua_opt_target(L, 2);
+  float x = static_cast<float>(luaL_checknumber(L, 3));
+  float y = static_cast<float>(luaL_checknumber(L, 4));
+  float angle = static_cast<float>(luaL_checknumber(L, 5));
+  float zoom_x = static_cast<float>(luaL_checknumber(L, 6));
+  float zoom_y = static_cast<float>(luaL_optnumber(L, 7, zoom_x));
+  GfxService::blitRotateZoom(c, dst, x, y, angle, zoom_x, zoom_y, lua_opt_transparent(L, 8));
+  return 0;
+}
+
+// -------------------------------
+// Vector primitives, shared by gfx.* (screen) and sprite:* (the sprite):
+// gfx.drawLine(x0, y0, x1, y1, color) / sprite:drawLine(x0, y0, x1, y1, color)
+// -------------------------------
+
+// Resolves the draw target: a sprite passed as self, or the screen. Sets `arg`
+// to the index of the first coordinate.
+static M5Canvas* lua_prim_target(lua_State* L, int* arg) {
+  if (LuaSprite* s = static_cast<LuaSprite*>(luaL_testudata(L, 1, kSpriteMT))) {
+    *arg = 2;
+    return lua_sprite_require_alive(L, s);
+  }
+  *arg = 1;
+  return nullptr;
+}
+
+static int32_t lua_check_i32(lua_State* L, int idx) {
+  return static_cast<int32_t>(luaL_checkinteger(L, idx));
+}
+
+static int l_prim_draw_line(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::drawLine(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                       lua_check_i32(L, a + 3), lua_check_u16(L, a + 4));
+  return 0;
+}
+
+// hline(x, y, w, color)
+static int l_prim_hline(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::drawFastHLine(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                            lua_check_u16(L, a + 3));
+  return 0;
+}
+
+// vline(x, y, h, color)
+static int l_prim_vline(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::drawFastVLine(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                            lua_check_u16(L, a + 3));
+  return 0;
+}
+
+static int l_prim_draw_rect(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::drawRect(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                       lua_check_i32(L, a + 3), lua_check_u16(L, a + 4));
+  return 0;
+}
+
+static int l_prim_fill_rect(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::fillRect(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                       lua_check_i32(L, a + 3), lua_check_u16(L, a + 4));
+  return 0;
+}
+
+// drawCircle(x, y, r, color)
+static int l_prim_draw_circle(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::drawCircle(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                         lua_check_u16(L, a + 3));
   return 0;
 }
 
+static int l_prim_fill_circle(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::fillCircle(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                         lua_check_u16(L, a + 3));
+  return 0;
+}
+
+// drawRoundRect(x, y, w, h, r, color)
+static int l_prim_draw_round_rect(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::drawRoundRect(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                            lua_check_i32(L, a + 3), lua_check_i32(L, a + 4), lua_check_u16(L, a + 5));
+  return 0;
+}
+
+static int l_prim_fill_round_rect(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::fillRoundRect(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                            lua_check_i32(L, a + 3), lua_check_i32(L, a + 4), lua_check_u16(L, a + 5));
+  return 0;
+}
+
+// drawTriangle(x0, y0, x1, y1, x2, y2, color)
+static int l_prim_draw_triangle(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::drawTriangle(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                           lua_check_i32(L, a + 3), lua_check_i32(L, a + 4), lua_check_i32(L, a + 5),
+                           lua_check_u16(L, a + 6));
+  return 0;
+}
+
+static int l_prim_fill_triangle(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  GfxService::fillTriangle(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                           lua_check_i32(L, a + 3), lua_check_i32(L, a + 4), lua_check_i32(L, a + 5),
+                           lua_check_u16(L, a + 6));
+  return 0;
+}
+
+// drawPolygon({x1, y1, x2, y2, ...}, color) / fillPolygon(...)
+static int lua_prim_polygon(lua_State* L, bool fill) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  luaL_checktype(L, a, LUA_TTABLE);
+  const uint16_t color = lua_check_u16(L, a + 1);
+  const lua_Integer n = luaL_len(L, a);
+  if (n % 2) luaL_argerror(L, a, "expected a flat list of x, y pairs");
+
+  // Long lists go in a Lua-owned scratch buffer: the argument errors below
+  // longjmp, so nothing here may need a destructor.
+  int32_t stack_xy[64];
+  int32_t* xy = stack_xy;
+  if (n > 64) xy = static_cast<int32_t*>(lua_newuserdatauv(L, static_cast<size_t>(n) * sizeof(int32_t), 0));
+  for (lua_Integer i = 0; i < n; i++) {
+    lua_geti(L, a, i + 1);
+    int ok = 0;
+    xy[i] = static_cast<int32_t>(lua_tointegerx(L, -1, &ok));
+    if (!ok) luaL_argerror(L, a, "coordinates must be integers");
+    lua_pop(L, 1);
+  }
+  if (fill) {
+    GfxService::fillPolygon(dst, xy, static_cast<size_t>(n / 2), color);
+  } else {
+    GfxService::drawPolygon(dst, xy, static_cast<size_t>(n / 2), color);
+  }
+  return 0;
+}
+
+static int l_prim_draw_polygon(lua_State* L) {
+  return lua_prim_polygon(L, false);
+}
+
+static int l_prim_fill_polygon(lua_State* L) {
+  return lua_prim_polygon(L, true);
+}
+
+// setScrollRect(x, y, w, h); with no arguments, back to the whole surface.
+static int l_prim_set_scroll_rect(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  if (lua_isnoneornil(L, a)) {
+    GfxService::clearScrollRect(dst);
+    return 0;
+  }
+  GfxService::setScrollRect(dst, lua_check_i32(L, a), lua_check_i32(L, a + 1), lua_check_i32(L, a + 2),
+                            lua_check_i32(L, a + 3));
+  return 0;
+}
+
+// scroll(dx, dy[, fill]): moves the scroll region, filling what it uncovers
+// (black by default).
+static int l_prim_scroll(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  const int32_t dx = lua_check_i32(L, a);
+  const int32_t dy = lua_check_i32(L, a + 1);
+  const uint16_t fill = lua_isnoneornil(L, a + 2) ? 0x0000 : lua_check_u16(L, a + 2);
+  GfxService::scroll(dst, dx, dy, fill);
+  return 0;
+}
+
+// -------------------------------
+// Text measurement and layout, shared by gfx.* and sprite:* like the
+// primitives. Nothing is drawn except by drawTextBox.
+// -------------------------------
+
+// Font for measuring on `dst`: the numbered font at opts.font (or `idx` when
+// it is a number), else the target's current font; size from opts.size, else
+// the target's text size.
+static TextService::Font lua_text_font(lua_State* L, M5Canvas* dst, int font_idx, int size_idx) {
+  const LovyanGFX* t = dst ? static_cast<const LovyanGFX*>(dst) : GfxService::textTarget();
+  TextService::Font f = TextService::fontOf(t);
+  if (size_idx && !lua_isnoneornil(L, size_idx)) {
+    f.size_x = f.size_y = static_cast<float>(luaL_checknumber(L, size_idx));
+    luaL_argcheck(L, f.size_x > 0, size_idx, "size must be positive");
+  }
+  if (font_idx && !lua_isnoneornil(L, font_idx)) {
+    f = TextService::numberedFont(static_cast<int32_t>(luaL_checkinteger(L, font_idx)), f.size_x, f.size_y);
+  }
+  return f;
+}
+
+// Reads `key` from the options table at `idx` onto the stack top; returns its index.
+static int lua_text_opt(lua_State* L, int idx, const char* key) {
+  if (!lua_istable(L, idx)) {
+    lua_pushnil(L);
+  } else {
+    lua_getfield(L, idx, key);
+  }
+  return lua_gettop(L);
+}
+
+// measure(text[, font[, size]]) -> width, height
+static int l_prim_measure(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  size_t len = 0;
+  const char* text = luaL_checklstring(L, a, &len);
+  const TextService::Font f = lua_text_font(L, dst, a + 1, a + 2);
+  lua_pushinteger(L, TextService::width(f, text, len));
+  lua_pushinteger(L, TextService::height(f));
+  return 2;
+}
+
+// Runs the layout for `text` in a box `width` wide with the options table at
+// `opts` ({font, size, maxLines, ellipsis}).
+static TextService::Font lua_text_layout(lua_State* L, M5Canvas* dst, const char* text, int32_t width, int opts,
+                                         int32_t max_lines, std::vector<TextService::Line>& lines) {
+  const int top = lua_gettop(L);
+  const int font_idx = lua_text_opt(L, opts, "font");
+  const int size_idx = lua_text_opt(L, opts, "size");
+  const TextService::Font f = lua_text_font(L, dst, font_idx, size_idx);
+
+  TextService::LayoutOptions lo;
+  lo.max_width = width;
+  lo.max_lines = max_lines;
+  const int lines_idx = lua_text_opt(L, opts, "maxLines");
+  if (!lua_isnil(L, lines_idx)) lo.max_lines = static_cast<int32_t>(luaL_checkinteger(L, lines_idx));
+  if (max_lines > 0 && (lo.max_lines <= 0 || lo.max_lines > max_lines)) lo.max_lines = max_lines;
+  const int ell_idx = lua_text_opt(L, opts, "ellipsis");
+  if (!lua_isnil(L, ell_idx)) lo.ellipsize = lua_toboolean(L, ell_idx);
+  lua_settop(L, top);
+
+  TextService::layout(f, text, lo, lines);
+  return f;
+}
+
+// layout(text, width[, {font, size, maxLines, ellipsis}]) -> lines, height
+// Each line is {text = ..., width = px, first = i, last = j}, where first/last
+// are the byte positions of the line in `text` (string.sub-style); `text`
+// ends in "..." on an ellipsized line.
+static int l_prim_layout(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  const char* text = luaL_checkstring(L, a);
+  const int32_t width = static_cast<int32_t>(luaL_checkinteger(L, a + 1));
+  std::vector<TextService::Line> lines;
+  const TextService::Font f = lua_text_layout(L, dst, text, width, a + 2, 0, lines);
+
+  lua_createtable(L, static_cast<int>(lines.size()), 0);
+  for (size_t i = 0; i < lines.size(); i++) {
+    const TextService::Line& line = lines[i];
+    lua_createtable(L, 0, 4);
+    if (line.ellipsized) {
+      luaL_Buffer b;
+      luaL_buffinit(L, &b);
+      luaL_addlstring(&b, text + line.start, line.len);
+      luaL_addstring(&b, "...");
+      luaL_pushresult(&b);
+    } else {
+      lua_pushlstring(L, text + line.start, line.len);
+    }
+    lua_setfield(L, -2, "text");
+    lua_pushinteger(L, line.width);
+    lua_setfield(L, -2, "width");
+    lua_pushinteger(L, static_cast<lua_Integer>(line.start) + 1);
+    lua_setfield(L, -2, "first");
+    lua_pushinteger(L, static_cast<lua_Integer>(line.start + line.len));
+    lua_setfield(L, -2, "last");
+    lua_rawseti(L, -2, static_cast<lua_Integer>(i) + 1);
+  }
+  lua_pushinteger(L, static_cast<lua_Integer>(lines.size()) * TextService::height(f));
+  return 2;
+}
+
+// drawTextBox(text, x, y, w, h[, {font, maxLines, ellipsis, align}]) -> lines drawn
+// Wraps `text` into the box, ellipsizing the last line that fits, and draws
+// it with the current text colours. align is "left" (default), "center" or
+// "right". The text size is the target's; opts.size is not supported here.
+static int l_prim_draw_text_box(lua_State* L) {
+  int a;
+  M5Canvas* dst = lua_prim_target(L, &a);
+  const char* text = luaL_checkstring(L, a);
+  const int32_t x = lua_check_i32(L, a + 1);
+  const int32_t y = lua_check_i32(L, a + 2);
+  const int32_t w = lua_check_i32(L, a + 3);
+  const int32_t h = lua_check_i32(L, a + 4);
+  const int opts = a + 5;
+
+  int align = 0;
+  int32_t font = -1;
+  if (lua_istable(L, opts)) {
+    lua_getfield(L, opts, "align");
+    if (!lua_isnil(L, -1)) {
+      const char* name = lua_tostring(L, -1);
+      if (name && strcmp(name, "center") == 0) {
+        align = 1;
+      } else if (name && strcmp(name, "right") == 0) {
+        align = 2;
+      } else if (!name || strcmp(name, "left") != 0) {
+        luaL_argerror(L, opts, "align must be \"left\", \"center\" or \"right\"");
+      }
+    }
+    lua_getfield(L, opts, "font");
+    if (!lua_isnil(L, -1)) font = static_cast<int32_t>(luaL_checkinteger(L, -1));
+    lua_getfield(L, opts, "size");
+    if (!lua_isnil(L, -1)) luaL_argerror(L, opts, "size is not supported; set the text size first");
+    lua_pop(L, 3);
+  }
+
+  TextService::Font f = lua_text_font(L, dst, 0, 0);
+  if (font >= 0) f = TextService::numberedFont(font, f.size_x, f.size_y);
+  const int32_t line_h = TextService::height(f);
+  if (line_h <= 0 || h < line_h) {
+    lua_pushinteger(L, 0);
+    return 1;
+  }
+
+  std::vector<TextService::Line> lines;
+  lua_text_layout(L, dst, text, w, opts, h / line_h, lines);
+
+  std::string buf;
+  for (size_t i = 0; i < lines.size(); i++) {
+    const TextService::Line& line = lines[i];
+    buf.assign(text + line.start, line.len);
+    if (line.ellipsized) buf += "...";
+    int32_t lx = x;
+    if (align == 1) lx += (w - line.width) / 2;
+    if (align == 2) lx += w - line.width;
+    GfxService::drawString(dst, buf.c_str(), lx, y + static_cast<int32_t>(i) * line_h, font);
+  }
+  lua_pushinteger(L, static_cast<lua_Integer>(lines.size()));
+  return 1;
+}
+
+// -------------------------------
+// gfx.pixels userdata (view over a 16-bit sprite's buffer)
+// -------------------------------
+
+static const char* kPixelsMT = "gfx.pixels";
+
+// Colours are RGB565 integers. Rectangles are optional trailing (x, y, w, h)
+// arguments defaulting to the whole sprite, and are clipped to it.
+struct LuaPixels {
+  LuaSprite* sprite = nullptr;  // kept alive by the uservalue
+};
+
+static PixelService::View lua_check_pixels(lua_State* L, int idx) {
+  LuaPixels* p = static_cast<LuaPixels*>(luaL_checkudata(L, idx, kPixelsMT));
+  PixelService::View v = PixelService::of(lua_sprite_require_alive(L, p->sprite));
+  if (!v.px) luaL_error(L, "pixels: sprite is not 16-bit");
+  return v;
+}
+
+static GfxService::Rect lua_opt_rect(lua_State* L, int idx, const PixelService::View& v) {
+  if (lua_isnoneornil(L, idx)) return GfxService::Rect{0, 0, v.width, v.height};
+  return GfxService::Rect{lua_check_i32(L, idx), lua_check_i32(L, idx + 1), lua_check_i32(L, idx + 2),
+                          lua_check_i32(L, idx + 3)};
+}
+
+// pixels:size() -> w, h
+static int l_pixels_size(lua_State* L) {
+  const PixelService::View v = lua_check_pixels(L, 1);
+  lua_pushinteger(L, v.width);
+  lua_pushinteger(L, v.height);
+  return 2;
+}
+
+// pixels:get(x, y) -> rgb565 (0 outside the sprite)
+static int l_pixels_get(lua_State* L) {
+  const PixelService::View v = lua_check_pixels(L, 1);
+  lua_pushinteger(L, PixelService::get(v, lua_check_i32(L, 2), lua_check_i32(L, 3)));
+  return 1;
+}
+
+// pixels:set(x, y, rgb565)
+static int l_pixels_set(lua_State* L) {
+  const PixelService::View v = lua_check_pixels(L, 1);
+  PixelService::set(v, lua_check_i32(L, 2), lua_check_i32(L, 3), lua_check_u16(L, 4));
+  return 0;
+}
+
+// pixels:plot({x1, y1, x2, y2, ...}, rgb565)
+static int l_pixels_plot(lua_State* L) {
+  const PixelService::View v = lua_check_pixels(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  const uint16_t color = lua_check_u16(L, 3);
+  const lua_Integer n = luaL_len(L, 2);
+  if (n % 2) luaL_argerror(L, 2, "expected a flat list of x, y pairs");
+
+  // Converted in chunks so large particle lists don't need a heap copy.
+  int32_t xy[128];
+  lua_Integer done = 0;
+  while (done < n) {
+    const lua_Integer chunk = std::min<lua_Integer>(n - done, 128);
+    for (lua_Integer i = 0; i < chunk; i++) {
+      lua_geti(L, 2, done + i + 1);
+      int ok = 0;
+      xy[i] = static_cast<int32_t>(lua_tointegerx(L, -1, &ok));
+      if (!ok) luaL_argerror(L, 2, "coordinates must be integers");
+      lua_pop(L, 1);
+    }
+    PixelService::plot(v, xy, static_cast<size_t>(chunk / 2), color);
+    done += chunk;
+  }
+  return 0;
+}
+
+// pixels:fill(rgb565[, x, y, w, h])
+static int l_pixels_fill(lua_State* L) {
+  const PixelService::View v = lua_check_pixels(L, 1);
+  const uint16_t color = lua_check_u16(L, 2);
+  PixelService::fill(v, lua_opt_rect(L, 3, v), color);
+  return 0;
+}
+
+// pixels:copyRect(src, sx, sy, w, h, dx, dy[, key]); `src` is a pixels view,
+// possibly this one.
+static int l_pixels_copy_rect(lua_State* L) {
+  const PixelService::View dst = lua_check_pixels(L, 1);
+  const PixelService::View src = lua_check_pixels(L, 2);
+  const GfxService::Rect r{lua_check_i32(L, 3), lua_check_i32(L, 4), lua_check_i32(L, 5), lua_check_i32(L, 6)};
+  PixelService::copyRect(src, r, dst, lua_check_i32(L, 7), lua_check_i32(L, 8), lua_opt_transparent(L, 9));
+  return 0;
+}
+
+// pixels:blend(src, sx, sy, w, h, dx, dy, alpha[, key]), alpha 0-255
+static int l_pixels_blend(lua_State* L) {
+  const PixelService::View dst = lua_check_pixels(L, 1);
+  const PixelService::View src = lua_check_pixels(L, 2);
+  const GfxService::Rect r{lua_check_i32(L, 3), lua_check_i32(L, 4), lua_check_i32(L, 5), lua_check_i32(L, 6)};
+  const lua_Integer alpha = luaL_checkinteger(L, 9);
+  luaL_argcheck(L, alpha >= 0 && alpha <= 255, 9, "alpha must be 0-255");
+  PixelService::blend(src, r, dst, lua_check_i32(L, 7), lua_check_i32(L, 8), static_cast<uint8_t>(alpha),
+                      lua_opt_transparent(L, 10));
+  return 0;
+}
+
+// pixels:paletteMap({[from] = to, ...}[, x, y, w, h])
+static int l_pixels_palette_map(lua_State* L) {
+  const PixelService::View v = lua_check_pixels(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  const GfxService::Rect r = lua_opt_rect(L, 3, v);
+  // Every entry is checked before the map is built: argument errors longjmp
+  // past C++ destructors, so nothing may raise while the vector is alive.
+  size_t count = 0;
+  lua_pushnil(L);
+  while (lua_next(L, 2)) {
+    int ok_from = 0, ok_to = 0;
+    const lua_Integer from = lua_tointegerx(L, -2, &ok_from);
+    const lua_Integer to = lua_tointegerx(L, -1, &ok_to);
+    if (!ok_from || !ok_to || from < 0 || from > 0xFFFF || to < 0 || to > 0xFFFF) {
+      luaL_argerror(L, 2, "expected rgb565 = rgb565 entries");
+    }
+    count++;
+    lua_pop(L, 1);
+  }
+
+  std::vector<std::pair<uint16_t, uint16_t>> map;
+  map.reserve(count);
+  lua_pushnil(L);
+  while (lua_next(L, 2)) {
+    map.emplace_back(static_cast<uint16_t>(lua_tointeger(L, -2)), static_cast<uint16_t>(lua_tointeger(L, -1)));
+    lua_pop(L, 1);
+  }
+  PixelService::paletteMap(v, r, map);
+  return 0;
+}
+
+// pixels:threshold(level, lo, hi[, x, y, w, h]): luma >= level -> hi, else lo
+static int l_pixels_threshold(lua_State* L) {
+  const PixelService::View v = lua_check_pixels(L, 1);
+  const lua_Integer level = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, level >= 0 && level <= 255, 2, "level must be 0-255");
+  const uint16_t lo = lua_check_u16(L, 3);
+  const uint16_t hi = lua_check_u16(L, 4);
+  PixelService::threshold(v, lua_opt_rect(L, 5, v), static_cast<uint8_t>(level), lo, hi);
+  return 0;
+}
+
+// pixels:read([x, y, w, h]) -> string of little-endian RGB565, row by row
+// (string.unpack("<I2", s, i) reads one pixel). Always w * h pixels: those
+// outside the sprite read as 0, like get(), so write() takes the string back.
+static int l_pixels_read(lua_State* L) {
+  const PixelService::View v = lua_check_pixels(L, 1);
+  const GfxService::Rect r = lua_opt_rect(L, 2, v);
+  if (r.w < 0 || r.h < 0) luaL_argerror(L, 2, "negative rectangle size");
+  const size_t len = static_cast<size_t>(r.w) * r.h * 2;
+  luaL_Buffer b;
+  char* out = luaL_buffinitsize(L, &b, len);
+  memset(out, 0, len);
+  // Only the part of the rect that overlaps the sprite is copied.
+  const int32_t x0 = std::max<int32_t>(0, -r.x);
+  const int32_t x1 = std::min<int32_t>(r.w, v.width - r.x);
+  for (int32_t y = 0; y < r.h; y++) {
+    const int32_t sy = r.y + y;
+    if (sy < 0 || sy >= v.height) continue;
+    const uint16_t* row = v.px + sy * v.width;
+    char* dst = out + static_cast<size_t>(y) * r.w * 2;
+    for (int32_t x = x0; x < x1; x++) {
+      // Buffer pixels are big-endian; the string is little-endian.
+      const uint16_t c = row[r.x + x];
+      dst[x * 2] = static_cast<char>(c >> 8);
+      dst[x * 2 + 1] = static_cast<char>(c & 0xFF);
+    }
+  }
+  luaL_pushresultsize(&b, len);
+  return 1;
+}
+
+// pixels:write(s[, x, y, w, h]): the inverse of read(); `s` must hold w * h
+// pixels, and those falling outside the sprite are skipped.
+static int l_pixels_write(lua_State* L) {
+  const PixelService::View v = lua_check_pixels(L, 1);
+  size_t len = 0;
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(luaL_checklstring(L, 2, &len));
+  const GfxService::Rect r = lua_opt_rect(L, 3, v);
+  if (r.w < 0 || r.h < 0 || len != static_cast<size_t>(r.w) * r.h * 2) {
+    luaL_argerror(L, 2, "size does not match the rectangle");
+  }
+  for (int32_t y = 0; y < r.h; y++) {
+    const int32_t ty = r.y + y;
+    if (ty < 0 || ty >= v.height) continue;
+    const uint8_t* row = in + static_cast<size_t>(y) * r.w * 2;
+    for (int32_t x = std::max<int32_t>(0, -r.x); x < r.w && r.x + x < v.width; x++) {
+      v.px[ty * v.width + r.x + x] = static_cast<uint16_t>((row[x * 2] << 8) | row[x * 2 + 1]);
+    }
+  }
+  return 0;
+}
+
+static const luaL_Reg kPixelsMethods[] = {
+    {"size", l_pixels_size},
+    {"get", l_pixels_get},
+    {"set", l_pixels_set},
+    {"plot", l_pixels_plot},
+    {"fill", l_pixels_fill},
+    {"copyRect", l_pixels_copy_rect},
+    {"blend", l_pixels_blend},
+    {"paletteMap", l_pixels_palette_map},
+    {"threshold", l_pixels_threshold},
+    {"read", l_pixels_read},
+    {"write", l_pixels_write},
+    {nullptr, nullptr},
+};
+
+// sprite:pixels() -> view over the sprite's buffer (16-bit sprites only).
+// The view keeps the sprite alive and sees every later change to it.
+static int l_sprite_pixels(lua_State* L) {
+  LuaSprite* s = lua_check_sprite(L, 1);
+  M5Canvas* c = lua_sprite_require_alive(L, s);
+  if (!PixelService::of(c).px) luaL_error(L, "pixels: sprite is not 16-bit");
+  LuaPixels* ud = static_cast<LuaPixels*>(lua_newuserdatauv(L, sizeof(LuaPixels), 1));
+  new (ud) LuaPixels();
+  luaL_setmetatable(L, kPixelsMT);
+  ud->sprite = s;
+  lua_pushvalue(L, 1);
+  lua_setiuservalue(L, -2, 1);
+  return 1;
+}
+
+// sprite:setPaletteColor(index, rgb565) on an indexed sprite.
+static int l_sprite_set_palette_color(lua_State* L) {
+  LuaSprite* s = lua_check_sprite(L, 1);
+  M5Canvas* c = lua_sprite_require_alive(L, s);
+  lua_Integer index = luaL_checkinteger(L, 2);
+  uint16_t color = lua_check_u16(L, 3);
+  if (!c->getPalette()) luaL_error(L, "sprite has no palette");
+  luaL_argcheck(L, index >= 0 && index < static_cast<lua_Integer>(c->getPaletteCount()), 2, "palette index out of range");
+  c->setPaletteColor(static_cast<size_t>(index), static_cast<uint8_t>((color >> 8) & 0xF8),
+                     static_cast<uint8_t>((color >> 3) & 0xFC), static_cast<uint8_t>((color << 3) & 0xF8));
+  return 0;
+}
+
+// sprite:depth() -> bits per pixel, and whether the sprite is palette-indexed
+static int l_sprite_depth(lua_State* L) {
+  LuaSprite* s = lua_check_sprite(L, 1);
+  M5Canvas* c = lua_sprite_require_alive(L, s);
+  lua_pushinteger(L, static_cast<lua_Integer>(c->getColorDepth() & lgfx::bit_mask));
+  lua_pushboolean(L, c->getPalette() != nullptr);
+  return 2;
+}
+
 static const luaL_Reg kSpriteMethods[] = {
     {"clear", l_sprite_clear},
     {"setTextColor", l_sprite_set_text_color},
@@ -118,29 +795,838 @@ static const luaL_Reg kSpriteMethods[] = {
     {"drawString", l_sprite_draw_string},
     {"drawCenterString", l_sprite_draw_center_string},
     {"push", l_sprite_push},
+    {"blit", l_sprite_blit},
+    {"blitRegion", l_sprite_blit_region},
+    {"blitRotateZoom", l_sprite_blit_rotate_zoom},
+    {"setPaletteColor", l_sprite_set_palette_color},
+    {"depth", l_sprite_depth},
+    {"pixels", l_sprite_pixels},
+    {"fillRect", l_prim_fill_rect},
+    {"drawLine", l_prim_draw_line},
+    {"hline", l_prim_hline},
+    {"vline", l_prim_vline},
+    {"drawRect", l_prim_draw_rect},
+    {"drawCircle", l_prim_draw_circle},
+    {"fillCircle", l_prim_fill_circle},
+    {"drawRoundRect", l_prim_draw_round_rect},
+    {"fillRoundRect", l_prim_fill_round_rect},
+    {"drawTriangle", l_prim_draw_triangle},
+    {"fillTriangle", l_prim_fill_triangle},
+    {"drawPolygon", l_prim_draw_polygon},
+    {"fillPolygon", l_prim_fill_polygon},
+    {"measure", l_prim_measure},
+    {"layout", l_prim_layout},
+    {"drawTextBox", l_prim_draw_text_box},
+    {"setScrollRect", l_prim_set_scroll_rect},
+    {"scroll", l_prim_scroll},
     {"free", l_sprite_free},
     {nullptr, nullptr},
 };
 
+// -------------------------------
+// gfx.batch userdata (retained draw-command list)
+// -------------------------------
+
+static const char* kBatchMT = "gfx.batch";
+
+struct LuaBatch {
+  std::vector<GfxService::DrawOp> ops;
+  std::vector<char> text;           // NUL-terminated strings referenced by text ops
+  std::vector<LuaSprite*> sprites;  // blit sources; the uservalue table keeps them alive
+};
+
+static LuaBatch* lua_check_batch(lua_State* L, int idx) {
+  return static_cast<LuaBatch*>(luaL_checkudata(L, idx, kBatchMT));
+}
+
+static int16_t lua_check_coord(lua_State* L, int idx) {
+  lua_Integer v = luaL_checkinteger(L, idx);
+  if (v < INT16_MIN) v = INT16_MIN;
+  if (v > INT16_MAX) v = INT16_MAX;
+  return static_cast<int16_t>(v);
+}
+
+static GfxService::DrawOp& lua_batch_push(LuaBatch* b, uint8_t type) {
+  b->ops.emplace_back();
+  GfxService::DrawOp& op = b->ops.back();
+  op.type = type;
+  return op;
+}
+
+// Shared by fillRect/drawRect: batch:fillRect(x, y, w, h, color)
+static int lua_batch_rect(lua_State* L, uint8_t type) {
+  LuaBatch* b = lua_check_batch(L, 1);
+  GfxService::DrawOp op;
+  op.type = type;
+  op.x = lua_check_coord(L, 2);
+  op.y = lua_check_coord(L, 3);
+  op.w = lua_check_coord(L, 4);
+  op.h = lua_check_coord(L, 5);
+  op.color = lua_check_u16(L, 6);
+  b->ops.push_back(op);
+  return 0;
+}
+
+static int l_batch_gc(lua_State* L) {
+  LuaBatch* b = lua_check_batch(L, 1);
+  b->~LuaBatch();
+  return 0;
+}
+
+static int l_batch_clear(lua_State* L) {
+  LuaBatch* b = lua_check_batch(L, 1);
+  uint16_t color = 0x0000;
+  if (lua_gettop(L) >= 2 && !lua_isnil(L, 2)) color = lua_check_u16(L, 2);
+  lua_batch_push(b, GfxService::DrawOp::kClear).color = color;
+  return 0;
+}
+
+static int l_batch_fill_rect(lua_State* L) {
+  return lua_batch_rect(L, GfxService::DrawOp::kFillRect);
+}
+
+static int l_batch_draw_rect(lua_State* L) {
+  return lua_batch_rect(L, GfxService::DrawOp::kDrawRect);
+}
+
+// batch:line(x0, y0, x1, y1, color)
+static int l_batch_line(lua_State* L) {
+  return lua_batch_rect(L, GfxService::DrawOp::kLine);
+}
+
+// batch:text(s, x, y, fg[, bg[, font]])
+static int l_batch_text(lua_State* L) {
+  LuaBatch* b = lua_check_batch(L, 1);
+  size_t len = 0;
+  const char* s = luaL_checklstring(L, 2, &len);
+  GfxService::DrawOp op;
+  op.type = GfxService::DrawOp::kText;
+  op.x = lua_check_coord(L, 3);
+  op.y = lua_check_coord(L, 4);
+  op.color = lua_check_u16(L, 5);
+  if (lua_gettop(L) >= 6 && !lua_isnil(L, 6)) {
+    op.bg = lua_check_u16(L, 6);
+    op.flags |= GfxService::DrawOp::kHasBg;
+  }
+  if (lua_gettop(L) >= 7 && !lua_isnil(L, 7)) {
+    lua_Integer font = luaL_checkinteger(L, 7);
+    luaL_argcheck(L, font >= 0 && font <= 127, 7, "font out of range");
+    op.font = static_cast<int8_t>(font);
+  }
+  op.arg = static_cast<uint32_t>(b->text.size());
+  b->text.insert(b->text.end(), s, s + len);
+  b->text.push_back('\0');
+  b->ops.push_back(op);
+  return 0;
+}
+
+// batch:blit(sprite, x, y[, transparent_color])
+static int l_batch_blit(lua_State* L) {
+  LuaBatch* b = lua_check_batch(L, 1);
+  LuaSprite* s = lua_check_sprite(L, 2);
+  GfxService::DrawOp op;
+  op.type = GfxService::DrawOp::kBlit;
+  op.x = lua_check_coord(L, 3);
+  op.y = lua_check_coord(L, 4);
+  if (lua_gettop(L) >= 5 && !lua_isnil(L, 5)) {
+    op.bg = lua_check_u16(L, 5);
+    op.flags |= GfxService::DrawOp::kTransparent;
+  }
+
+  size_t slot = 0;
+  while (slot < b->sprites.size() && b->sprites[slot] != s) slot++;
+  if (slot == b->sprites.size()) {
+    b->sprites.push_back(s);
+    lua_getiuservalue(L, 1, 1);
+    lua_pushvalue(L, 2);
+    lua_rawseti(L, -2, static_cast<lua_Integer>(slot + 1));
+    lua_pop(L, 1);
+  }
+  op.arg = static_cast<uint32_t>(slot);
+  b->ops.push_back(op);
+  return 0;
+}
+
+static int l_batch_reset(lua_State* L) {
+  LuaBatch* b = lua_check_batch(L, 1);
+  b->ops.clear();
+  b->text.clear();
+  b->sprites.clear();
+  lua_newtable(L);
+  lua_setiuservalue(L, 1, 1);
+  return 0;
+}
+
+static int l_batch_count(lua_State* L) {
+  LuaBatch* b = lua_check_batch(L, 1);
+  lua_pushinteger(L, static_cast<lua_Integer>(b->ops.size()));
+  return 1;
+}
+
+// batch:submit([sprite]) draws the list onto the screen (or a sprite) and
+// keeps it, so a static layer can be submitted again every frame.
+// Returns the number of primitives drawn after culling and merging.
+static int l_batch_submit(lua_State* L) {
+  LuaBatch* b = lua_check_batch(L, 1);
+  M5Canvas* dst = nullptr;
+  if (lua_gettop(L) >= 2 && !lua_isnil(L, 2)) dst = lua_sprite_require_alive(L, lua_check_sprite(L, 2));
+
+  // Resolve sprites now: any of them may have been freed since it was added.
+  M5Canvas* stack_sprites[8];
+  std::vector<M5Canvas*> heap_sprites;
+  M5Canvas** sprites = stack_sprites;
+  if (b->sprites.size() > 8) {
+    heap_sprites.resize(b->sprites.size());
+    sprites = heap_sprites.data();
+  }
+  for (size_t i = 0; i < b->sprites.size(); i++) sprites[i] = b->sprites[i]->canvas;
+
+  const uint32_t drawn = GfxService::drawBatch(b->ops.data(), b->ops.size(), b->text.data(), sprites, dst);
+  lua_pushinteger(L, static_cast<lua_Integer>(drawn));
+  return 1;
+}
+
+static const luaL_Reg kBatchMethods[] = {
+    {"clear", l_batch_clear},
+    {"fillRect", l_batch_fill_rect},
+    {"drawRect", l_batch_draw_rect},
+    {"line", l_batch_line},
+    {"text", l_batch_text},
+    {"blit", l_batch_blit},
+    {"reset", l_batch_reset},
+    {"count", l_batch_count},
+    {"submit", l_batch_submit},
+    {nullptr, nullptr},
+};
+
+// gfx.newBatch([capacity])
+static int l_gfx_new_batch(lua_State* L) {
+  lua_Integer capacity = luaL_optinteger(L, 1, 0);
+  luaL_argcheck(L, capacity >= 0 && capacity <= 4096, 1, "capacity out of range");
+
+  LuaBatch* ud = static_cast<LuaBatch*>(lua_newuserdatauv(L, sizeof(LuaBatch), 1));
+  new (ud) LuaBatch();
+  luaL_setmetatable(L, kBatchMT);
+  if (capacity) ud->ops.reserve(static_cast<size_t>(capacity));
+
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, 1);
+  return 1;
+}
+
+// -------------------------------
+// gfx.tilemap userdata
+// -------------------------------
+
+static const char* kTilemapMT = "gfx.tilemap";
+
+// Cells are 0-based like pixel coordinates. 0 is empty; n draws tile n - 1 of
+// the tileset. Cells are stored as bytes unless the tileset has more than
+// 255 tiles.
+struct LuaTilemap {
+  LuaSprite* tileset = nullptr;  // kept alive by the uservalue
+  std::vector<uint8_t> cells8;
+  std::vector<uint16_t> cells16;
+  GfxService::TileLayer layer;
+  uint16_t max_cell = 0;
+};
+
+static LuaTilemap* lua_check_tilemap(lua_State* L, int idx) {
+  return static_cast<LuaTilemap*>(luaL_checkudata(L, idx, kTilemapMT));
+}
+
+static size_t lua_tilemap_check_cell(lua_State* L, LuaTilemap* m, int idx) {
+  lua_Integer cx = luaL_checkinteger(L, idx);
+  lua_Integer cy = luaL_checkinteger(L, idx + 1);
+  if (cx < 0 || cy < 0 || cx >= m->layer.cols || cy >= m->layer.rows) luaL_error(L, "tilemap: cell out of range");
+  return static_cast<size_t>(cy * m->layer.cols + cx);
+}
+
+static uint16_t lua_tilemap_check_value(lua_State* L, LuaTilemap* m, int idx) {
+  lua_Integer v = luaL_checkinteger(L, idx);
+  luaL_argcheck(L, v >= 0 && v <= m->max_cell, idx, "tile index out of range");
+  return static_cast<uint16_t>(v);
+}
+
+static int l_tilemap_gc(lua_State* L) {
+  LuaTilemap* m = lua_check_tilemap(L, 1);
+  m->~LuaTilemap();
+  return 0;
+}
+
+// tilemap:set(cx, cy, tile)
+static int l_tilemap_set(lua_State* L) {
+  LuaTilemap* m = lua_check_tilemap(L, 1);
+  const size_t i = lua_tilemap_check_cell(L, m, 2);
+  const uint16_t v = lua_tilemap_check_value(L, m, 4);
+  if (!m->cells8.empty()) {
+    m->cells8[i] = static_cast<uint8_t>(v);
+  } else {
+    m->cells16[i] = v;
+  }
+  return 0;
+}
+
+static int l_tilemap_get(lua_State* L) {
+  LuaTilemap* m = lua_check_tilemap(L, 1);
+  const size_t i = lua_tilemap_check_cell(L, m, 2);
+  lua_pushinteger(L, m->cells8.empty() ? m->cells16[i] : m->cells8[i]);
+  return 1;
+}
+
+// tilemap:fill(tile[, cx, cy, w, h])
+static int l_tilemap_fill(lua_State* L) {
+  LuaTilemap* m = lua_check_tilemap(L, 1);
+  const uint16_t v = lua_tilemap_check_value(L, m, 2);
+  int32_t x0 = static_cast<int32_t>(luaL_optinteger(L, 3, 0));
+  int32_t y0 = static_cast<int32_t>(luaL_optinteger(L, 4, 0));
+  int32_t x1 = x0 + static_cast<int32_t>(luaL_optinteger(L, 5, m->layer.cols));
+  int32_t y1 = y0 + static_cast<int32_t>(luaL_optinteger(L, 6, m->layer.rows));
+  x0 = std::max<int32_t>(x0, 0);
+  y0 = std::max<int32_t>(y0, 0);
+  x1 = std::min(x1, m->layer.cols);
+  y1 = std::min(y1, m->layer.rows);
+  if (x1 <= x0 || y1 <= y0) return 0;
+  for (int32_t cy = y0; cy < y1; cy++) {
+    const size_t row = static_cast<size_t>(cy * m->layer.cols);
+    if (!m->cells8.empty()) {
+      memset(&m->cells8[row + x0], v, static_cast<size_t>(x1 - x0));
+    } else {
+      std::fill(m->cells16.begin() + row + x0, m->cells16.begin() + row + x1, v);
+    }
+  }
+  return 0;
+}
+
+// tilemap:setScroll(px, py): map pixel shown at the viewport's top-left.
+static int l_tilemap_set_scroll(lua_State* L) {
+  LuaTilemap* m = lua_check_tilemap(L, 1);
+  m->layer.scroll_x = static_cast<int32_t>(luaL_checkinteger(L, 2));
+  m->layer.scroll_y = static_cast<int32_t>(luaL_checkinteger(L, 3));
+  return 0;
+}
+
+static int l_tilemap_scroll(lua_State* L) {
+  LuaTilemap* m = lua_check_tilemap(L, 1);
+  lua_pushinteger(L, m->layer.scroll_x);
+  lua_pushinteger(L, m->layer.scroll_y);
+  return 2;
+}
+
+static int l_tilemap_size(lua_State* L) {
+  LuaTilemap* m = lua_check_tilemap(L, 1);
+  lua_pushinteger(L, m->layer.cols);
+  lua_pushinteger(L, m->layer.rows);
+  return 2;
+}
+
+// tilemap:draw([sprite][, x, y, w, h]) renders into the screen or a sprite,
+// within the given viewport (the whole target by default). Returns tiles drawn.
+static int l_tilemap_draw(lua_State* L) {
+  LuaTilemap* m = lua_check_tilemap(L, 1);
+  M5Canvas* dst = nullptr;
+  int arg = 2;
+  if (lua_isuserdata(L, 2)) {
+    dst = lua_sprite_require_alive(L, lua_check_sprite(L, 2));
+    arg = 3;
+  } else if (lua_isnil(L, 2)) {
+    arg = 3;
+  }
+  const int32_t tw = dst ? dst->width() : GfxService::width();
+  const int32_t th = dst ? dst->height() : GfxService::height();
+  const int32_t x = static_cast<int32_t>(luaL_optinteger(L, arg, 0));
+  const int32_t y = static_cast<int32_t>(luaL_optinteger(L, arg + 1, 0));
+  const int32_t w = static_cast<int32_t>(luaL_optinteger(L, arg + 2, tw - x));
+  const int32_t h = static_cast<int32_t>(luaL_optinteger(L, arg + 3, th - y));
+
+  m->layer.tileset = lua_sprite_require_alive(L, m->tileset);
+  const uint32_t drawn = GfxService::drawTiles(m->layer, x, y, w, h, dst);
+  lua_pushinteger(L, static_cast<lua_Integer>(drawn));
+  return 1;
+}
+
+static const luaL_Reg kTilemapMethods[] = {
+    {"set", l_tilemap_set},
+    {"get", l_tilemap_get},
+    {"fill", l_tilemap_fill},
+    {"setScroll", l_tilemap_set_scroll},
+    {"scroll", l_tilemap_scroll},
+    {"size", l_tilemap_size},
+    {"draw", l_tilemap_draw},
+    {nullptr, nullptr},
+};
+
+// gfx.newTilemap(tileset_sprite, w, h, tile_w, tile_h)
+static int l_gfx_new_tilemap(lua_State* L) {
+  LuaSprite* ts = lua_check_sprite(L, 1);
+  M5Canvas* c = lua_sprite_require_alive(L, ts);
+  const lua_Integer cols = luaL_checkinteger(L, 2);
+  const lua_Integer rows = luaL_checkinteger(L, 3);
+  const lua_Integer tw = luaL_checkinteger(L, 4);
+  const lua_Integer th = luaL_checkinteger(L, 5);
+  if (cols <= 0 || rows <= 0 || cols * rows > 65536) luaL_error(L, "newTilemap: map must be 1..65536 cells");
+  if (tw <= 0 || th <= 0 || tw > c->width() || th > c->height()) luaL_error(L, "newTilemap: bad tile size");
+
+  const lua_Integer tiles = (c->width() / tw) * (c->height() / th);
+
+  LuaTilemap* ud = static_cast<LuaTilemap*>(lua_newuserdatauv(L, sizeof(LuaTilemap), 1));
+  new (ud) LuaTilemap();
+  luaL_setmetatable(L, kTilemapMT);
+
+  const size_t n = static_cast<size_t>(cols * rows);
+  if (tiles <= 0xFF) {
+    ud->cells8.assign(n, 0);
+    ud->layer.cells8 = ud->cells8.data();
+  } else {
+    ud->cells16.assign(n, 0);
+    ud->layer.cells16 = ud->cells16.data();
+  }
+  ud->max_cell = static_cast<uint16_t>(std::min<lua_Integer>(tiles, 0xFFFF));
+  ud->tileset = ts;
+  ud->layer.tileset = c;
+  ud->layer.cols = static_cast<int32_t>(cols);
+  ud->layer.rows = static_cast<int32_t>(rows);
+  ud->layer.tile_w = static_cast<int32_t>(tw);
+  ud->layer.tile_h = static_cast<int32_t>(th);
+
+  lua_pushvalue(L, 1);
+  lua_setiuservalue(L, -2, 1);
+  return 1;
+}
+
+// -------------------------------
+// gfx.compositor userdata (z-ordered sprite layers)
+// -------------------------------
+
+static const char* kCompositorMT = "gfx.compositor";
+
+// Layers are drawn in ascending z, ties in the order they were added. Moving,
+// hiding, re-keying or re-ordering a layer marks the screen area it covered
+// and now covers; changes to a sprite's pixels are reported with invalidate().
+struct LuaCompositorLayer {
+  int32_t id = 0;
+  int32_t z = 0;
+  LuaSprite* sprite = nullptr;  // kept alive by the uservalue
+  GfxService::Layer layer;
+  GfxService::Rect shown{0, 0, 0, 0};  // area covered at the last composite
+  bool changed = true;
+};
+
+struct LuaCompositor {
+  std::vector<LuaCompositorLayer> layers;
+  std::vector<GfxService::Rect> pending;  // extra areas to rebuild
+  uint16_t background = 0x0000;
+  int32_t next_id = 1;
+  bool full = true;  // rebuild the whole target on the next composite
+};
+
+static LuaCompositor* lua_check_compositor(lua_State* L, int idx) {
+  return static_cast<LuaCompositor*>(luaL_checkudata(L, idx, kCompositorMT));
+}
+
+static LuaCompositorLayer& lua_compositor_check_layer(lua_State* L, LuaCompositor* c, int idx) {
+  const lua_Integer id = luaL_checkinteger(L, idx);
+  for (LuaCompositorLayer& l : c->layers) {
+    if (l.id == id) return l;
+  }
+  luaL_error(L, "compositor: no layer %d", static_cast<int>(id));
+  return c->layers.front();  // not reached
+}
+
+static void lua_compositor_sort(LuaCompositor* c) {
+  std::stable_sort(c->layers.begin(), c->layers.end(),
+                   [](const LuaCompositorLayer& a, const LuaCompositorLayer& b) { return a.z < b.z; });
+}
+
+static int l_compositor_gc(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  c->~LuaCompositor();
+  return 0;
+}
+
+// compositor:add(sprite, x, y[, key[, z]]) -> layer id
+static int l_compositor_add(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  LuaSprite* s = lua_check_sprite(L, 2);
+  lua_sprite_require_alive(L, s);
+  LuaCompositorLayer l;
+  l.id = c->next_id++;
+  l.sprite = s;
+  l.layer.x = lua_check_i32(L, 3);
+  l.layer.y = lua_check_i32(L, 4);
+  l.layer.transparent = lua_opt_transparent(L, 5);
+  l.z = static_cast<int32_t>(luaL_optinteger(L, 6, 0));
+  c->layers.push_back(l);
+  lua_compositor_sort(c);
+
+  lua_getiuservalue(L, 1, 1);
+  lua_pushvalue(L, 2);
+  lua_rawseti(L, -2, l.id);
+  lua_pop(L, 1);
+  lua_pushinteger(L, l.id);
+  return 1;
+}
+
+// compositor:remove(id)
+static int l_compositor_remove(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  LuaCompositorLayer& l = lua_compositor_check_layer(L, c, 2);
+  if (l.shown.w > 0) c->pending.push_back(l.shown);
+  const int32_t id = l.id;
+  c->layers.erase(c->layers.begin() + (&l - c->layers.data()));
+
+  lua_getiuservalue(L, 1, 1);
+  lua_pushnil(L);
+  lua_rawseti(L, -2, id);
+  lua_pop(L, 1);
+  return 0;
+}
+
+// compositor:move(id, x, y)
+static int l_compositor_move(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  LuaCompositorLayer& l = lua_compositor_check_layer(L, c, 2);
+  const int32_t x = lua_check_i32(L, 3);
+  const int32_t y = lua_check_i32(L, 4);
+  if (x != l.layer.x || y != l.layer.y) {
+    l.layer.x = x;
+    l.layer.y = y;
+    l.changed = true;
+  }
+  return 0;
+}
+
+// compositor:setVisible(id, visible)
+static int l_compositor_set_visible(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  LuaCompositorLayer& l = lua_compositor_check_layer(L, c, 2);
+  const bool visible = lua_toboolean(L, 3);
+  if (visible != l.layer.visible) {
+    l.layer.visible = visible;
+    l.changed = true;
+  }
+  return 0;
+}
+
+// compositor:setKey(id[, key]); no key makes the layer opaque.
+static int l_compositor_set_key(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  LuaCompositorLayer& l = lua_compositor_check_layer(L, c, 2);
+  l.layer.transparent = lua_opt_transparent(L, 3);
+  l.changed = true;
+  return 0;
+}
+
+// compositor:setZ(id, z)
+static int l_compositor_set_z(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  LuaCompositorLayer& l = lua_compositor_check_layer(L, c, 2);
+  const int32_t z = static_cast<int32_t>(luaL_checkinteger(L, 3));
+  if (z != l.z) {
+    l.z = z;
+    l.changed = true;
+    lua_compositor_sort(c);
+  }
+  return 0;
+}
+
+// compositor:invalidate() marks the whole target; invalidate(id) the layer;
+// invalidate(id, x, y, w, h) part of the layer, in sprite coordinates.
+static int l_compositor_invalidate(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  if (lua_isnoneornil(L, 2)) {
+    c->full = true;
+    return 0;
+  }
+  LuaCompositorLayer& l = lua_compositor_check_layer(L, c, 2);
+  if (lua_isnoneornil(L, 3)) {
+    l.changed = true;
+    return 0;
+  }
+  c->pending.push_back(GfxService::Rect{l.layer.x + lua_check_i32(L, 3), l.layer.y + lua_check_i32(L, 4),
+                                        lua_check_i32(L, 5), lua_check_i32(L, 6)});
+  return 0;
+}
+
+// compositor:setBackground(rgb565)
+static int l_compositor_set_background(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  c->background = lua_check_u16(L, 2);
+  c->full = true;
+  return 0;
+}
+
+// compositor:composite([sprite]) -> pixels written
+// Rebuilds every area marked since the last call, onto the screen or `sprite`.
+static int l_compositor_composite(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  M5Canvas* dst = lua_opt_target(L, 2);
+
+  std::vector<GfxService::Rect>& rects = c->pending;
+  if (c->full) {
+    rects.clear();
+    rects.push_back(GfxService::Rect{0, 0, dst ? dst->width() : GfxService::width(),
+                                     dst ? dst->height() : GfxService::height()});
+  }
+
+  std::vector<GfxService::Layer> layers;
+  layers.reserve(c->layers.size());
+  for (LuaCompositorLayer& l : c->layers) {
+    l.layer.sprite = l.sprite->canvas;  // null once the sprite is freed
+    GfxService::Rect now{0, 0, 0, 0};
+    if (l.layer.sprite && l.layer.visible) {
+      now = GfxService::Rect{l.layer.x, l.layer.y, l.layer.sprite->width(), l.layer.sprite->height()};
+    }
+    const bool moved = now.x != l.shown.x || now.y != l.shown.y || now.w != l.shown.w || now.h != l.shown.h;
+    if (!c->full && (l.changed || moved)) {
+      if (l.shown.w > 0) rects.push_back(l.shown);
+      if (now.w > 0) rects.push_back(now);
+    }
+    l.shown = now;
+    l.changed = false;
+    layers.push_back(l.layer);
+  }
+
+  const uint32_t pixels =
+      GfxService::composite(layers.data(), layers.size(), rects.data(), rects.size(), c->background, dst);
+  rects.clear();
+  c->full = false;
+  lua_pushinteger(L, static_cast<lua_Integer>(pixels));
+  return 1;
+}
+
+// compositor:count() -> layers
+static int l_compositor_count(lua_State* L) {
+  LuaCompositor* c = lua_check_compositor(L, 1);
+  lua_pushinteger(L, static_cast<lua_Integer>(c->layers.size()));
+  return 1;
+}
+
+static const luaL_Reg kCompositorMethods[] = {
+    {"add", l_compositor_add},
+    {"remove", l_compositor_remove},
+    {"move", l_compositor_move},
+    {"setVisible", l_compositor_set_visible},
+    {"setKey", l_compositor_set_key},
+    {"setZ", l_compositor_set_z},
+    {"invalidate", l_compositor_invalidate},
+    {"setBackground", l_compositor_set_background},
+    {"composite", l_compositor_composite},
+    {"count", l_compositor_count},
+    {nullptr, nullptr},
+};
+
+// gfx.newCompositor([background])
+static int l_gfx_new_compositor(lua_State* L) {
+  const uint16_t background = lua_isnoneornil(L, 1) ? 0x0000 : lua_check_u16(L, 1);
+  LuaCompositor* ud = static_cast<LuaCompositor*>(lua_newuserdatauv(L, sizeof(LuaCompositor), 1));
+  new (ud) LuaCompositor();
+  luaL_setmetatable(L, kCompositorMT);
+  ud->background = background;
+
+  lua_newtable(L);
+  lua_setiuservalue(L, -2, 1);
+  return 1;
+}
+
+static int l_gfx_composite_stats(lua_State* L) {
+  const GfxService::CompositeStats& s = GfxService::compositeStats();
+  lua_createtable(L, 0, 6);
+  lua_pushinteger(L, static_cast<lua_Integer>(s.rects));
+  lua_setfield(L, -2, "rects");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.pixels));
+  lua_setfield(L, -2, "pixels");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.bytes));
+  lua_setfield(L, -2, "bytes");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.layers));
+  lua_setfield(L, -2, "layers");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.spans));
+  lua_setfield(L, -2, "spans");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.us));
+  lua_setfield(L, -2, "us");
+  return 1;
+}
+
+// gfx.newSprite(w, h[, {depth = 1|2|4|8|16, palette = {rgb565, ...}}])
+//
+// Depths 1, 2 and 4 are always palette-indexed (a grey ramp unless a palette
+// is given); 8 is RGB332 without a palette and indexed with one. Drawing
+// colours on an indexed sprite are palette indices.
 static int l_gfx_new_sprite(lua_State* L) {
   int32_t w = static_cast<int32_t>(luaL_checkinteger(L, 1));
   int32_t h = static_cast<int32_t>(luaL_checkinteger(L, 2));
   if (w <= 0 || h <= 0) luaL_error(L, "newSprite: width and height must be > 0");
 
+  lua_Integer depth = 16;
+  uint16_t palette[256];
+  lua_Integer palette_count = 0;
+  if (!lua_isnoneornil(L, 3)) {
+    luaL_checktype(L, 3, LUA_TTABLE);
+    if (lua_getfield(L, 3, "depth") != LUA_TNIL) depth = luaL_checkinteger(L, -1);
+    lua_pop(L, 1);
+    if (depth != 1 && depth != 2 && depth != 4 && depth != 8 && depth != 16) {
+      luaL_error(L, "newSprite: depth must be 1, 2, 4, 8 or 16");
+    }
+    if (lua_getfield(L, 3, "palette") != LUA_TNIL) {
+      luaL_checktype(L, -1, LUA_TTABLE);
+      palette_count = luaL_len(L, -1);
+      if (depth > 8 || palette_count < 1 || palette_count > (1 << depth)) {
+        luaL_error(L, "newSprite: palette needs 1..2^depth colours and depth <= 8");
+      }
+      for (lua_Integer i = 0; i < palette_count; i++) {
+        lua_geti(L, -1, i + 1);
+        palette[i] = lua_check_u16(L, -1);
+        lua_pop(L, 1);
+      }
+    }
+    lua_pop(L, 1);
+  }
+
   LuaSprite* ud = static_cast<LuaSprite*>(lua_newuserdatauv(L, sizeof(LuaSprite), 0));
   new (ud) LuaSprite();
 
-  // Create canvas (parented to the real display).
-  ud->canvas = new (std::nothrow) M5Canvas(&M5Cardputer.Display);
-  if (!ud->canvas) luaL_error(L, "newSprite: OOM allocating canvas");
+  // Pixels come from the buffer pool; rows are whole bytes, as M5GFX lays
+  // them out in createSprite.
+  const size_t bytes = static_cast<size_t>((w * depth + 7) / 8) * static_cast<size_t>(h);
+  ud->buffer = BufferService::acquire(bytes);
+  if (!ud->buffer) luaL_error(L, "newSprite: out of memory for %dx%d", static_cast<int>(w), static_cast<int>(h));
+  ud->buffer_bytes = bytes;
+  memset(ud->buffer, 0, bytes);  // pooled buffers are dirty; createSprite cleared
 
-  bool ok = ud->canvas->createSprite(w, h);
+  // Canvas in the userdata (parented to the real display).
+  ud->canvas = new (ud->storage) M5Canvas(&M5Cardputer.Display);
+  luaL_setmetatable(L, kSpriteMT);  // __gc now returns the buffer
+  ud->canvas->setColorDepth(static_cast<uint8_t>(depth));
+  ud->canvas->setBuffer(ud->buffer, w, h, static_cast<lgfx::color_depth_t>(depth));
+  bool ok = true;
+  if (palette_count) {
+    ok = ud->canvas->createPalette(palette, static_cast<uint32_t>(palette_count));
+  } else if (depth < 8) {
+    ok = ud->canvas->createPalette();
+  }
   if (!ok) {
     lua_sprite_free(ud);
-    luaL_error(L, "newSprite: createSprite failed");
+    luaL_error(L, "newSprite: createPalette failed");
   }
+  return 1;
+}
+
+// gfx.loadImage(path) -> sprite, or nil and an error message.
+static int l_gfx_load_image(lua_State* L) {
+  const char* path = luaL_checkstring(L, 1);
 
+  // Allocate the userdata first so a Lua OOM can't leak the canvas.
+  LuaSprite* ud = static_cast<LuaSprite*>(lua_newuserdatauv(L, sizeof(LuaSprite), 0));
+  new (ud) LuaSprite();
   luaL_setmetatable(L, kSpriteMT);
+
+  String err;
+  ud->canvas = ImageService::load(path, err);
+  if (!ud->canvas) {
+    lua_pushnil(L);
+    lua_pushstring(L, err.c_str());
+    return 2;
+  }
+  return 1;
+}
+
+// gfx.imageStats() -> {coldLoads, cachedLoads, failures, coldMs, cachedMs}
+// (the ms fields are averages per image).
+static int l_gfx_image_stats(lua_State* L) {
+  const ImageService::Stats& s = ImageService::stats();
+  lua_createtable(L, 0, 5);
+  lua_pushinteger(L, static_cast<lua_Integer>(s.cold_loads));
+  lua_setfield(L, -2, "coldLoads");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.cached_loads));
+  lua_setfield(L, -2, "cachedLoads");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.failures));
+  lua_setfield(L, -2, "failures");
+  lua_pushnumber(L, s.cold_loads ? static_cast<lua_Number>(s.cold_us) / 1000.0 / s.cold_loads : 0.0);
+  lua_setfield(L, -2, "coldMs");
+  lua_pushnumber(L, s.cached_loads ? static_cast<lua_Number>(s.cached_us) / 1000.0 / s.cached_loads : 0.0);
+  lua_setfield(L, -2, "cachedMs");
+  return 1;
+}
+
+// gfx.spriteStats() -> {acquires, hits, failures, trims, inUse, inUseBytes,
+// pooled, pooledBytes, highWaterBytes}: the newSprite buffer pool.
+static int l_gfx_sprite_stats(lua_State* L) {
+  const BufferService::Stats& s = BufferService::stats();
+  lua_createtable(L, 0, 9);
+  lua_pushinteger(L, static_cast<lua_Integer>(s.acquires));
+  lua_setfield(L, -2, "acquires");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.hits));
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.failures));
+  lua_setfield(L, -2, "failures");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.trims));
+  lua_setfield(L, -2, "trims");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.in_use));
+  lua_setfield(L, -2, "inUse");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.in_use_bytes));
+  lua_setfield(L, -2, "inUseBytes");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.pooled));
+  lua_setfield(L, -2, "pooled");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.pooled_bytes));
+  lua_setfield(L, -2, "pooledBytes");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.high_water_bytes));
+  lua_setfield(L, -2, "highWaterBytes");
+  return 1;
+}
+
+// gfx.setRenderMode("sync" | "threaded") -> mode in effect
+static int l_gfx_set_render_mode(lua_State* L) {
+  static const char* const kModes[] = {"sync", "threaded", nullptr};
+  const int mode = luaL_checkoption(L, 1, nullptr, kModes);
+  const GfxService::RenderMode in_effect = GfxService::setRenderMode(static_cast<GfxService::RenderMode>(mode));
+  lua_pushstring(L, kModes[static_cast<int>(in_effect)]);
+  return 1;
+}
+
+static int l_gfx_render_mode(lua_State* L) {
+  lua_pushstring(L, GfxService::renderMode() == GfxService::RenderMode::kThreaded ? "threaded" : "sync");
+  return 1;
+}
+
+// gfx.renderStats() -> {frames, commands, renderUs, waitUs, syncs, ringPeak, ringBytes}
+static int l_gfx_render_stats(lua_State* L) {
+  const GfxService::RenderStats& s = GfxService::renderStats();
+  lua_createtable(L, 0, 7);
+  lua_pushinteger(L, static_cast<lua_Integer>(s.frames));
+  lua_setfield(L, -2, "frames");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.commands));
+  lua_setfield(L, -2, "commands");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.render_us));
+  lua_setfield(L, -2, "renderUs");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.wait_us));
+  lua_setfield(L, -2, "waitUs");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.syncs));
+  lua_setfield(L, -2, "syncs");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.ring_peak));
+  lua_setfield(L, -2, "ringPeak");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.ring_bytes));
+  lua_setfield(L, -2, "ringBytes");
+  return 1;
+}
+
+// gfx.textCacheStats() -> {hits, misses, bypasses, evictions, entries, bytes, budget}
+static int l_gfx_text_cache_stats(lua_State* L) {
+  const GfxService::TextCacheStats& s = GfxService::textCacheStats();
+  lua_createtable(L, 0, 7);
+  lua_pushinteger(L, static_cast<lua_Integer>(s.hits));
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.misses));
+  lua_setfield(L, -2, "misses");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.bypasses));
+  lua_setfield(L, -2, "bypasses");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.evictions));
+  lua_setfield(L, -2, "evictions");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.entries));
+  lua_setfield(L, -2, "entries");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.bytes));
+  lua_setfield(L, -2, "bytes");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.budget));
+  lua_setfield(L, -2, "budget");
   return 1;
 }
 
@@ -231,8 +1717,53 @@ static int l_gfx_height(lua_State* L) {
   return 1;
 }
 
+// gfx.setFramebuffer(mode): true/1 = one buffer, 2 = double-buffered, false/0 = off.
+// Returns the mode actually in effect.
+static int l_gfx_set_framebuffer(lua_State* L) {
+  lua_Integer buffers;
+  if (lua_isboolean(L, 1) || lua_isnoneornil(L, 1)) {
+    buffers = lua_toboolean(L, 1) ? 1 : 0;
+  } else {
+    buffers = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, buffers >= 0 && buffers <= 2, 1, "expected 0, 1 or 2");
+  }
+  lua_pushinteger(L, GfxService::setFramebuffer(static_cast<uint8_t>(buffers)));
+  return 1;
+}
+
+static int l_gfx_framebuffer(lua_State* L) {
+  lua_pushinteger(L, GfxService::framebuffer());
+  return 1;
+}
+
+static int l_gfx_damage(lua_State* L) {
+  const GfxService::DamageStats& d = GfxService::damageStats();
+  lua_createtable(L, 0, 7);
+  lua_pushinteger(L, static_cast<lua_Integer>(d.rects));
+  lua_setfield(L, -2, "rects");
+  lua_pushinteger(L, static_cast<lua_Integer>(d.pixels));
+  lua_setfield(L, -2, "pixels");
+  lua_pushinteger(L, static_cast<lua_Integer>(d.bytes));
+  lua_setfield(L, -2, "bytes");
+  lua_pushinteger(L, static_cast<lua_Integer>(d.total_bytes));
+  lua_setfield(L, -2, "totalBytes");
+  lua_pushinteger(L, static_cast<lua_Integer>(d.frames));
+  lua_setfield(L, -2, "frames");
+  lua_pushinteger(L, static_cast<lua_Integer>(d.flush_us));
+  lua_setfield(L, -2, "flushUs");
+  lua_pushinteger(L, static_cast<lua_Integer>(d.dma_wait_us));
+  lua_setfield(L, -2, "dmaWaitUs");
+  return 1;
+}
+
 static const luaL_Reg kGfxLib[] = {
     {"newSprite", l_gfx_new_sprite},
+    {"newBatch", l_gfx_new_batch},
+    {"newTilemap", l_gfx_new_tilemap},
+    {"newCompositor", l_gfx_new_compositor},
+    {"loadImage", l_gfx_load_image},
+    {"imageStats", l_gfx_image_stats},
+    {"spriteStats", l_gfx_sprite_stats},
     {"clear", l_gfx_clear},
     {"setCursor", l_gfx_set_cursor},
     {"setTextSize", l_gfx_set_text_size},
@@ -241,9 +1772,34 @@ static const luaL_Reg kGfxLib[] = {
     {"println", l_gfx_println},
     {"drawString", l_gfx_draw_string},
     {"fillRect", l_gfx_fill_rect},
+    {"drawLine", l_prim_draw_line},
+    {"hline", l_prim_hline},
+    {"vline", l_prim_vline},
+    {"drawRect", l_prim_draw_rect},
+    {"drawCircle", l_prim_draw_circle},
+    {"fillCircle", l_prim_fill_circle},
+    {"drawRoundRect", l_prim_draw_round_rect},
+    {"fillRoundRect", l_prim_fill_round_rect},
+    {"drawTriangle", l_prim_draw_triangle},
+    {"fillTriangle", l_prim_fill_triangle},
+    {"drawPolygon", l_prim_draw_polygon},
+    {"fillPolygon", l_prim_fill_polygon},
+    {"measure", l_prim_measure},
+    {"layout", l_prim_layout},
+    {"drawTextBox", l_prim_draw_text_box},
+    {"setScrollRect", l_prim_set_scroll_rect},
+    {"scroll", l_prim_scroll},
     {"drawCenterString", l_gfx_draw_center_string},
     {"width", l_gfx_width},
     {"height", l_gfx_height},
+    {"setFramebuffer", l_gfx_set_framebuffer},
+    {"framebuffer", l_gfx_framebuffer},
+    {"setRenderMode", l_gfx_set_render_mode},
+    {"renderMode", l_gfx_render_mode},
+    {"renderStats", l_gfx_render_stats},
+    {"damage", l_gfx_damage},
+    {"textCacheStats", l_gfx_text_cache_stats},
+    {"compositeStats", l_gfx_composite_stats},
     {nullptr, nullptr},
 };
 
@@ -260,8 +1816,49 @@ int luaopen_gfx(lua_State* L) {
   }
   lua_pop(L, 1);  // pop metatable
 
+  // Create gfx.pixels metatable (trivially destructible, no __gc).
+  if (luaL_newmetatable(L, kPixelsMT)) {
+    luaL_newlib(L, kPixelsMethods);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_pop(L, 1);  // pop metatable
+
+  // Create gfx.batch metatable.
+  if (luaL_newmetatable(L, kBatchMT)) {
+    luaL_newlib(L, kBatchMethods);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushcfunction(L, l_batch_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_pop(L, 1);  // pop metatable
+
+  // Create gfx.tilemap metatable.
+  if (luaL_newmetatable(L, kTilemapMT)) {
+    luaL_newlib(L, kTilemapMethods);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushcfunction(L, l_tilemap_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_pop(L, 1);  // pop metatable
+
+  // Create gfx.compositor metatable.
+  if (luaL_newmetatable(L, kCompositorMT)) {
+    luaL_newlib(L, kCompositorMethods);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushcfunction(L, l_compositor_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_pop(L, 1);  // pop metatable
+
   luaL_newlib(L, kGfxLib);
   return 1;
 }
 
+M5Canvas* lua_gfx_opt_sprite(lua_State* L, int idx) {
+  return lua_opt_target(L, idx);
+}
+
 
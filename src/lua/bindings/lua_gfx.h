@@ -3,7 +3,13 @@
 // C++ convenience header that wraps the Lua C headers in 'extern "C"'.
 #include "lua.hpp"
 
+#include "M5Cardputer.h"
+
 // Lua module entrypoint: local gfx = require("gfx")
 int luaopen_gfx(lua_State* L);
 
+// The canvas of the gfx.sprite at `idx` (raising an error if it was freed),
+// or nullptr when the argument is nil or absent. For other modules that draw
+// into sprites.
+M5Canvas* lua_gfx_opt_sprite(lua_State* L, int idx);
 
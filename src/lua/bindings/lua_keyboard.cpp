@@ -25,11 +25,146 @@ static int l_keyboard_get_key(lua_State* L) {
     return 1;
 }
 
+static const char* const kEventTypes[] = {"press", "release", "repeat"};
+
+// keyboard.poll([events]) -> events, n
+// Drains every queued event into an array of {type, key, x, y, time}
+// (type "press" | "release" | "repeat", time in microseconds since the app was
+// loaded). Pass the table from the previous call to reuse it and its event
+// tables; entries past n are cleared.
+// With 32-bit Lua integers (the f32 build) time wraps to negative after about
+// 35 minutes: the difference between two events stays correct, but comparing
+// times across the wrap doesn't.
+static int l_keyboard_poll(lua_State* L) {
+    if (lua_isnoneornil(L, 1)) {
+        lua_createtable(L, static_cast<int>(KeyboardService::pending()), 0);
+    } else {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        lua_settop(L, 1);
+    }
+    const int events = lua_gettop(L);
+
+    const int64_t epoch = KeyboardService::epoch();
+    KeyboardService::Event buf[16];
+    lua_Integer n = 0;
+    for (size_t got; (got = KeyboardService::poll(buf, 16)) > 0;) {
+        for (size_t i = 0; i < got; i++) {
+            const KeyboardService::Event& e = buf[i];
+            if (lua_rawgeti(L, events, ++n) != LUA_TTABLE) {
+                lua_pop(L, 1);
+                lua_createtable(L, 0, 5);
+                lua_pushvalue(L, -1);
+                lua_rawseti(L, events, n);
+            }
+            lua_pushstring(L, kEventTypes[static_cast<int>(e.type)]);
+            lua_setfield(L, -2, "type");
+            lua_pushinteger(L, e.key);
+            lua_setfield(L, -2, "key");
+            lua_pushinteger(L, e.x);
+            lua_setfield(L, -2, "x");
+            lua_pushinteger(L, e.y);
+            lua_setfield(L, -2, "y");
+            // Wraps modulo 2^32 when lua_Integer is 32 bits.
+            lua_pushinteger(L, static_cast<lua_Integer>(static_cast<uint64_t>(e.time_us - epoch)));
+            lua_setfield(L, -2, "time");
+            lua_pop(L, 1);
+        }
+    }
+    for (lua_Integer i = n + 1, len = static_cast<lua_Integer>(lua_rawlen(L, events)); i <= len; i++) {
+        lua_pushnil(L);
+        lua_rawseti(L, events, i);
+    }
+    lua_pushinteger(L, n);
+    return 2;
+}
+
+// keyboard.stats() -> {scans, events, dropped, missed, peak, pending}
+static int l_keyboard_stats(lua_State* L) {
+    const KeyboardService::Stats& s = KeyboardService::stats();
+    lua_createtable(L, 0, 6);
+    lua_pushinteger(L, static_cast<lua_Integer>(s.scans));
+    lua_setfield(L, -2, "scans");
+    lua_pushinteger(L, static_cast<lua_Integer>(s.events));
+    lua_setfield(L, -2, "events");
+    lua_pushinteger(L, static_cast<lua_Integer>(s.dropped));
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, static_cast<lua_Integer>(s.missed));
+    lua_setfield(L, -2, "missed");
+    lua_pushinteger(L, static_cast<lua_Integer>(s.peak));
+    lua_setfield(L, -2, "peak");
+    lua_pushinteger(L, static_cast<lua_Integer>(KeyboardService::pending()));
+    lua_setfield(L, -2, "pending");
+    return 1;
+}
+
+// keyboard.state() -> keys, mods
+// The whole matrix in one call. keys is a 7-byte string: key i (see
+// keyboard.keyIndex) is down when bit i % 8 of byte i // 8 + 1 is set. mods
+// has shift = 1, ctrl = 2, alt = 4, opt = 8, fn = 16.
+static int l_keyboard_state(lua_State* L) {
+    const uint64_t mask = KeyboardService::keyMask();
+    char packed[(KeyboardService::kKeys + 7) / 8];
+    for (size_t i = 0; i < sizeof(packed); i++) packed[i] = static_cast<char>(mask >> (i * 8));
+    lua_pushlstring(L, packed, sizeof(packed));
+    lua_pushinteger(L, KeyboardService::modifiers(mask));
+    return 2;
+}
+
+// keyboard.keyIndex(name) -> index (0-55) or nil, for decoding keyboard.state()
+static int l_keyboard_key_index(lua_State* L) {
+    const int i = KeyboardService::keyIndex(luaL_checkstring(L, 1));
+    if (i < 0) {
+        lua_pushnil(L);
+    } else {
+        lua_pushinteger(L, i);
+    }
+    return 1;
+}
+
+// keyboard.pressedKeys(tbl) -> tbl, n
+// Sets tbl[name] = true for every key down ("w", "shift", " ", ...) and turns
+// entries left true from the last call to false, so a table reused every
+// frame stops allocating once each key has been seen.
+static int l_keyboard_pressed_keys(lua_State* L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 1);
+    const uint64_t mask = KeyboardService::keyMask();
+
+    // Only existing fields are assigned while traversing.
+    lua_pushnil(L);
+    while (lua_next(L, 1)) {
+        const bool was_down = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+        if (was_down) {
+            lua_pushvalue(L, -1);
+            lua_pushboolean(L, 0);
+            lua_rawset(L, 1);
+        }
+    }
+
+    lua_Integer n = 0;
+    for (uint64_t down = mask; down; down &= down - 1) {
+        int i = 0;
+        while (!((down >> i) & 1)) i++;
+        lua_pushstring(L, KeyboardService::keyName(i));
+        lua_pushboolean(L, 1);
+        lua_rawset(L, 1);
+        n++;
+    }
+    lua_pushinteger(L, n);
+    return 2;
+}
+
 static const luaL_Reg kKeyboardLib[] = {
     {"isChanged", l_keyboard_is_changed},
     {"isPressed", l_keyboard_is_pressed},
     {"isKeyPressed", l_keyboard_is_key_pressed},
     {"getKey", l_keyboard_get_key},
+    {"poll", l_keyboard_poll},
+    {"stats", l_keyboard_stats},
+    {"state", l_keyboard_state},
+    {"keyIndex", l_keyboard_key_index},
+    {"pressedKeys", l_keyboard_pressed_keys},
     {nullptr, nullptr},
 };
 
@@ -0,0 +1,100 @@
+#include "lua_sys.h"
+
+#include "lua/lua_heap.h"
+#include "lua/module_cache.h"
+#include "lua/require_sd.h"
+#include "services/FrameService.h"
+
+static void set_int_field(lua_State* L, const char* key, lua_Integer v) {
+  lua_pushinteger(L, v);
+  lua_setfield(L, -2, key);
+}
+
+static int l_sys_heap(lua_State* L) {
+  const LuaHeapStats s = lua_cardstock_heap_stats();
+  lua_createtable(L, 0, 10);
+  lua_pushboolean(L, s.enabled);
+  lua_setfield(L, -2, "enabled");
+  set_int_field(L, "arena", static_cast<lua_Integer>(s.arena_bytes));
+  set_int_field(L, "inUse", static_cast<lua_Integer>(s.in_use_bytes));
+  set_int_field(L, "peak", static_cast<lua_Integer>(s.peak_bytes));
+  set_int_field(L, "free", static_cast<lua_Integer>(s.free_bytes));
+  set_int_field(L, "largestFree", static_cast<lua_Integer>(s.largest_free_block));
+  set_int_field(L, "fallback", static_cast<lua_Integer>(s.fallback_bytes));
+  set_int_field(L, "fallbackAllocs", static_cast<lua_Integer>(s.fallback_allocs));
+  set_int_field(L, "stateFallbacks", static_cast<lua_Integer>(s.state_fallbacks));
+  lua_pushnumber(L, static_cast<lua_Number>(s.fragmentation));
+  lua_setfield(L, -2, "fragmentation");
+  return 1;
+}
+
+static int l_sys_loader_stats(lua_State* L) {
+  const LuaRequireStats r = lua_cardstock_require_stats();
+  const LuaModuleCacheStats m = lua_cardstock_module_cache_stats();
+  lua_createtable(L, 0, 9);
+  set_int_field(L, "requires", static_cast<lua_Integer>(r.requires));
+  set_int_field(L, "sdOpens", static_cast<lua_Integer>(r.sd_opens));
+  set_int_field(L, "indexSkips", static_cast<lua_Integer>(r.index_skips));
+  set_int_field(L, "indexBuilds", static_cast<lua_Integer>(r.index_builds));
+  set_int_field(L, "moduleCacheHits", static_cast<lua_Integer>(m.hits));
+  set_int_field(L, "moduleCacheMisses", static_cast<lua_Integer>(m.misses));
+  set_int_field(L, "moduleCacheEvictions", static_cast<lua_Integer>(m.evictions));
+  set_int_field(L, "moduleCacheEntries", static_cast<lua_Integer>(m.entries));
+  set_int_field(L, "moduleCacheBytes", static_cast<lua_Integer>(m.bytes));
+  return 1;
+}
+
+static uint16_t lua_check_fps(lua_State* L, int idx) {
+  lua_Integer fps = luaL_checkinteger(L, idx);
+  if (fps < 0) fps = 0;
+  if (fps > 1000) fps = 1000;
+  return static_cast<uint16_t>(fps);
+}
+
+static int l_sys_set_target_fps(lua_State* L) {
+  FrameService::setTargetFps(lua_check_fps(L, 1));
+  return 0;
+}
+
+static int l_sys_target_fps(lua_State* L) {
+  lua_pushinteger(L, FrameService::targetFps());
+  return 1;
+}
+
+static int l_sys_set_idle_fps(lua_State* L) {
+  FrameService::setIdleFps(lua_check_fps(L, 1));
+  return 0;
+}
+
+static int l_sys_frame_stats(lua_State* L) {
+  const FrameService::Stats& s = FrameService::stats();
+  lua_createtable(L, 0, 11);
+  lua_pushnumber(L, static_cast<lua_Number>(s.fps));
+  lua_setfield(L, -2, "fps");
+  set_int_field(L, "frameUs", static_cast<lua_Integer>(s.frame_us));
+  set_int_field(L, "tickUs", static_cast<lua_Integer>(s.tick_us));
+  set_int_field(L, "drawUs", static_cast<lua_Integer>(s.draw_us));
+  set_int_field(L, "flushUs", static_cast<lua_Integer>(s.flush_us));
+  set_int_field(L, "sleepUs", static_cast<lua_Integer>(s.sleep_us));
+  set_int_field(L, "ticks", static_cast<lua_Integer>(s.ticks));
+  set_int_field(L, "droppedTicks", static_cast<lua_Integer>(s.dropped_ticks));
+  set_int_field(L, "frames", static_cast<lua_Integer>(s.frames));
+  lua_pushboolean(L, s.idle);
+  lua_setfield(L, -2, "idle");
+  return 1;
+}
+
+static const luaL_Reg kSysLib[] = {
+    {"heap", l_sys_heap},
+    {"loaderStats", l_sys_loader_stats},
+    {"setTargetFps", l_sys_set_target_fps},
+    {"targetFps", l_sys_target_fps},
+    {"setIdleFps", l_sys_set_idle_fps},
+    {"frameStats", l_sys_frame_stats},
+    {nullptr, nullptr},
+};
+
+int luaopen_sys(lua_State* L) {
+  luaL_newlib(L, kSysLib);
+  return 1;
+}
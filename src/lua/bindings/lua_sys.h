@@ -0,0 +1,6 @@
+#pragma once
+
+#include "lua.hpp"
+
+// Lua module entrypoint: local sys = require("sys")
+int luaopen_sys(lua_State* L);
@@ -0,0 +1,485 @@
+#include "lua_ui.h"
+
+#include "lua_gfx.h"
+#include "services/UiService.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// -------------------------------
+// ui.widget userdata (handle to a UiService widget)
+// -------------------------------
+
+static const char* kWidgetMT = "ui.widget";
+// Registry table: widget id -> userdata. It keeps every widget alive until
+// destroy(), so a tree built without holding each widget in a variable stays
+// on screen; render also finds list row providers through it.
+static const char* kWidgetsKey = "ui.widgets";
+
+// Uservalue 1 holds a list's row provider.
+// The service only takes bounds, colours and value/max as a whole, so the last
+// ones set from Lua are kept here to let scripts change a single field.
+struct LuaWidget {
+  UiService::Id id = 0;
+  int32_t bounds[4] = {0, 0, 0, 0};
+  int32_t colors[3] = {0xFFFF, 0x0000, 0x041F};
+  int32_t value = 0;
+  int32_t max = 100;
+};
+
+static LuaWidget* lua_check_widget(lua_State* L, int idx) {
+  return static_cast<LuaWidget*>(luaL_checkudata(L, idx, kWidgetMT));
+}
+
+static UiService::Id lua_widget_require_alive(lua_State* L, int idx) {
+  LuaWidget* w = lua_check_widget(L, idx);
+  if (!UiService::exists(w->id)) luaL_error(L, "widget is destroyed");
+  return w->id;
+}
+
+static uint16_t lua_check_color(lua_State* L, int idx) {
+  lua_Integer v = luaL_checkinteger(L, idx);
+  if (v < 0) v = 0;
+  if (v > 0xFFFF) v = 0xFFFF;
+  return static_cast<uint16_t>(v);
+}
+
+// Field `key` of the table at `idx` pushed onto the stack; true unless nil.
+static bool lua_opt_field(lua_State* L, int idx, const char* key) {
+  lua_getfield(L, idx, key);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return false;
+  }
+  return true;
+}
+
+static int32_t lua_field_i32(lua_State* L, int idx, const char* key, int32_t def) {
+  if (!lua_opt_field(L, idx, key)) return def;
+  int ok = 0;
+  const lua_Integer v = lua_tointegerx(L, -1, &ok);
+  lua_pop(L, 1);
+  if (!ok) luaL_error(L, "ui: '%s' must be an integer", key);
+  return static_cast<int32_t>(v);
+}
+
+static void lua_widget_set_items(lua_State* L, UiService::Id id, int idx) {
+  idx = lua_absindex(L, idx);
+  luaL_checktype(L, idx, LUA_TTABLE);
+  // Convert into a Lua table first: __len, __index and __tostring can raise,
+  // and a longjmp would skip the destructors of a half-built vector.
+  const lua_Integer n = std::max<lua_Integer>(0, luaL_len(L, idx));
+  lua_createtable(L, static_cast<int>(n), 0);
+  for (lua_Integer i = 1; i <= n; i++) {
+    lua_geti(L, idx, i);
+    luaL_tolstring(L, -1, nullptr);
+    lua_rawseti(L, -3, i);
+    lua_pop(L, 1);
+  }
+
+  std::vector<String> items;
+  items.reserve(static_cast<size_t>(n));
+  for (lua_Integer i = 1; i <= n; i++) {
+    lua_rawgeti(L, -1, i);
+    items.emplace_back(lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  UiService::setItems(id, std::move(items));
+}
+
+// Applies the properties in the table at `idx`:
+// x, y, w, h, fg, bg, accent, font, align, visible, text, value, max,
+// items, count, rows (list row provider), rowHeight, selected.
+static void lua_widget_apply(lua_State* L, int self, int idx) {
+  luaL_checktype(L, idx, LUA_TTABLE);
+  const UiService::Id id = lua_widget_require_alive(L, self);
+
+  LuaWidget* w = lua_check_widget(L, self);
+  static const char* const kEdges[] = {"x", "y", "w", "h"};
+  static const char* const kColors[] = {"fg", "bg", "accent"};
+
+  bool bounds = false;
+  for (int i = 0; i < 4; i++) {
+    if (!lua_opt_field(L, idx, kEdges[i])) continue;
+    lua_pop(L, 1);
+    w->bounds[i] = lua_field_i32(L, idx, kEdges[i], 0);
+    bounds = true;
+  }
+  if (bounds) UiService::setBounds(id, w->bounds[0], w->bounds[1], w->bounds[2], w->bounds[3]);
+
+  bool colors = false;
+  for (int i = 0; i < 3; i++) {
+    if (!lua_opt_field(L, idx, kColors[i])) continue;
+    lua_pop(L, 1);
+    w->colors[i] = lua_field_i32(L, idx, kColors[i], 0) & 0xFFFF;
+    colors = true;
+  }
+  if (colors) {
+    UiService::setColors(id, static_cast<uint16_t>(w->colors[0]), static_cast<uint16_t>(w->colors[1]),
+                         static_cast<uint16_t>(w->colors[2]));
+  }
+
+  if (lua_opt_field(L, idx, "font")) {
+    UiService::setFont(id, static_cast<int32_t>(luaL_checkinteger(L, -1)));
+    lua_pop(L, 1);
+  }
+  if (lua_opt_field(L, idx, "align")) {
+    static const char* const kAlign[] = {"left", "center", "right", nullptr};
+    const int a = luaL_checkoption(L, -1, nullptr, kAlign);
+    UiService::setAlign(id, static_cast<UiService::Align>(a));
+    lua_pop(L, 1);
+  }
+  if (lua_opt_field(L, idx, "visible")) {
+    UiService::setVisible(id, lua_toboolean(L, -1));
+    lua_pop(L, 1);
+  }
+  if (lua_opt_field(L, idx, "text")) {
+    UiService::setText(id, luaL_checkstring(L, -1));
+    lua_pop(L, 1);
+  }
+  if (lua_opt_field(L, idx, "max") || lua_opt_field(L, idx, "value")) {
+    lua_pop(L, 1);
+    w->value = lua_field_i32(L, idx, "value", w->value);
+    w->max = lua_field_i32(L, idx, "max", w->max);
+    UiService::setValue(id, w->value, w->max);
+  }
+  if (lua_opt_field(L, idx, "rowHeight")) {
+    UiService::setRowHeight(id, static_cast<int32_t>(luaL_checkinteger(L, -1)));
+    lua_pop(L, 1);
+  }
+  if (lua_opt_field(L, idx, "items")) {
+    lua_widget_set_items(L, id, lua_gettop(L));
+    lua_pop(L, 1);
+  }
+  if (lua_opt_field(L, idx, "rows")) {
+    luaL_checktype(L, -1, LUA_TFUNCTION);
+    lua_setiuservalue(L, self, 1);
+    UiService::invalidate(id);
+  }
+  if (lua_opt_field(L, idx, "count")) {
+    UiService::setCount(id, static_cast<int32_t>(luaL_checkinteger(L, -1)));
+    lua_pop(L, 1);
+  }
+  if (lua_opt_field(L, idx, "selected")) {
+    UiService::select(id, static_cast<int32_t>(luaL_checkinteger(L, -1)) - 1);
+    lua_pop(L, 1);
+  }
+}
+
+static int lua_widget_new(lua_State* L, UiService::Kind kind) {
+  UiService::Id parent = 0;
+  if (lua_istable(L, 1) && lua_opt_field(L, 1, "parent")) {
+    parent = lua_widget_require_alive(L, lua_gettop(L));
+    lua_pop(L, 1);
+  }
+
+  LuaWidget* ud = static_cast<LuaWidget*>(lua_newuserdatauv(L, sizeof(LuaWidget), 1));
+  new (ud) LuaWidget();
+  luaL_setmetatable(L, kWidgetMT);
+  const int self = lua_gettop(L);
+  ud->id = UiService::create(kind, parent);
+
+  lua_getfield(L, LUA_REGISTRYINDEX, kWidgetsKey);
+  lua_pushvalue(L, self);
+  lua_rawseti(L, -2, ud->id);
+  lua_pop(L, 1);
+
+  if (lua_istable(L, 1)) lua_widget_apply(L, self, 1);
+  lua_settop(L, self);
+  return 1;
+}
+
+// Only reached once the widget left the registry (destroy()) or when the
+// state closes, so all that can be left is the service widget itself.
+static int l_widget_gc(lua_State* L) {
+  LuaWidget* w = lua_check_widget(L, 1);
+  if (w->id) UiService::destroy(w->id);
+  w->id = 0;
+  return 0;
+}
+
+// widget:set{...}: any of the constructor properties except parent.
+static int l_widget_set(lua_State* L) {
+  lua_widget_apply(L, 1, 2);
+  return 0;
+}
+
+static int l_widget_set_text(lua_State* L) {
+  UiService::setText(lua_widget_require_alive(L, 1), luaL_checkstring(L, 2));
+  return 0;
+}
+
+// widget:setValue(value[, max])
+static int l_widget_set_value(lua_State* L) {
+  const UiService::Id id = lua_widget_require_alive(L, 1);
+  LuaWidget* w = lua_check_widget(L, 1);
+  w->value = static_cast<int32_t>(luaL_checkinteger(L, 2));
+  w->max = static_cast<int32_t>(luaL_optinteger(L, 3, w->max));
+  UiService::setValue(id, w->value, w->max);
+  return 0;
+}
+
+static int l_widget_set_visible(lua_State* L) {
+  UiService::setVisible(lua_widget_require_alive(L, 1), lua_toboolean(L, 2));
+  return 0;
+}
+
+// widget:move(x, y[, w, h])
+static int l_widget_move(lua_State* L) {
+  lua_widget_require_alive(L, 1);
+  lua_createtable(L, 0, 4);
+  lua_pushvalue(L, 2);
+  lua_setfield(L, -2, "x");
+  lua_pushvalue(L, 3);
+  lua_setfield(L, -2, "y");
+  if (!lua_isnoneornil(L, 4)) {
+    lua_pushvalue(L, 4);
+    lua_setfield(L, -2, "w");
+    lua_pushvalue(L, 5);
+    lua_setfield(L, -2, "h");
+  }
+  lua_widget_apply(L, 1, lua_gettop(L));
+  return 0;
+}
+
+static int l_widget_set_items(lua_State* L) {
+  lua_widget_set_items(L, lua_widget_require_alive(L, 1), 2);
+  return 0;
+}
+
+// list:setCount(n[, provider])
+static int l_widget_set_count(lua_State* L) {
+  const UiService::Id id = lua_widget_require_alive(L, 1);
+  if (!lua_isnoneornil(L, 3)) {
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+    lua_pushvalue(L, 3);
+    lua_setiuservalue(L, 1, 1);
+  }
+  UiService::setCount(id, static_cast<int32_t>(luaL_checkinteger(L, 2)));
+  return 0;
+}
+
+// widget:select(i), 1-based; 0 clears the selection.
+static int l_widget_select(lua_State* L) {
+  UiService::select(lua_widget_require_alive(L, 1), static_cast<int32_t>(luaL_checkinteger(L, 2)) - 1);
+  return 0;
+}
+
+// widget:selected() -> i or nil
+static int l_widget_selected(lua_State* L) {
+  const int32_t sel = UiService::selected(lua_widget_require_alive(L, 1));
+  if (sel < 0) {
+    lua_pushnil(L);
+  } else {
+    lua_pushinteger(L, sel + 1);
+  }
+  return 1;
+}
+
+// widget:moveSelection(delta[, wrap]) -> new selection
+static int l_widget_move_selection(lua_State* L) {
+  const UiService::Id id = lua_widget_require_alive(L, 1);
+  const int32_t delta = static_cast<int32_t>(luaL_checkinteger(L, 2));
+  const bool wrap = lua_toboolean(L, 3);
+  const int32_t n = UiService::count(id);
+  if (n <= 0) {
+    lua_pushnil(L);
+    return 1;
+  }
+  int32_t sel = UiService::selected(id);
+  sel = sel < 0 ? (delta > 0 ? 0 : n - 1) : sel + delta;
+  if (wrap) {
+    sel = ((sel % n) + n) % n;
+  } else {
+    sel = sel < 0 ? 0 : (sel >= n ? n - 1 : sel);
+  }
+  UiService::select(id, sel);
+  lua_pushinteger(L, sel + 1);
+  return 1;
+}
+
+static int l_widget_scroll(lua_State* L) {
+  UiService::scroll(lua_widget_require_alive(L, 1), static_cast<int32_t>(luaL_checkinteger(L, 2)));
+  return 0;
+}
+
+static int l_widget_count(lua_State* L) {
+  lua_pushinteger(L, UiService::count(lua_widget_require_alive(L, 1)));
+  return 1;
+}
+
+// widget:invalidate(): redraw it; lists also ask their provider again.
+static int l_widget_invalidate(lua_State* L) {
+  UiService::invalidate(lua_widget_require_alive(L, 1));
+  return 0;
+}
+
+// widget:destroy(): removes it from the tree and drops the registry's
+// reference; its children stay alive, hidden at the root.
+static int l_widget_destroy(lua_State* L) {
+  LuaWidget* w = lua_check_widget(L, 1);
+  if (!w->id) return 0;
+  lua_getfield(L, LUA_REGISTRYINDEX, kWidgetsKey);
+  if (lua_rawgeti(L, -1, w->id) == LUA_TUSERDATA && lua_touserdata(L, -1) == w) {
+    lua_pushnil(L);
+    lua_rawseti(L, -3, w->id);
+  }
+  lua_pop(L, 2);
+  UiService::destroy(w->id);
+  w->id = 0;
+  return 0;
+}
+
+static const luaL_Reg kWidgetMethods[] = {
+    {"set", l_widget_set},
+    {"setText", l_widget_set_text},
+    {"setValue", l_widget_set_value},
+    {"setVisible", l_widget_set_visible},
+    {"move", l_widget_move},
+    {"setItems", l_widget_set_items},
+    {"setCount", l_widget_set_count},
+    {"select", l_widget_select},
+    {"selected", l_widget_selected},
+    {"moveSelection", l_widget_move_selection},
+    {"scroll", l_widget_scroll},
+    {"count", l_widget_count},
+    {"invalidate", l_widget_invalidate},
+    {"destroy", l_widget_destroy},
+    {nullptr, nullptr},
+};
+
+// -------------------------------
+// ui module
+// -------------------------------
+
+static int l_ui_panel(lua_State* L) {
+  return lua_widget_new(L, UiService::Kind::kPanel);
+}
+
+static int l_ui_label(lua_State* L) {
+  return lua_widget_new(L, UiService::Kind::kLabel);
+}
+
+// ui.list{..., count = n, rows = function(i) return text end}
+static int l_ui_list(lua_State* L) {
+  return lua_widget_new(L, UiService::Kind::kList);
+}
+
+// ui.menu{..., items = {...}}
+static int l_ui_menu(lua_State* L) {
+  return lua_widget_new(L, UiService::Kind::kMenu);
+}
+
+static int l_ui_progress(lua_State* L) {
+  return lua_widget_new(L, UiService::Kind::kProgress);
+}
+
+static int l_ui_text_box(lua_State* L) {
+  return lua_widget_new(L, UiService::Kind::kTextBox);
+}
+
+// Asks list providers for the rows about to be shown. On a provider error,
+// leaves the message on the stack and returns false.
+static bool lua_ui_fetch_rows(lua_State* L) {
+  std::vector<std::pair<UiService::Id, int32_t>> missing;
+  UiService::missingRows(missing);
+  if (missing.empty()) return true;
+
+  lua_getfield(L, LUA_REGISTRYINDEX, kWidgetsKey);
+  const int widgets = lua_gettop(L);
+  for (const auto& m : missing) {
+    if (lua_rawgeti(L, widgets, m.first) != LUA_TUSERDATA) {
+      lua_pop(L, 1);
+      continue;
+    }
+    if (lua_getiuservalue(L, -1, 1) != LUA_TFUNCTION) {
+      lua_pop(L, 2);
+      continue;
+    }
+    lua_pushinteger(L, static_cast<lua_Integer>(m.second) + 1);
+    if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+      lua_replace(L, widgets);
+      lua_settop(L, widgets);
+      return false;
+    }
+    const char* text = lua_isnil(L, -1) ? "" : luaL_tolstring(L, -1, nullptr);
+    UiService::setRow(m.first, m.second, text);
+    lua_settop(L, widgets);
+  }
+  lua_pop(L, 1);
+  return true;
+}
+
+// ui.render([sprite]) -> widgets drawn
+static int l_ui_render(lua_State* L) {
+  M5Canvas* dst = lua_gfx_opt_sprite(L, 1);
+  if (!lua_ui_fetch_rows(L)) return lua_error(L);
+  lua_pushinteger(L, static_cast<lua_Integer>(UiService::render(dst)));
+  return 1;
+}
+
+static int l_ui_set_background(lua_State* L) {
+  UiService::setBackground(lua_check_color(L, 1));
+  return 0;
+}
+
+// ui.invalidate(): redraw everything at the next render.
+static int l_ui_invalidate(lua_State* L) {
+  (void)L;
+  UiService::invalidate(0);
+  return 0;
+}
+
+static int l_ui_stats(lua_State* L) {
+  const UiService::Stats& s = UiService::stats();
+  lua_createtable(L, 0, 5);
+  lua_pushinteger(L, static_cast<lua_Integer>(s.widgets));
+  lua_setfield(L, -2, "widgets");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.drawn));
+  lua_setfield(L, -2, "drawn");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.rows_drawn));
+  lua_setfield(L, -2, "rowsDrawn");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.rows_held));
+  lua_setfield(L, -2, "rowsHeld");
+  lua_pushinteger(L, static_cast<lua_Integer>(s.render_us));
+  lua_setfield(L, -2, "renderUs");
+  return 1;
+}
+
+static const luaL_Reg kUiLib[] = {
+    {"panel", l_ui_panel},
+    {"label", l_ui_label},
+    {"list", l_ui_list},
+    {"menu", l_ui_menu},
+    {"progress", l_ui_progress},
+    {"textBox", l_ui_text_box},
+    {"render", l_ui_render},
+    {"setBackground", l_ui_set_background},
+    {"invalidate", l_ui_invalidate},
+    {"stats", l_ui_stats},
+    {nullptr, nullptr},
+};
+
+int luaopen_ui(lua_State* L) {
+  // Create ui.widget metatable.
+  if (luaL_newmetatable(L, kWidgetMT)) {
+    luaL_newlib(L, kWidgetMethods);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushcfunction(L, l_widget_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_pop(L, 1);  // pop metatable
+
+  // id -> widget table; a new state (new app) starts with an empty one,
+  // matching UiService::reset().
+  lua_newtable(L);
+  lua_setfield(L, LUA_REGISTRYINDEX, kWidgetsKey);
+
+  luaL_newlib(L, kUiLib);
+  return 1;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include "lua.hpp"
+
+// Lua module entrypoint: local ui = require("ui")
+int luaopen_ui(lua_State* L);
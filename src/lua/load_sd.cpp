@@ -0,0 +1,328 @@
+#include "load_sd.h"
+#include "module_cache.h"
+#include "services/SdService.h"
+
+#include <Arduino.h>
+#include <SD.h>
+
+// Bytecode cache switch. Disable with: -DCARDSTOCK_BYTECODE_CACHE=0
+#ifndef CARDSTOCK_BYTECODE_CACHE
+#define CARDSTOCK_BYTECODE_CACHE 1
+#endif
+
+// Read block size for streaming chunks off SD. Matches the FAT sector size so
+// each refill is one sector read; peak heap during a load no longer scales
+// with the script size.
+#ifndef CARDSTOCK_LOAD_BLOCK_SIZE
+#define CARDSTOCK_LOAD_BLOCK_SIZE 512
+#endif
+
+// Strip debug info (line numbers, local names) from cached bytecode. Saves
+// SD space and load time, but errors raised from cached chunks then report
+// "?" instead of a line number. Enable with: -DCARDSTOCK_BYTECODE_STRIP=1
+#ifndef CARDSTOCK_BYTECODE_STRIP
+#define CARDSTOCK_BYTECODE_STRIP 0
+#endif
+
+// Log per-load timing and peak Lua heap growth to Serial.
+// Enable with: -DCARDSTOCK_LOAD_STATS
+
+namespace {
+
+static const char* kCacheRoot = "/cache/luac";
+
+// Header written in front of every cached blob. Compared field-by-field
+// against the current source file and interpreter build.
+struct CacheHeader {
+  char magic[4];
+  uint16_t format;
+  uint16_t lua_version;
+  uint8_t int_size;
+  uint8_t num_size;
+  uint8_t strip;  // CARDSTOCK_BYTECODE_STRIP it was dumped with
+  uint8_t reserved;
+  uint32_t src_size;
+  uint32_t src_mtime;
+};
+
+static const char kCacheMagic[4] = {'C', 'S', 'B', 'C'};
+static const uint16_t kCacheFormat = 2;
+
+static uint32_t g_sd_opens = 0;
+
+static File sd_open(const char* path, const char* mode) {
+  g_sd_opens++;
+  return SD.open(path, mode);
+}
+
+static CacheHeader make_header(File& src) {
+  CacheHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, kCacheMagic, sizeof(h.magic));
+  h.format = kCacheFormat;
+  h.lua_version = LUA_VERSION_NUM;
+  h.int_size = sizeof(lua_Integer);
+  h.num_size = sizeof(lua_Number);
+  h.strip = CARDSTOCK_BYTECODE_STRIP;
+  h.src_size = static_cast<uint32_t>(src.size());
+  h.src_mtime = static_cast<uint32_t>(src.getLastWrite());
+  return h;
+}
+
+static String cache_path_for(const String& normalized) {
+  // "/apps/foo/main.lua" -> "/cache/luac/apps/foo/main.luac"
+  return String(kCacheRoot) + normalized + "c";
+}
+
+// lua_Reader over an open File, refilled one block at a time.
+struct FileReader {
+  File* f = nullptr;
+  bool failed = false;
+  char block[CARDSTOCK_LOAD_BLOCK_SIZE];
+};
+
+static const char* file_reader(lua_State* L, void* ud, size_t* sz) {
+  (void)L;
+  FileReader* r = static_cast<FileReader*>(ud);
+  int n = r->f->read(reinterpret_cast<uint8_t*>(r->block), sizeof(r->block));
+  if (n <= 0) {
+    // A short read before EOF is an SD error, not the end of the chunk.
+    if (r->f->position() < r->f->size()) r->failed = true;
+    *sz = 0;
+    return nullptr;
+  }
+  *sz = static_cast<size_t>(n);
+  return r->block;
+}
+
+// lua_load() from the current position of `f`. Read errors are reported as
+// LUA_ERRFILE so callers can tell them apart from syntax errors.
+static int load_stream(lua_State* L, File& f, const char* chunkname, const char* mode, const String& normalized) {
+  FileReader r;
+  r.f = &f;
+  int rc = lua_load(L, file_reader, &r, chunkname, mode);
+  if (r.failed) {
+    lua_pop(L, 1);  // partial chunk or parser error
+    lua_pushfstring(L, "read failed: %s", normalized.c_str());
+    return LUA_ERRFILE;
+  }
+  return rc;
+}
+
+// Pushes the cached chunk and returns true if `cache_path` holds bytecode
+// built from a source matching `want`. Leaves the stack unchanged otherwise.
+static bool load_cached(lua_State* L, const String& cache_path, const CacheHeader& want, const char* chunkname) {
+  File f = sd_open(cache_path.c_str(), FILE_READ);
+  if (!f) return false;
+
+  CacheHeader have;
+  bool ok = SdService::readExact(f, reinterpret_cast<uint8_t*>(&have), sizeof(have)) &&
+            memcmp(&have, &want, sizeof(have)) == 0;
+
+  if (ok && load_stream(L, f, chunkname, "b", cache_path) != LUA_OK) {
+    // Corrupt or incompatible blob; caller recompiles and overwrites it.
+    lua_pop(L, 1);
+    ok = false;
+  }
+  f.close();
+  return ok;
+}
+
+struct CacheBlob {
+  lua_State* L;
+  const CacheHeader* header;
+};
+
+static int file_writer(lua_State* L, const void* p, size_t sz, void* ud) {
+  (void)L;
+  if (!p || !sz) return 0;  // end-of-dump marker
+  File* f = static_cast<File*>(ud);
+  return f->write(static_cast<const uint8_t*>(p), sz) == sz ? 0 : 1;
+}
+
+static bool write_blob(File& f, void* ctx) {
+  const CacheBlob* b = static_cast<const CacheBlob*>(ctx);
+  return f.write(reinterpret_cast<const uint8_t*>(b->header), sizeof(CacheHeader)) == sizeof(CacheHeader) &&
+         lua_dump(b->L, file_writer, &f, CARDSTOCK_BYTECODE_STRIP) == 0;
+}
+
+// Dumps the function on top of the stack to `cache_path`. Best effort: a full
+// or read-only card just means the next boot parses the source again.
+static void store_cached(lua_State* L, const String& cache_path, const CacheHeader& header) {
+  CacheBlob blob{L, &header};
+  g_sd_opens++;  // the temp file
+  SdService::writeFile(cache_path, write_blob, &blob);
+}
+
+static int load_source(lua_State* L, File& src, const String& normalized, const char* chunkname) {
+  if (!src.size()) {
+    lua_pushfstring(L, "empty file: %s", normalized.c_str());
+    return LUA_ERRFILE;
+  }
+  return load_stream(L, src, chunkname, nullptr, normalized);
+}
+
+#ifdef CARDSTOCK_LOAD_STATS
+// Wraps the state's allocator for the duration of one load to record how far
+// the Lua heap grows above its starting point.
+struct AllocProbe {
+  lua_Alloc inner = nullptr;
+  void* inner_ud = nullptr;
+  int32_t cur = 0;
+  int32_t peak = 0;
+};
+
+static void* probe_alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+  AllocProbe* p = static_cast<AllocProbe*>(ud);
+  void* out = p->inner(p->inner_ud, ptr, osize, nsize);
+  if (nsize == 0 || out) {
+    // For ptr == NULL, osize is a type tag rather than a size.
+    if (ptr) p->cur -= static_cast<int32_t>(osize);
+    p->cur += static_cast<int32_t>(nsize);
+    if (p->cur > p->peak) p->peak = p->cur;
+  }
+  return out;
+}
+#endif
+
+static int load_file(lua_State* L, const String& normalized, const char* chunkname, bool* out_cached,
+                     size_t* out_size) {
+  const bool resident = lua_cardstock_module_cache_accepts(normalized.c_str());
+  if (resident && lua_cardstock_module_cache_load(L, normalized.c_str(), chunkname)) {
+    *out_cached = true;
+    return LUA_OK;
+  }
+
+  File src = sd_open(normalized.c_str(), FILE_READ);
+  if (!src) {
+    lua_pushfstring(L, "open failed: %s", normalized.c_str());
+    return LUA_ERRFILE;
+  }
+  *out_size = static_cast<size_t>(src.size());
+
+#if CARDSTOCK_BYTECODE_CACHE
+  const CacheHeader header = make_header(src);
+  const String cache_path = cache_path_for(normalized);
+  if (load_cached(L, cache_path, header, chunkname)) {
+    src.close();
+    if (resident) lua_cardstock_module_cache_store(L, normalized.c_str());
+    *out_cached = true;
+    return LUA_OK;
+  }
+#endif
+
+  int rc = load_source(L, src, normalized, chunkname);
+  src.close();
+
+#if CARDSTOCK_BYTECODE_CACHE
+  if (rc == LUA_OK) store_cached(L, cache_path, header);
+#endif
+  if (rc == LUA_OK && resident) lua_cardstock_module_cache_store(L, normalized.c_str());
+  return rc;
+}
+
+}  // namespace
+
+int lua_cardstock_loadfile(lua_State* L, const char* path, const char* chunkname) {
+  const String normalized = SdService::normalizePath(path ? String(path) : String(""));
+  if (!chunkname) chunkname = path;
+  bool cached = false;
+  size_t src_size = 0;
+
+#ifdef CARDSTOCK_LOAD_STATS
+  AllocProbe probe;
+  probe.inner = lua_getallocf(L, &probe.inner_ud);
+  lua_setallocf(L, probe_alloc, &probe);
+  const uint32_t t0 = micros();
+  const uint32_t free_before = ESP.getFreeHeap();
+#endif
+
+  int rc = load_file(L, normalized, chunkname, &cached, &src_size);
+
+#ifdef CARDSTOCK_LOAD_STATS
+  const uint32_t elapsed_us = micros() - t0;
+  lua_setallocf(L, probe.inner, probe.inner_ud);
+  if (rc != LUA_ERRFILE) {
+    String line = "load ";
+    line += normalized;
+    line += cached ? " (cached): " : " (source): ";
+    line += String(static_cast<unsigned long>(elapsed_us)) + " us, peak lua heap +";
+    line += String(static_cast<long>(probe.peak)) + " B, read block ";
+    line += String(CARDSTOCK_LOAD_BLOCK_SIZE) + " B (whole-file buffer would be ";
+    line += String(static_cast<unsigned long>(src_size)) + " B), free heap ";
+    line += String(static_cast<unsigned long>(free_before)) + " -> ";
+    line += String(static_cast<unsigned long>(ESP.getFreeHeap())) + " B";
+    Serial.println(line);
+  }
+#endif
+
+  return rc;
+}
+
+void lua_cardstock_bench_loadfile(lua_State* L, const char* path, int iterations) {
+  const String normalized = SdService::normalizePath(path ? String(path) : String(""));
+  if (iterations < 1) iterations = 1;
+
+  File src = sd_open(normalized.c_str(), FILE_READ);
+  if (!src) {
+    Serial.println(String("bench: open failed: ") + normalized);
+    return;
+  }
+  const CacheHeader header = make_header(src);
+  src.close();
+
+  // Cold: open + read + parse the source every time.
+  uint32_t cold_us = 0;
+  for (int i = 0; i < iterations; i++) {
+    const uint32_t t0 = micros();
+    File f = sd_open(normalized.c_str(), FILE_READ);
+    if (!f) {
+      Serial.println(String("bench: reopen failed: ") + normalized);
+      return;
+    }
+    int rc = load_source(L, f, normalized, path);
+    f.close();
+    cold_us += micros() - t0;
+    if (rc != LUA_OK) {
+      Serial.println(String("bench: cold load failed: ") + lua_tostring(L, -1));
+      lua_pop(L, 1);
+      return;
+    }
+    if (i == 0) store_cached(L, cache_path_for(normalized), header);
+    lua_pop(L, 1);  // chunk
+  }
+
+  // Warm: open + read the cached bytecode every time.
+  const String cache_path = cache_path_for(normalized);
+  uint32_t warm_us = 0;
+  int warm_hits = 0;
+  for (int i = 0; i < iterations; i++) {
+    const uint32_t t0 = micros();
+    File f = sd_open(normalized.c_str(), FILE_READ);  // the real path stats the source too
+    const CacheHeader want = f ? make_header(f) : header;
+    if (f) f.close();
+    const bool hit = load_cached(L, cache_path, want, path);
+    warm_us += micros() - t0;
+    if (hit) {
+      warm_hits++;
+      lua_pop(L, 1);
+    }
+  }
+
+  String line = "bench: ";
+  line += normalized;
+  line += " (" + String(static_cast<unsigned long>(header.src_size)) + " B) cold parse avg ";
+  line += String(static_cast<unsigned long>(cold_us / iterations)) + " us, cached avg ";
+  line += String(static_cast<unsigned long>(warm_us / iterations)) + " us";
+  line += " (" + String(warm_hits) + "/" + String(iterations) + " hits)";
+  Serial.println(line);
+}
+
+void lua_cardstock_loadfile_invalidate() {
+  SdService::removeTree(kCacheRoot);
+  lua_cardstock_module_cache_invalidate(nullptr);
+}
+
+uint32_t lua_cardstock_sd_open_count() {
+  return g_sd_opens;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// SD-backed chunk loader for Cardstock.
+//
+// Loads a Lua chunk from SD the way luaL_loadfile() does: on success the
+// compiled chunk is pushed and LUA_OK is returned; on failure an error message
+// is pushed and the Lua status code is returned. LUA_ERRFILE means the file
+// could not be opened or read (callers like the require searcher treat that as
+// "not found").
+//
+// Compiled chunks are cached as bytecode under /cache/luac, mirroring the
+// source path ("/apps/foo/main.lua" -> "/cache/luac/apps/foo/main.luac").
+// A cache entry is only used when the source size, source mtime, Lua
+// version/number format and strip setting it was built from still match. Modules under /syslib
+// are additionally kept resident in RAM across lua_State re-creation (see
+// module_cache.h).
+
+#include "lua.hpp"
+
+#include <stdint.h>
+
+// Load `path` (absolute SD path) as a chunk named `chunkname` (defaults to path).
+int lua_cardstock_loadfile(lua_State* L, const char* path, const char* chunkname = nullptr);
+
+// Drops every cached bytecode blob, on SD and resident. Call after files on
+// SD were replaced: the cache key is source size + mtime, and FAT mtimes are
+// 2 s apart, so a same-size rewrite within that window looks unchanged.
+void lua_cardstock_loadfile_invalidate();
+
+// Number of SD.open() calls made by the loader since boot (sources, cache
+// blobs and cache writes). Sample before/after a load to count its opens.
+uint32_t lua_cardstock_sd_open_count();
+
+// Launch-time benchmark: times `iterations` cold parses of `path` against the
+// same number of loads from its bytecode cache and logs both to Serial.
+// Leaves the Lua stack unchanged.
+void lua_cardstock_bench_loadfile(lua_State* L, const char* path, int iterations = 5);
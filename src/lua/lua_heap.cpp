@@ -0,0 +1,555 @@
+#include "lua_heap.h"
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+// Arena size in internal RAM. The allocator bench (CARDSTOCK_BENCH_HEAP) peaks
+// at ~70 KB and fits this without falling back to the system heap.
+// Disable the arena with: -DCARDSTOCK_LUA_HEAP_BYTES=0
+#ifndef CARDSTOCK_LUA_HEAP_BYTES
+#define CARDSTOCK_LUA_HEAP_BYTES (96 * 1024)
+#endif
+
+// Arena size used instead when the board has PSRAM.
+#ifndef CARDSTOCK_LUA_HEAP_PSRAM_BYTES
+#define CARDSTOCK_LUA_HEAP_PSRAM_BYTES (1024 * 1024)
+#endif
+
+namespace {
+
+// -------------------------------
+// Large blocks (segregated fit)
+// -------------------------------
+// Every block starts with a boundary tag. Free blocks keep their list links
+// in the payload and live in the bucket for floor(log2(size)).
+
+struct BlockHeader {
+  uint32_t size;       // total bytes including this header; bit 0 = in use
+  uint32_t prev_size;  // total bytes of the physically previous block (0 for the first)
+};
+
+struct FreeLinks {
+  BlockHeader* next;
+  BlockHeader* prev;
+};
+
+static const size_t kAlign = 8;
+static const uint32_t kUsed = 1;
+static const size_t kHeader = sizeof(BlockHeader);
+static const size_t kMinBlock = (kHeader + sizeof(FreeLinks) + kAlign - 1) & ~(kAlign - 1);
+static const int kBuckets = 24;
+
+// -------------------------------
+// Small objects (size classes)
+// -------------------------------
+// 8..64 B in 8 B steps, then 80..128 B in 16 B steps. Objects are carved out
+// of slabs taken from the large allocator and recycled through per-class free
+// lists; Lua passes the original size on free, so no per-object header.
+//
+// A free object stays on its class list, so memory freed in one class can't
+// serve another. When the arena runs out, reclaim_slabs() hands every slab
+// whose objects are all free back to the large allocator before anything
+// falls back to the system heap. Slabs are found by address through a sorted
+// table kept at the end of the arena.
+
+static const size_t kSmallMax = 128;
+static const int kSmallClasses = 12;
+static const size_t kSlabBytes = 1024;
+
+struct Heap {
+  uint8_t* region = nullptr;  // as returned by heap_caps_malloc
+  uint8_t* base = nullptr;    // 8-byte aligned start of the arena
+  size_t size = 0;
+  BlockHeader* buckets[kBuckets];
+  void* small_free[kSmallClasses];
+  size_t small_free_bytes = 0;
+  uint8_t** slabs = nullptr;      // live slabs, sorted by address
+  uint16_t* slab_free = nullptr;  // per-slab scratch for reclaim_slabs()
+  size_t slab_count = 0;
+  size_t slab_cap = 0;
+  bool swept = false;             // no small frees since the last reclaim_slabs()
+  bool closing = false;
+  lua_State* owner = nullptr;
+
+  size_t in_use = 0;
+  size_t peak = 0;
+  size_t fallback_bytes = 0;
+  uint32_t fallback_allocs = 0;
+};
+
+static Heap g_heap;
+static uint32_t g_state_fallbacks = 0;
+
+static inline size_t round_up(size_t n) {
+  return (n + kAlign - 1) & ~(kAlign - 1);
+}
+
+static inline uint32_t block_size(const BlockHeader* b) {
+  return b->size & ~kUsed;
+}
+
+static inline bool block_used(const BlockHeader* b) {
+  return (b->size & kUsed) != 0;
+}
+
+static inline BlockHeader* next_block(BlockHeader* b) {
+  return reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(b) + block_size(b));
+}
+
+static inline BlockHeader* prev_block(BlockHeader* b) {
+  return reinterpret_cast<BlockHeader*>(reinterpret_cast<uint8_t*>(b) - b->prev_size);
+}
+
+static inline FreeLinks* links(BlockHeader* b) {
+  return reinterpret_cast<FreeLinks*>(b + 1);
+}
+
+static inline BlockHeader* header_of(void* p) {
+  return reinterpret_cast<BlockHeader*>(p) - 1;
+}
+
+static inline bool in_arena(const void* p) {
+  const uint8_t* q = static_cast<const uint8_t*>(p);
+  return g_heap.base && q >= g_heap.base && q < g_heap.base + g_heap.size;
+}
+
+static int bucket_for(size_t size) {
+  int b = 31 - __builtin_clz(static_cast<uint32_t>(size));
+  return b >= kBuckets ? kBuckets - 1 : b;
+}
+
+static void list_insert(BlockHeader* b) {
+  const int i = bucket_for(block_size(b));
+  FreeLinks* l = links(b);
+  l->prev = nullptr;
+  l->next = g_heap.buckets[i];
+  if (l->next) links(l->next)->prev = b;
+  g_heap.buckets[i] = b;
+}
+
+static void list_remove(BlockHeader* b) {
+  FreeLinks* l = links(b);
+  if (l->prev) {
+    links(l->prev)->next = l->next;
+  } else {
+    g_heap.buckets[bucket_for(block_size(b))] = l->next;
+  }
+  if (l->next) links(l->next)->prev = l->prev;
+}
+
+// Shrinks used block `b` to `need` bytes and returns the tail to the free
+// lists (merged with a free successor) if it is big enough to stand alone.
+static void release_tail(BlockHeader* b, size_t need) {
+  const size_t rem = block_size(b) - need;
+  if (rem < kMinBlock) return;
+
+  b->size = static_cast<uint32_t>(need) | kUsed;
+  BlockHeader* r = next_block(b);
+  r->size = static_cast<uint32_t>(rem);
+  r->prev_size = static_cast<uint32_t>(need);
+
+  BlockHeader* n = next_block(r);
+  if (!block_used(n)) {
+    list_remove(n);
+    r->size += block_size(n);
+  }
+  next_block(r)->prev_size = r->size;
+  list_insert(r);
+}
+
+static size_t block_need(size_t n) {
+  size_t need = round_up(n + kHeader);
+  return need < kMinBlock ? kMinBlock : need;
+}
+
+static void* large_alloc(size_t n) {
+  const size_t need = block_need(n);
+  for (int i = bucket_for(need); i < kBuckets; i++) {
+    for (BlockHeader* b = g_heap.buckets[i]; b; b = links(b)->next) {
+      if (block_size(b) < need) continue;
+      list_remove(b);
+      b->size |= kUsed;
+      release_tail(b, need);
+      return b + 1;
+    }
+  }
+  return nullptr;
+}
+
+static void large_free(void* p) {
+  BlockHeader* b = header_of(p);
+  b->size &= ~kUsed;
+
+  BlockHeader* n = next_block(b);
+  if (!block_used(n)) {
+    list_remove(n);
+    b->size += block_size(n);
+  }
+  if (b->prev_size) {
+    BlockHeader* pv = prev_block(b);
+    if (!block_used(pv)) {
+      list_remove(pv);
+      pv->size += b->size;
+      b = pv;
+    }
+  }
+  next_block(b)->prev_size = b->size;
+  list_insert(b);
+}
+
+// Resizes a large block in place (shrinking, or growing into a free successor).
+static bool large_resize(void* p, size_t n) {
+  BlockHeader* b = header_of(p);
+  const size_t need = block_need(n);
+  if (block_size(b) < need) {
+    BlockHeader* nx = next_block(b);
+    if (block_used(nx) || block_size(b) + block_size(nx) < need) return false;
+    list_remove(nx);
+    b->size += block_size(nx);
+    next_block(b)->prev_size = block_size(b);
+  }
+  release_tail(b, need);
+  return true;
+}
+
+static int small_class(size_t n) {
+  if (n <= 64) return static_cast<int>((n + 7) / 8) - 1;
+  return 8 + static_cast<int>((n - 64 + 15) / 16) - 1;
+}
+
+static size_t small_class_size(int c) {
+  return c < 8 ? static_cast<size_t>(c + 1) * 8 : 64 + static_cast<size_t>(c - 7) * 16;
+}
+
+static void small_push(int c, void* p) {
+  *static_cast<void**>(p) = g_heap.small_free[c];
+  g_heap.small_free[c] = p;
+  g_heap.small_free_bytes += small_class_size(c);
+}
+
+static size_t slab_objects(int c) {
+  return (kSlabBytes - kHeader) / small_class_size(c);
+}
+
+// Index of the slab holding `p`, or -1 (e.g. a single block carved when no
+// slab could be had).
+static int slab_index(const void* p) {
+  const uint8_t* q = static_cast<const uint8_t*>(p);
+  size_t lo = 0, hi = g_heap.slab_count;
+  while (lo < hi) {
+    const size_t mid = (lo + hi) / 2;
+    if (g_heap.slabs[mid] <= q) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0 || q >= g_heap.slabs[lo - 1] + (kSlabBytes - kHeader)) return -1;
+  return static_cast<int>(lo - 1);
+}
+
+static void slab_add(uint8_t* slab) {
+  size_t i = g_heap.slab_count;
+  for (; i > 0 && g_heap.slabs[i - 1] > slab; --i) g_heap.slabs[i] = g_heap.slabs[i - 1];
+  g_heap.slabs[i] = slab;
+  g_heap.slab_count++;
+}
+
+// Returns slabs with no live objects to the large allocator. Runs only when
+// the arena is out of space, and only if something was freed since last time.
+static bool reclaim_slabs() {
+  if (g_heap.swept || g_heap.small_free_bytes < kSlabBytes - kHeader) return false;
+  g_heap.swept = true;
+
+  static const uint16_t kEmpty = 0xFFFF;  // above any per-slab object count
+  memset(g_heap.slab_free, 0, g_heap.slab_count * sizeof(uint16_t));
+  for (int c = 0; c < kSmallClasses; c++) {
+    for (void* p = g_heap.small_free[c]; p; p = *static_cast<void**>(p)) {
+      const int i = slab_index(p);
+      if (i >= 0) g_heap.slab_free[i]++;
+    }
+  }
+
+  // Unlink the objects of fully free slabs from their lists...
+  bool any = false;
+  for (int c = 0; c < kSmallClasses; c++) {
+    const size_t full = slab_objects(c);
+    void** link = &g_heap.small_free[c];
+    while (*link) {
+      void* p = *link;
+      const int i = slab_index(p);
+      if (i >= 0 && g_heap.slab_free[i] >= full) {
+        g_heap.slab_free[i] = kEmpty;
+        *link = *static_cast<void**>(p);
+        g_heap.small_free_bytes -= small_class_size(c);
+        any = true;
+      } else {
+        link = static_cast<void**>(p);
+      }
+    }
+  }
+
+  // ...then free those slabs and drop them from the table.
+  size_t kept = 0;
+  for (size_t i = 0; i < g_heap.slab_count; i++) {
+    if (g_heap.slab_free[i] == kEmpty) {
+      large_free(g_heap.slabs[i]);
+    } else {
+      g_heap.slabs[kept++] = g_heap.slabs[i];
+    }
+  }
+  g_heap.slab_count = kept;
+  return any;
+}
+
+static void* small_alloc(size_t n) {
+  const int c = small_class(n);
+  const size_t sz = small_class_size(c);
+
+  if (!g_heap.small_free[c]) {
+    // Refill from a new slab; if the arena can't spare one, a single block.
+    uint8_t* slab = g_heap.slab_count < g_heap.slab_cap
+                        ? static_cast<uint8_t*>(large_alloc(kSlabBytes - kHeader))
+                        : nullptr;
+    if (slab) {
+      slab_add(slab);
+      const size_t count = slab_objects(c);
+      for (size_t i = count; i > 0; --i) small_push(c, slab + (i - 1) * sz);
+    } else {
+      return large_alloc(sz);
+    }
+  }
+
+  void* p = g_heap.small_free[c];
+  g_heap.small_free[c] = *static_cast<void**>(p);
+  g_heap.small_free_bytes -= sz;
+  return p;
+}
+
+static void arena_reset() {
+  memset(g_heap.buckets, 0, sizeof(g_heap.buckets));
+  memset(g_heap.small_free, 0, sizeof(g_heap.small_free));
+  g_heap.small_free_bytes = 0;
+  g_heap.slab_count = 0;
+  g_heap.swept = false;
+
+  // One free block spanning the arena, followed by a zero-size "used" sentinel
+  // so coalescing never walks past the end.
+  const size_t usable = (g_heap.size - kHeader) & ~(kAlign - 1);
+  BlockHeader* first = reinterpret_cast<BlockHeader*>(g_heap.base);
+  first->size = static_cast<uint32_t>(usable);
+  first->prev_size = 0;
+  BlockHeader* end = next_block(first);
+  end->size = kUsed;
+  end->prev_size = static_cast<uint32_t>(usable);
+  list_insert(first);
+
+  g_heap.in_use = 0;
+  g_heap.peak = 0;
+  g_heap.fallback_bytes = 0;
+  g_heap.fallback_allocs = 0;
+}
+
+static bool arena_reserve() {
+  if (g_heap.base) return true;
+  if (CARDSTOCK_LUA_HEAP_BYTES == 0) return false;
+
+  size_t want = CARDSTOCK_LUA_HEAP_BYTES;
+  uint32_t caps = MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL;
+  if (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) > CARDSTOCK_LUA_HEAP_PSRAM_BYTES) {
+    want = CARDSTOCK_LUA_HEAP_PSRAM_BYTES;
+    caps = MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM;
+  }
+
+  uint8_t* region = static_cast<uint8_t*>(heap_caps_malloc(want + kAlign, caps));
+  if (!region) return false;
+
+  // The slab table takes the top of the region; the rest is the arena.
+  const size_t slab_cap = want / kSlabBytes;
+  const size_t table = round_up(slab_cap * (sizeof(uint8_t*) + sizeof(uint16_t)));
+
+  g_heap.region = region;
+  g_heap.base = reinterpret_cast<uint8_t*>(round_up(reinterpret_cast<uintptr_t>(region)));
+  g_heap.size = want - table;
+  g_heap.slabs = reinterpret_cast<uint8_t**>(g_heap.base + g_heap.size);
+  g_heap.slab_free = reinterpret_cast<uint16_t*>(g_heap.slabs + slab_cap);
+  g_heap.slab_cap = slab_cap;
+  arena_reset();
+  return true;
+}
+
+static void* arena_alloc(size_t n) {
+  return n <= kSmallMax ? small_alloc(n) : large_alloc(n);
+}
+
+static void* acquire(size_t n) {
+  void* p = arena_alloc(n);
+  if (!p && reclaim_slabs()) p = arena_alloc(n);
+  if (!p) {
+    p = malloc(n);
+    if (!p) return nullptr;
+    g_heap.fallback_bytes += n;
+    g_heap.fallback_allocs++;
+  }
+  g_heap.in_use += n;
+  if (g_heap.in_use > g_heap.peak) g_heap.peak = g_heap.in_use;
+  return p;
+}
+
+static void release(void* p, size_t osize) {
+  g_heap.in_use -= osize;
+  if (!in_arena(p)) {
+    g_heap.fallback_bytes -= osize;
+    free(p);
+    return;
+  }
+  if (g_heap.closing) return;  // whole arena is reset after lua_close
+  if (osize <= kSmallMax) {
+    small_push(small_class(osize), p);
+    g_heap.swept = false;
+  } else {
+    large_free(p);
+  }
+}
+
+static void* heap_alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+  (void)ud;
+  if (nsize == 0) {
+    if (ptr) release(ptr, osize);
+    return nullptr;
+  }
+  if (!ptr) return acquire(nsize);  // osize is a type tag here
+
+  if (!in_arena(ptr)) {
+    void* np = realloc(ptr, nsize);
+    if (!np) return nullptr;
+    g_heap.fallback_bytes += nsize - osize;
+    g_heap.in_use += nsize - osize;
+    if (g_heap.in_use > g_heap.peak) g_heap.peak = g_heap.in_use;
+    return np;
+  }
+
+  bool in_place = false;
+  if (osize <= kSmallMax && nsize <= kSmallMax) {
+    in_place = small_class(osize) == small_class(nsize);
+  } else if (osize > kSmallMax && nsize > kSmallMax) {
+    in_place = large_resize(ptr, nsize);
+  }
+  if (in_place) {
+    g_heap.in_use += nsize - osize;
+    if (g_heap.in_use > g_heap.peak) g_heap.peak = g_heap.in_use;
+    return ptr;
+  }
+
+  void* np = acquire(nsize);
+  if (!np) return nullptr;
+  memcpy(np, ptr, osize < nsize ? osize : nsize);
+  release(ptr, osize);
+  return np;
+}
+
+static int heap_panic(lua_State* L) {
+  const char* msg = lua_tostring(L, -1);
+  Serial.print("PANIC: unprotected error in call to Lua API (");
+  Serial.print(msg ? msg : "error object is not a string");
+  Serial.println(")");
+  return 0;  // return to Lua to abort
+}
+
+// warn() handlers, as luaL_newstate installs them (on, with "@on"/"@off"
+// control messages), but written to Serial.
+static void heap_warn_on(void* ud, const char* msg, int tocont);
+static void heap_warn_off(void* ud, const char* msg, int tocont);
+static void heap_warn_cont(void* ud, const char* msg, int tocont);
+
+static bool heap_warn_control(lua_State* L, const char* msg, int tocont) {
+  if (tocont || *msg++ != '@') return false;
+  if (strcmp(msg, "off") == 0) {
+    lua_setwarnf(L, heap_warn_off, L);
+  } else if (strcmp(msg, "on") == 0) {
+    lua_setwarnf(L, heap_warn_on, L);
+  }
+  return true;
+}
+
+static void heap_warn_off(void* ud, const char* msg, int tocont) {
+  heap_warn_control(static_cast<lua_State*>(ud), msg, tocont);
+}
+
+static void heap_warn_cont(void* ud, const char* msg, int tocont) {
+  lua_State* L = static_cast<lua_State*>(ud);
+  Serial.print(msg);
+  if (tocont) {
+    lua_setwarnf(L, heap_warn_cont, L);
+  } else {
+    Serial.println();
+    lua_setwarnf(L, heap_warn_on, L);
+  }
+}
+
+static void heap_warn_on(void* ud, const char* msg, int tocont) {
+  if (heap_warn_control(static_cast<lua_State*>(ud), msg, tocont)) return;
+  Serial.print("Lua warning: ");
+  heap_warn_cont(ud, msg, tocont);
+}
+
+}  // namespace
+
+lua_State* lua_cardstock_heap_newstate() {
+  if (g_heap.owner || !arena_reserve()) {
+    g_state_fallbacks++;
+    Serial.println(g_heap.owner ? "lua heap: arena in use, state on the system heap"
+                                : "lua heap: no arena, state on the system heap");
+    return luaL_newstate();
+  }
+
+  lua_State* L = lua_newstate(heap_alloc, &g_heap, luaL_makeseed(nullptr));
+  if (!L) return nullptr;
+  lua_atpanic(L, heap_panic);
+  lua_setwarnf(L, heap_warn_on, L);
+  g_heap.owner = L;
+  return L;
+}
+
+void lua_cardstock_heap_close(lua_State* L) {
+  if (!L) return;
+  if (L != g_heap.owner) {
+    lua_close(L);
+    return;
+  }
+
+  // Finalizers still run inside lua_close; only the per-block frees are skipped.
+  g_heap.closing = true;
+  lua_close(L);
+  g_heap.closing = false;
+  g_heap.owner = nullptr;
+  arena_reset();
+}
+
+LuaHeapStats lua_cardstock_heap_stats() {
+  LuaHeapStats s;
+  s.enabled = g_heap.owner != nullptr;
+  s.arena_bytes = g_heap.size;
+  s.in_use_bytes = g_heap.in_use;
+  s.peak_bytes = g_heap.peak;
+  s.fallback_bytes = g_heap.fallback_bytes;
+  s.fallback_allocs = g_heap.fallback_allocs;
+  s.state_fallbacks = g_state_fallbacks;
+  if (!g_heap.base) return s;
+
+  size_t large_free_bytes = 0;
+  size_t largest = 0;
+  for (int i = 0; i < kBuckets; i++) {
+    for (BlockHeader* b = g_heap.buckets[i]; b; b = links(b)->next) {
+      large_free_bytes += block_size(b);
+      if (block_size(b) > largest) largest = block_size(b);
+    }
+  }
+  s.largest_free_block = largest > kHeader ? largest - kHeader : 0;
+  s.free_bytes = large_free_bytes + g_heap.small_free_bytes;
+  s.fragmentation = large_free_bytes ? 1.0f - static_cast<float>(largest) / static_cast<float>(large_free_bytes) : 0.0f;
+  return s;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// Dedicated heap for the Lua state.
+//
+// All Lua allocations are served from one arena reserved once at boot instead
+// of the shared ESP-IDF heap, so Lua garbage never fragments the memory M5GFX
+// needs for sprite buffers. Small objects (<= 128 B) come from per-size-class
+// free lists carved out of slabs; larger blocks come from a segregated-fit
+// allocator with boundary-tag coalescing. If the arena runs out, slabs with no
+// live objects go back to the large allocator; only if that doesn't help do
+// requests fall back to the system heap, counted in the stats.
+//
+// lua_cardstock_heap_close() runs lua_close() with arena frees turned into
+// no-ops (finalizers such as sprite __gc still run), then resets the arena to
+// a single free block in O(1).
+
+#include "lua.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct LuaHeapStats {
+  bool enabled = false;
+  size_t arena_bytes = 0;
+  size_t in_use_bytes = 0;        // live bytes as requested by Lua (arena + fallback)
+  size_t peak_bytes = 0;          // high-water mark of in_use_bytes since last reset
+  size_t free_bytes = 0;          // free arena bytes (large free blocks + small free lists)
+  size_t largest_free_block = 0;  // largest single allocation the arena can satisfy
+  size_t fallback_bytes = 0;      // live bytes served by the system heap
+  uint32_t fallback_allocs = 0;   // allocations that missed the arena since last reset
+  uint32_t state_fallbacks = 0;   // newstate calls that got a plain luaL_newstate(), since boot
+  float fragmentation = 0.0f;     // 1 - largest_free_block / free large-block bytes
+};
+
+// Create a Lua state (luaL_newstate semantics) whose allocations use the arena.
+// Falls back to a plain luaL_newstate(), logged to Serial and counted in
+// state_fallbacks, if the arena is in use or cannot be reserved.
+lua_State* lua_cardstock_heap_newstate();
+
+// Close a state created by lua_cardstock_heap_newstate() and wipe the arena.
+void lua_cardstock_heap_close(lua_State* L);
+
+LuaHeapStats lua_cardstock_heap_stats();
@@ -0,0 +1,143 @@
+#include "module_cache.h"
+
+#include <Arduino.h>
+
+#include <memory>
+#include <new>
+#include <vector>
+
+// Byte budget for resident module bytecode. Disable with: -DCARDSTOCK_MODULE_CACHE_BYTES=0
+#ifndef CARDSTOCK_MODULE_CACHE_BYTES
+#define CARDSTOCK_MODULE_CACHE_BYTES (32 * 1024)
+#endif
+
+// Only modules under this root are kept resident; app-local modules are
+// dropped with their app anyway.
+#ifndef CARDSTOCK_MODULE_CACHE_ROOT
+#define CARDSTOCK_MODULE_CACHE_ROOT "/syslib/"
+#endif
+
+// Same switch as the SD bytecode cache (load_sd.cpp): debug info is kept
+// unless -DCARDSTOCK_BYTECODE_STRIP=1.
+#ifndef CARDSTOCK_BYTECODE_STRIP
+#define CARDSTOCK_BYTECODE_STRIP 0
+#endif
+
+namespace {
+
+struct Entry {
+  String path;
+  std::unique_ptr<uint8_t[]> data;
+  size_t len = 0;
+  uint32_t last_used = 0;
+};
+
+static std::vector<Entry> g_entries;
+static size_t g_bytes = 0;
+static uint32_t g_clock = 0;  // bumped on every hit/store; orders entries for LRU
+static LuaModuleCacheStats g_stats;
+
+struct DumpBuffer {
+  uint8_t* dst = nullptr;
+  size_t len = 0;
+};
+
+static int dump_writer(lua_State* L, const void* p, size_t sz, void* ud) {
+  (void)L;
+  DumpBuffer* b = static_cast<DumpBuffer*>(ud);
+  if (!p || !sz) return 0;  // end-of-dump marker
+  if (b->dst) memcpy(b->dst + b->len, p, sz);
+  b->len += sz;
+  return 0;
+}
+
+static Entry* find(const char* path) {
+  for (Entry& e : g_entries) {
+    if (e.path == path) return &e;
+  }
+  return nullptr;
+}
+
+static void erase_at(size_t i) {
+  g_bytes -= g_entries[i].len;
+  g_entries.erase(g_entries.begin() + i);
+}
+
+static void evict_until_fits(size_t incoming) {
+  while (!g_entries.empty() && g_bytes + incoming > CARDSTOCK_MODULE_CACHE_BYTES) {
+    size_t oldest = 0;
+    for (size_t i = 1; i < g_entries.size(); i++) {
+      if (g_entries[i].last_used < g_entries[oldest].last_used) oldest = i;
+    }
+    erase_at(oldest);
+    g_stats.evictions++;
+  }
+}
+
+}  // namespace
+
+bool lua_cardstock_module_cache_accepts(const char* path) {
+  if (CARDSTOCK_MODULE_CACHE_BYTES == 0 || !path) return false;
+  return strncmp(path, CARDSTOCK_MODULE_CACHE_ROOT, strlen(CARDSTOCK_MODULE_CACHE_ROOT)) == 0;
+}
+
+bool lua_cardstock_module_cache_load(lua_State* L, const char* path, const char* chunkname) {
+  Entry* e = find(path);
+  if (!e) {
+    g_stats.misses++;
+    return false;
+  }
+
+  if (luaL_loadbufferx(L, reinterpret_cast<const char*>(e->data.get()), e->len, chunkname, "b") != LUA_OK) {
+    lua_pop(L, 1);
+    lua_cardstock_module_cache_invalidate(path);
+    g_stats.misses++;
+    return false;
+  }
+
+  e->last_used = ++g_clock;
+  g_stats.hits++;
+  return true;
+}
+
+void lua_cardstock_module_cache_store(lua_State* L, const char* path) {
+  if (!lua_cardstock_module_cache_accepts(path) || !lua_isfunction(L, -1)) return;
+
+  // Size the blob first so it gets exactly one allocation.
+  DumpBuffer sizing;
+  lua_dump(L, dump_writer, &sizing, CARDSTOCK_BYTECODE_STRIP);
+  if (!sizing.len || sizing.len > CARDSTOCK_MODULE_CACHE_BYTES) return;
+
+  lua_cardstock_module_cache_invalidate(path);
+  evict_until_fits(sizing.len);
+
+  Entry e;
+  e.data.reset(new (std::nothrow) uint8_t[sizing.len]);
+  if (!e.data) return;
+
+  DumpBuffer fill;
+  fill.dst = e.data.get();
+  lua_dump(L, dump_writer, &fill, CARDSTOCK_BYTECODE_STRIP);
+  if (fill.len != sizing.len) return;
+
+  e.path = path;
+  e.len = fill.len;
+  e.last_used = ++g_clock;
+  g_bytes += e.len;
+  g_entries.push_back(std::move(e));
+}
+
+void lua_cardstock_module_cache_invalidate(const char* prefix) {
+  const size_t n = prefix ? strlen(prefix) : 0;
+  for (size_t i = g_entries.size(); i > 0; --i) {
+    if (!n || strncmp(g_entries[i - 1].path.c_str(), prefix, n) == 0) erase_at(i - 1);
+  }
+}
+
+LuaModuleCacheStats lua_cardstock_module_cache_stats() {
+  LuaModuleCacheStats s = g_stats;
+  s.entries = g_entries.size();
+  s.bytes = g_bytes;
+  s.budget = CARDSTOCK_MODULE_CACHE_BYTES;
+  return s;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+// Resident bytecode cache for shared Lua modules.
+//
+// Holds dumped bytecode for modules under /syslib in C++ heap so they
+// survive lua_State re-creation on switch_app: the next require() of the
+// same module is a luaL_loadbuffer from RAM with no SD access and no parse.
+// Memory is bounded by CARDSTOCK_MODULE_CACHE_BYTES; least recently used
+// entries are evicted first. Entries are trusted until invalidated, so code
+// that rewrites files under /syslib must call
+// lua_cardstock_module_cache_invalidate().
+
+#include "lua.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct LuaModuleCacheStats {
+  uint32_t hits = 0;
+  uint32_t misses = 0;
+  uint32_t evictions = 0;
+  size_t entries = 0;
+  size_t bytes = 0;
+  size_t budget = 0;
+};
+
+// True if `path` (absolute, normalized) is eligible for the resident cache.
+bool lua_cardstock_module_cache_accepts(const char* path);
+
+// On hit, pushes the chunk for `path` and returns true. Stack unchanged on miss.
+bool lua_cardstock_module_cache_load(lua_State* L, const char* path, const char* chunkname);
+
+// Dumps the function on top of the stack and stores it under `path`.
+void lua_cardstock_module_cache_store(lua_State* L, const char* path);
+
+// Drops entries whose path starts with `prefix` (nullptr or "" drops all).
+void lua_cardstock_module_cache_invalidate(const char* prefix);
+
+LuaModuleCacheStats lua_cardstock_module_cache_stats();
@@ -1,10 +1,22 @@
 #include "require_sd.h"
+#include "load_sd.h"
+#include "module_cache.h"
+#include "services/SdService.h"
 
 #include <Arduino.h>
 #include <SD.h>
+#include <strings.h>
 
-#include <new>
-#include <memory>
+#include <algorithm>
+#include <vector>
+
+// Upper bound on .lua files indexed per root. Roots with more files fall back
+// to probing SD for every candidate.
+#ifndef CARDSTOCK_REQUIRE_INDEX_MAX_FILES
+#define CARDSTOCK_REQUIRE_INDEX_MAX_FILES 512
+#endif
+
+// Log SD opens per require() to Serial. Enable with: -DCARDSTOCK_LOAD_STATS
 
 namespace {
 
@@ -12,15 +24,6 @@ namespace {
 static const char* kAppRootKey = "cardstock.app_root";
 static const char* kSysLibRoot = "/syslib";
 
-static String normalize_abs_path(const String& p) {
-  if (!p.length()) return "";
-  String out = p;
-  if (out[0] != '/') out = String("/") + out;
-  // Strip trailing slashes (except for "/")
-  while (out.length() > 1 && out[out.length() - 1] == '/') out.remove(out.length() - 1);
-  return out;
-}
-
 static bool contains_path_traversal(const char* s) {
   if (!s) return false;
   // Disallow any ".." path segment.
@@ -43,44 +46,97 @@ static String module_name_to_rel_path(const char* modname) {
   return out;
 }
 
-static bool read_entire_file(const String& path, std::unique_ptr<uint8_t[]>& out_buf, size_t& out_len, String& out_err) {
-  const String normalized = normalize_abs_path(path);
-  File f = SD.open(normalized.c_str(), FILE_READ);
-  if (!f) {
-    out_err = "open failed: " + normalized;
-    return false;
-  }
+// -------------------------------
+// Path-existence index
+// -------------------------------
+// Each search root (/syslib, the current app root) is enumerated on first use
+// and its .lua files kept in a sorted list, so candidates that don't exist are
+// rejected without an SD.open (a FAT directory walk per miss). App roots are
+// dropped when their app closes. FAT is case-insensitive, so lookups are too.
+
+struct RootIndex {
+  String root;
+  bool complete = false;  // false: too many files, nested too deep, or enumeration failed; probe SD
+  std::vector<String> files;
+};
+
+static std::vector<RootIndex> g_index;
+static LuaRequireStats g_require_stats;
+static uint32_t g_index_opens = 0;  // directory and entry opens made building g_index
+
+static File index_open(const char* path) {
+  g_index_opens++;
+  return SD.open(path, FILE_READ);
+}
 
-  size_t sz = static_cast<size_t>(f.size());
-  if (sz == 0) {
-    out_err = "empty file: " + normalized;
-    f.close();
-    return false;
-  }
+static File index_next(File& dir) {
+  File entry = dir.openNextFile();
+  if (entry) g_index_opens++;
+  return entry;
+}
+
+static bool ends_with_lua(const char* p) {
+  const size_t n = strlen(p);
+  return n >= 4 && strcasecmp(p + n - 4, ".lua") == 0;
+}
 
-  std::unique_ptr<uint8_t[]> buf(new (std::nothrow) uint8_t[sz]);
-  if (!buf) {
-    out_err = "OOM reading: " + normalized;
-    f.close();
-    return false;
+static bool path_less(const String& a, const String& b) {
+  return strcasecmp(a.c_str(), b.c_str()) < 0;
+}
+
+static bool collect_lua_files(File& dir, std::vector<String>& out, int depth) {
+  if (depth > 8) return false;  // too deep to list fully; leave the root unindexed
+  for (File entry = index_next(dir); entry; entry = index_next(dir)) {
+    if (entry.isDirectory()) {
+      const bool ok = collect_lua_files(entry, out, depth + 1);
+      entry.close();
+      if (!ok) return false;
+      continue;
+    }
+    const char* p = entry.path();
+    if (p && ends_with_lua(p)) {
+      if (out.size() >= CARDSTOCK_REQUIRE_INDEX_MAX_FILES) {
+        entry.close();
+        return false;
+      }
+      out.push_back(SdService::normalizePath(String(p)));
+    }
+    entry.close();
   }
+  return true;
+}
 
-  size_t read_total = 0;
-  while (read_total < sz) {
-    int n = f.read(buf.get() + read_total, sz - read_total);
-    if (n <= 0) break;
-    read_total += static_cast<size_t>(n);
+static RootIndex& index_for_root(const String& root) {
+  for (RootIndex& idx : g_index) {
+    if (idx.root == root) return idx;
   }
-  f.close();
 
-  if (read_total != sz) {
-    out_err = "short read: " + normalized;
-    return false;
+  RootIndex idx;
+  idx.root = root;
+  File dir = index_open(root.c_str());
+  if (!dir) {
+    idx.complete = true;  // missing root: every candidate under it misses
+  } else if (dir.isDirectory()) {
+    idx.complete = collect_lua_files(dir, idx.files, 0);
+    if (idx.complete) {
+      std::sort(idx.files.begin(), idx.files.end(), path_less);
+    } else {
+      idx.files.clear();
+      idx.files.shrink_to_fit();
+    }
   }
+  if (dir) dir.close();
+  g_require_stats.index_builds++;
 
-  out_buf = std::move(buf);
-  out_len = sz;
-  return true;
+  g_index.push_back(std::move(idx));
+  return g_index.back();
+}
+
+// False only when the index proves `path` does not exist under `root`.
+static bool may_exist(const String& root, const String& path) {
+  const RootIndex& idx = index_for_root(root);
+  if (!idx.complete) return true;
+  return std::binary_search(idx.files.begin(), idx.files.end(), path, path_less);
 }
 
 static String get_app_root(lua_State* L) {
@@ -117,27 +173,39 @@ static int l_cardstock_searcher(lua_State* L) {
 
   // Build candidates.
   String candidates[4];
+  String roots[4];
   int n = 0;
 
   if (app_root.length()) {
+    roots[n] = app_root;
     candidates[n++] = app_root + "/" + rel + ".lua";
+    roots[n] = app_root;
     candidates[n++] = app_root + "/" + rel + "/init.lua";
   }
 
+  roots[n] = kSysLibRoot;
   candidates[n++] = String(kSysLibRoot) + "/" + rel + ".lua";
+  roots[n] = kSysLibRoot;
   candidates[n++] = String(kSysLibRoot) + "/" + rel + "/init.lua";
 
+  g_require_stats.requires++;
+  const uint32_t opens_before = lua_cardstock_sd_open_count() + g_index_opens;
+
   // Try candidates in order.
   for (int i = 0; i < n; i++) {
     const String& p = candidates[i];
-    String err;
-    std::unique_ptr<uint8_t[]> buf;
-    size_t len = 0;
 
-    // Load full file into chunk.
-    if (!read_entire_file(p, buf, len, err)) continue;
+    if (!may_exist(roots[i], p)) {
+      g_require_stats.index_skips++;
+      continue;
+    }
 
-    int rc = luaL_loadbuffer(L, reinterpret_cast<const char*>(buf.get()), len, p.c_str());
+    // Load chunk (from the bytecode cache when fresh).
+    int rc = lua_cardstock_loadfile(L, p.c_str());
+    if (rc == LUA_ERRFILE) {
+      lua_pop(L, 1);  // missing/unreadable; try next candidate
+      continue;
+    }
     if (rc != LUA_OK) {
       const char* emsg = lua_tostring(L, -1);
       String m = "load error in ";
@@ -149,11 +217,17 @@ static int l_cardstock_searcher(lua_State* L) {
       return 1;
     }
 
-    lua_pushstring(L, normalize_abs_path(p).c_str());
+    lua_pushstring(L, SdService::normalizePath(p).c_str());
     loaded = true;
     break;
   }
 
+  const uint32_t opens = lua_cardstock_sd_open_count() + g_index_opens - opens_before;
+  g_require_stats.sd_opens += opens;
+#ifdef CARDSTOCK_LOAD_STATS
+  Serial.println(String("require ") + modname + ": " + String(static_cast<unsigned long>(opens)) + " SD opens");
+#endif
+
   if (loaded) return 2;
 
   // Not found. Provide a single aggregated message.
@@ -208,10 +282,24 @@ void lua_cardstock_install_require(lua_State* L) {
 void lua_cardstock_set_app_root(lua_State* L, const char* app_root) {
   if (!L) return;
   String root = app_root ? String(app_root) : String("");
-  root = normalize_abs_path(root);
+  root = SdService::normalizePath(root);
   lua_pushstring(L, kAppRootKey);
   lua_pushstring(L, root.c_str());
   lua_settable(L, LUA_REGISTRYINDEX);
 }
 
+void lua_cardstock_require_reset() {
+  g_index.erase(std::remove_if(g_index.begin(), g_index.end(),
+                               [](const RootIndex& idx) { return idx.root != kSysLibRoot; }),
+                g_index.end());
+}
 
+void lua_cardstock_require_invalidate() {
+  g_index.clear();
+  g_index.shrink_to_fit();
+  lua_cardstock_module_cache_invalidate(nullptr);
+}
+
+LuaRequireStats lua_cardstock_require_stats() {
+  return g_require_stats;
+}
@@ -7,9 +7,22 @@
 //   2) /syslib/<module>.lua and /syslib/<module>/init.lua
 //
 // The app root is set by the host (C++) per loaded entrypoint.
+//
+// Each root's .lua files are indexed on first use (/syslib once per boot, an
+// app root once per launch), so missing candidates are rejected from RAM
+// instead of with an SD.open per probe.
 
 #include "lua.hpp"
 
+#include <stdint.h>
+
+struct LuaRequireStats {
+  uint32_t requires = 0;      // searcher invocations
+  uint32_t sd_opens = 0;      // SD opens (files, index directories and entries) made resolving them
+  uint32_t index_skips = 0;   // candidates rejected by the path index
+  uint32_t index_builds = 0;  // root directories enumerated
+};
+
 // Install the Cardstock SD-backed searcher into `package.searchers`.
 void lua_cardstock_install_require(lua_State* L);
 
@@ -17,4 +30,12 @@ void lua_cardstock_install_require(lua_State* L);
 // Pass "" or nullptr to disable app-scoped lookup.
 void lua_cardstock_set_app_root(lua_State* L, const char* app_root);
 
+// Drop the index of every root but /syslib. Call when an app is closed so the
+// roots of earlier apps don't accumulate.
+void lua_cardstock_require_reset();
+
+// Drop the path index and resident module cache. Call after anything writes
+// to SD (e.g. debug-protocol uploads) so new/changed modules are picked up.
+void lua_cardstock_require_invalidate();
 
+LuaRequireStats lua_cardstock_require_stats();
@@ -27,8 +27,23 @@ extern "C" {
 #include "M5Cardputer.h"
 #include "lua/bindings/lua_gfx.h"
 #include "lua/require_sd.h"
+#include "lua/load_sd.h"
+#include "lua/bench_numeric.h"
+#include "lua/bench_gfx.h"
+#include "lua/bench_heap.h"
+#include "lua/bench_input.h"
 #include "lua/bindings/lua_keyboard.h"
+#include "lua/bindings/lua_sys.h"
+#include "lua/bindings/lua_ui.h"
+#include "lua/lua_heap.h"
 #include "debug/SerialDebug.h"
+#include "services/BufferService.h"
+#include "services/FrameService.h"
+#include "services/GfxService.h"
+#include "services/ImageService.h"
+#include "services/KeyboardService.h"
+#include "services/SdService.h"
+#include "services/UiService.h"
 
 // -------------------------------
 // Build-time configuration knobs
@@ -50,6 +65,33 @@ extern "C" {
 #define CARDSTOCK_SD_FREQ_HZ 20000000u
 #endif
 
+// Launch-time benchmark of cold parse vs bytecode-cache load for each entrypoint,
+// logged to Serial. Enable with: -DCARDSTOCK_BENCH_LOAD
+
+// Numeric microbenchmarks (compare the default build with the f32 env), run
+// once per entrypoint and logged to Serial. Enable with: -DCARDSTOCK_BENCH_NUMERIC
+
+// Cold vs cached load time for every image in CARDSTOCK_BENCH_IMAGE_DIR (default
+// "/icons"), run once at boot and logged to Serial. Enable with: -DCARDSTOCK_BENCH_IMAGES
+#if defined(CARDSTOCK_BENCH_IMAGES) && !defined(CARDSTOCK_BENCH_IMAGE_DIR)
+#define CARDSTOCK_BENCH_IMAGE_DIR "/icons"
+#endif
+
+// GC-heavy Lua workload on the Lua arena vs the default allocator, run once
+// per entrypoint (before its state is created) and logged to Serial.
+// Enable with: -DCARDSTOCK_BENCH_HEAP
+
+// Per-call vs batched gfx draw-call throughput on a launcher-style screen, run
+// once per entrypoint and logged to Serial. Enable with: -DCARDSTOCK_BENCH_GFX
+
+// Per-frame cost of reading 12 keys with isKeyPressed, state() and
+// pressedKeys(), run once per entrypoint and logged to Serial.
+// Enable with: -DCARDSTOCK_BENCH_INPUT
+
+// Keys lost at the current frame rate: each time the keyboard stats change,
+// logs presses that per-frame polling missed next to events the queue dropped.
+// Type into an app throttled to 10 FPS to compare. Enable with: -DCARDSTOCK_BENCH_KEYS
+
 // -------------------------------
 // Tiny Lua host runtime
 // -------------------------------
@@ -59,7 +101,6 @@ struct LuaHost {
   String current_path;
   String pending_path;
   bool reload_requested = false;
-  uint32_t last_ms = 0;
   String app_root;
 };
 
@@ -81,6 +122,7 @@ static void host_set_for_lua(lua_State* L, LuaHost* host) {
 
 static void ui_status(const String& line1, const String& line2 = "") {
   // Simple status overlay for early bring-up.
+  GfxService::waitFlush();
   M5Cardputer.Display.fillScreen(BLACK);
   M5Cardputer.Display.setTextSize(1);
   M5Cardputer.Display.setCursor(0, 0);
@@ -106,58 +148,8 @@ static bool init_sd_card() {
 #endif
 }
 
-static bool read_entire_file_from_sd(const String& path, std::unique_ptr<uint8_t[]>& out_buf, size_t& out_len, String& out_err) {
-  // ESP32 SD/FS paths are effectively absolute (no working-directory semantics).
-  // Root files often work without a leading '/', but subdirectories commonly won't.
-  const String normalized = (path.length() && path[0] == '/') ? path : (String("/") + path);
-  File f = SD.open(normalized.c_str(), FILE_READ);
-  if (!f) {
-    out_err = "SD.open failed: " + normalized + "\nMake sure your SD card is formatted correctly.";
-    return false;
-  }
-
-  size_t sz = static_cast<size_t>(f.size());
-  if (sz == 0) {
-    out_err = "Empty file: " + normalized;
-    f.close();
-    return false;
-  }
-
-  std::unique_ptr<uint8_t[]> buf(new (std::nothrow) uint8_t[sz]);
-  if (!buf) {
-    out_err = "OOM reading: " + normalized;
-    f.close();
-    return false;
-  }
-
-  size_t read_total = 0;
-  while (read_total < sz) {
-    int n = f.read(buf.get() + read_total, sz - read_total);
-    if (n <= 0) break;
-    read_total += static_cast<size_t>(n);
-  }
-  f.close();
-
-  if (read_total != sz) {
-    out_err = "Short read: " + normalized;
-    return false;
-  }
-
-  out_buf = std::move(buf);
-  out_len = sz;
-  return true;
-}
-
-static String normalize_abs_path(const String& p) {
-  if (!p.length()) return "";
-  String out = p;
-  if (out[0] != '/') out = String("/") + out;
-  while (out.length() > 1 && out[out.length() - 1] == '/') out.remove(out.length() - 1);
-  return out;
-}
-
 static String compute_app_root_for_entrypoint(const String& entry_script_path) {
-  const String p = normalize_abs_path(entry_script_path);
+  const String p = SdService::normalizePath(entry_script_path);
 
   // Preferred: apps live at /apps/<appID>/...
   if (p.startsWith("/apps/")) {
@@ -235,18 +227,27 @@ static bool lua_call_optional(lua_State* L, const char* fn_name, int nargs, int
 
 static void lua_close_state(LuaHost& host) {
   if (host.L) {
-    lua_close(host.L);
+    lua_cardstock_heap_close(host.L);
     host.L = nullptr;
   }
 }
 
 static bool lua_boot_and_load(LuaHost& host, const String& script_path) {
   lua_close_state(host);
+  GfxService::reset();
+  UiService::reset();
+  KeyboardService::clear();  // keys typed into the old app
+  lua_cardstock_require_reset();  // the old app root's path index
+  BufferService::trim();  // the closed app's sprite buffers back to the heap
+
+#ifdef CARDSTOCK_BENCH_HEAP
+  lua_cardstock_bench_heap();  // needs the arena, so before the app's state exists
+#endif
 
-  host.L = luaL_newstate();
+  host.L = lua_cardstock_heap_newstate();
   if (!host.L) {
-    ui_status("Lua", "luaL_newstate failed");
-    log_line("luaL_newstate failed");
+    ui_status("Lua", "lua_newstate failed");
+    log_line("lua_newstate failed");
     return false;
   }
 
@@ -263,6 +264,10 @@ static bool lua_boot_and_load(LuaHost& host, const String& script_path) {
   lua_pop(host.L, 1);  // pop returned module table
   luaL_requiref(host.L, "keyboard", luaopen_keyboard, 1);
   lua_pop(host.L, 1);  // pop returned module table
+  luaL_requiref(host.L, "sys", luaopen_sys, 1);
+  lua_pop(host.L, 1);  // pop returned module table
+  luaL_requiref(host.L, "ui", luaopen_ui, 1);
+  lua_pop(host.L, 1);  // pop returned module table
 
   // Override print() to go to Serial (handy on embedded).
   lua_pushcfunction(host.L, l_print_serial);
@@ -272,16 +277,28 @@ static bool lua_boot_and_load(LuaHost& host, const String& script_path) {
   lua_pushcfunction(host.L, l_switch_app);
   lua_setglobal(host.L, "switch_app");
 
-  std::unique_ptr<uint8_t[]> buf;
-  size_t len = 0;
-  String err;
-  if (!read_entire_file_from_sd(script_path, buf, len, err)) {
+#ifdef CARDSTOCK_BENCH_LOAD
+  lua_cardstock_bench_loadfile(host.L, script_path.c_str());
+#endif
+#ifdef CARDSTOCK_BENCH_NUMERIC
+  lua_cardstock_bench_numeric(host.L);
+#endif
+#ifdef CARDSTOCK_BENCH_GFX
+  lua_cardstock_bench_gfx(host.L);
+#endif
+#ifdef CARDSTOCK_BENCH_INPUT
+  lua_cardstock_bench_input(host.L);
+#endif
+
+  int rc = lua_cardstock_loadfile(host.L, script_path.c_str());
+  if (rc == LUA_ERRFILE) {
+    String err = lua_tostring(host.L, -1);
+    lua_pop(host.L, 1);
+    err += "\nMake sure your SD card is formatted correctly.";
     ui_status("SD read failed", err);
     log_line(err);
     return false;
   }
-
-  int rc = luaL_loadbuffer(host.L, reinterpret_cast<const char*>(buf.get()), len, script_path.c_str());
   if (rc != LUA_OK) {
     lua_report_top_error(host.L, "load: ");
     return false;
@@ -295,6 +312,7 @@ static bool lua_boot_and_load(LuaHost& host, const String& script_path) {
   host.current_path = script_path;
   host.pending_path = "";
   host.reload_requested = false;
+  FrameService::reset();
 
   ui_status("Lua loaded", host.current_path);
 
@@ -310,6 +328,7 @@ void setup() {
 
   auto cfg = M5.config();
   M5Cardputer.begin(cfg);
+  KeyboardService::begin();
   M5Cardputer.Display.setRotation(1);
   
   // Initialize debug mode sprite (width, height, color depth)
@@ -325,32 +344,52 @@ void setup() {
     return;
   }
 
+#ifdef CARDSTOCK_BENCH_IMAGES
+  ImageService::bench(CARDSTOCK_BENCH_IMAGE_DIR);
+#endif
+
   ui_status("SD OK", String("Loading ") + CARDSTOCK_LUA_ENTRY);
-  g_host.last_ms = millis();
   lua_boot_and_load(g_host, String(CARDSTOCK_LUA_ENTRY));
 }
 
 void loop() {
-  M5Cardputer.update();
+  KeyboardService::update();
 
   if (g_host.L) { // If Lua is loaded, run the main loop
-    uint32_t now = millis();
-    float dt = (now - g_host.last_ms) / 1000.0f;
-    g_host.last_ms = now;
-
-    // tick(dt)
-    lua_pushnumber(g_host.L, dt);
-    if (!lua_call_optional(g_host.L, "tick", 1, 0)) {
-      // On error, keep Lua alive so user can see the message. (They can switch apps via reset.)
-      delay(250);
-      return;
+    const uint32_t ticks = FrameService::beginFrame(KeyboardService::hasActivity());
+    const float dt = FrameService::tickSeconds();
+
+    // tick(dt), on a fixed timestep (possibly several times to catch up)
+    for (uint32_t i = 0; i < ticks; i++) {
+      const uint32_t t0 = micros();
+      lua_pushnumber(g_host.L, dt);
+      const bool ok = lua_call_optional(g_host.L, "tick", 1, 0);
+      FrameService::recordTick(micros() - t0);
+      if (!ok) {
+        // On error, keep Lua alive so user can see the message. (They can switch apps via reset.)
+        delay(250);
+        return;
+      }
     }
 
-    // draw()
-    if (!lua_call_optional(g_host.L, "draw", 0, 0)) {
+    // draw(); returning false tells the scheduler nothing changed (idle)
+    const uint32_t t0 = micros();
+    const int top = lua_gettop(g_host.L);
+    if (!lua_call_optional(g_host.L, "draw", 0, 1)) {
       delay(250);
       return;
     }
+    bool changed = true;
+    if (lua_gettop(g_host.L) > top) {
+      changed = !(lua_isboolean(g_host.L, -1) && !lua_toboolean(g_host.L, -1));
+      lua_settop(g_host.L, top);
+    }
+    FrameService::recordDraw(micros() - t0, changed);
+
+    // Start flushing damaged regions (frame-buffer mode) and roll over damage stats.
+    const uint32_t t1 = micros();
+    GfxService::endFrame();
+    FrameService::recordFlush(micros() - t1);
 
     // If Lua requested a new script, reload cleanly between frames.
     if (g_host.reload_requested) {
@@ -366,8 +405,18 @@ void loop() {
       }
     }
 
-    // Keep loop responsive; adjust later if you add a fixed framerate.
-    delay(1);
+#ifdef CARDSTOCK_BENCH_KEYS
+    static uint32_t logged_events = 0;
+    const KeyboardService::Stats& keys = KeyboardService::stats();
+    if (keys.events != logged_events) {
+      logged_events = keys.events;
+      Serial.println(String("bench keys: ") + keys.events + " events, " + keys.missed + " missed by polling, " +
+                     keys.dropped + " dropped from queue, frame " + FrameService::stats().frame_us + " us");
+    }
+#endif
+
+    // Sleep until the next frame deadline.
+    FrameService::endFrame();
   }
 
   int serialResult = SerialDebug::handleSerialInput();
@@ -385,6 +434,7 @@ void loop() {
     debug_sprite.drawString("DEV MODE", 5, 2.5);
     
     // Push sprite to display in one operation
+    GfxService::waitFlush();
     debug_sprite.pushSprite(0, 0);
   }
 }
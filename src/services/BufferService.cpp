@@ -0,0 +1,121 @@
+#include "BufferService.h"
+
+#include <esp_heap_caps.h>
+
+// Most bytes kept in the pool for reuse; released buffers beyond it go back
+// to the heap. Disable the pool with: -DCARDSTOCK_BUFFER_POOL_BYTES=0
+#ifndef CARDSTOCK_BUFFER_POOL_BYTES
+#define CARDSTOCK_BUFFER_POOL_BYTES (64 * 1024)
+#endif
+
+namespace BufferService {
+
+namespace {
+
+// Classes start at 2^kMinShift bytes; every power of two is split in four.
+static const int kMinShift = 6;
+static const int kMaxShift = 20;
+static const int kClasses = (kMaxShift - kMinShift) * 4 + 1;
+
+static const uint32_t kCaps = MALLOC_CAP_DMA | MALLOC_CAP_8BIT;
+
+// Free buffers link through their first bytes.
+struct FreeBuffer {
+  FreeBuffer* next;
+};
+
+static FreeBuffer* g_free[kClasses] = {};
+static Stats g_stats;
+
+static size_t class_bytes(int c) {
+  const int shift = kMinShift + c / 4;
+  return (static_cast<size_t>(4 + c % 4) << shift) / 4;
+}
+
+// Smallest class holding `bytes`, or -1 if it's larger than any class.
+static int class_of(size_t bytes) {
+  if (bytes <= (static_cast<size_t>(1) << kMinShift)) return 0;
+  int shift = kMinShift;
+  while (shift < kMaxShift && bytes > (static_cast<size_t>(1) << (shift + 1))) shift++;
+  if (shift == kMaxShift) return -1;
+  int c = (shift - kMinShift) * 4;
+  while (class_bytes(c) < bytes) c++;
+  return c;
+}
+
+static void note_high_water() {
+  const uint32_t total = g_stats.in_use_bytes + g_stats.pooled_bytes;
+  if (total > g_stats.high_water_bytes) g_stats.high_water_bytes = total;
+}
+
+}  // namespace
+
+  void* acquire(size_t bytes) {
+    g_stats.acquires++;
+    const int c = class_of(bytes);
+    if (c < 0) {
+      g_stats.failures++;
+      return nullptr;
+    }
+    const size_t size = class_bytes(c);
+
+    void* p = g_free[c];
+    if (p) {
+      g_free[c] = g_free[c]->next;
+      g_stats.hits++;
+      g_stats.pooled--;
+      g_stats.pooled_bytes -= size;
+    } else {
+      p = heap_caps_malloc(size, kCaps);
+      if (!p && g_stats.pooled) {
+        trim();
+        p = heap_caps_malloc(size, kCaps);
+      }
+      if (!p) {
+        g_stats.failures++;
+        return nullptr;
+      }
+    }
+
+    g_stats.in_use++;
+    g_stats.in_use_bytes += size;
+    note_high_water();
+    return p;
+  }
+
+  void release(void* buffer, size_t bytes) {
+    if (!buffer) return;
+    const int c = class_of(bytes);
+    const size_t size = class_bytes(c);
+    g_stats.in_use--;
+    g_stats.in_use_bytes -= size;
+
+    if (g_stats.pooled_bytes + size > CARDSTOCK_BUFFER_POOL_BYTES) {
+      heap_caps_free(buffer);
+      return;
+    }
+    FreeBuffer* f = static_cast<FreeBuffer*>(buffer);
+    f->next = g_free[c];
+    g_free[c] = f;
+    g_stats.pooled++;
+    g_stats.pooled_bytes += size;
+  }
+
+  void trim() {
+    if (!g_stats.pooled) return;
+    for (int c = 0; c < kClasses; c++) {
+      while (FreeBuffer* f = g_free[c]) {
+        g_free[c] = f->next;
+        heap_caps_free(f);
+      }
+    }
+    g_stats.pooled = 0;
+    g_stats.pooled_bytes = 0;
+    g_stats.trims++;
+  }
+
+  const Stats& stats() {
+    return g_stats;
+  }
+
+}  // namespace BufferService
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Pool of sprite pixel buffers.
+//
+// Buffers come in size classes a quarter of a power of two apart (1, 1.25,
+// 1.5, 1.75 x 2^n bytes), so a request wastes at most 25%. Released buffers
+// go back on their class's free list instead of to the heap, up to
+// CARDSTOCK_BUFFER_POOL_BYTES in total, and an acquire of the same class
+// takes one from there; apps that create and free sprites every frame stop
+// allocating once the pool has warmed up. An acquire the heap can't satisfy
+// frees the pool and tries again, so idle buffers never cause an OOM.
+namespace BufferService {
+
+// A buffer of at least `bytes` (DMA-capable internal RAM, like M5GFX's own
+// sprite buffers), or nullptr when out of memory. Its contents are undefined.
+void* acquire(size_t bytes);
+
+// Returns a buffer from acquire(); `bytes` is the size asked for there.
+void release(void* buffer, size_t bytes);
+
+// Frees every pooled buffer.
+void trim();
+
+struct Stats {
+  uint32_t acquires = 0;
+  uint32_t hits = 0;             // acquires served from the pool
+  uint32_t failures = 0;         // acquires that returned nullptr
+  uint32_t trims = 0;            // pool flushes (explicit or to retry an acquire)
+  uint32_t in_use = 0;           // buffers handed out
+  uint32_t in_use_bytes = 0;     // size-class bytes handed out
+  uint32_t pooled = 0;           // buffers waiting for reuse
+  uint32_t pooled_bytes = 0;
+  uint32_t high_water_bytes = 0; // peak of in_use_bytes + pooled_bytes
+};
+
+const Stats& stats();
+
+}  // namespace BufferService
@@ -0,0 +1,146 @@
+#include "FrameService.h"
+
+// Default frame rate for tick()/draw(). Override with: -DCARDSTOCK_TARGET_FPS=30
+#ifndef CARDSTOCK_TARGET_FPS
+#define CARDSTOCK_TARGET_FPS 60
+#endif
+
+// Frame rate while the app reports nothing changed.
+#ifndef CARDSTOCK_IDLE_FPS
+#define CARDSTOCK_IDLE_FPS 20
+#endif
+
+// Most fixed-timestep ticks run in one frame before the backlog is dropped.
+#ifndef CARDSTOCK_MAX_CATCHUP_TICKS
+#define CARDSTOCK_MAX_CATCHUP_TICKS 4
+#endif
+
+namespace FrameService {
+
+namespace {
+
+uint16_t g_target_fps = CARDSTOCK_TARGET_FPS;
+uint16_t g_idle_fps = CARDSTOCK_IDLE_FPS;
+
+bool g_started = false;
+bool g_input_changed = false;
+uint32_t g_frame_start_us = 0;
+uint32_t g_accum_us = 0;
+float g_dt = 0.0f;
+Stats g_stats;
+
+uint32_t frame_period_us() {
+  const uint16_t fps = g_stats.idle ? g_idle_fps : g_target_fps;
+  return fps ? 1000000u / fps : 0;
+}
+
+}  // namespace
+
+void reset() {
+  g_started = false;
+  g_accum_us = 0;
+  g_dt = 0.0f;
+  g_stats = Stats();
+}
+
+void setTargetFps(uint16_t fps) {
+  g_target_fps = fps;
+  g_accum_us = 0;
+}
+
+uint16_t targetFps() {
+  return g_target_fps;
+}
+
+void setIdleFps(uint16_t fps) {
+  g_idle_fps = fps ? fps : 1;
+}
+
+uint16_t idleFps() {
+  return g_idle_fps;
+}
+
+uint32_t beginFrame(bool input_changed) {
+  const uint32_t now = micros();
+  if (!g_started) {
+    g_started = true;
+    g_frame_start_us = now;
+  }
+
+  const uint32_t elapsed = now - g_frame_start_us;
+  g_frame_start_us = now;
+  g_input_changed = input_changed;
+  if (input_changed) g_stats.idle = false;
+
+  g_stats.frame_us = elapsed;
+  g_stats.tick_us = 0;
+  g_stats.draw_us = 0;
+  g_stats.flush_us = 0;
+  g_stats.ticks = 0;
+  if (elapsed) {
+    const float inst = 1000000.0f / static_cast<float>(elapsed);
+    g_stats.fps = g_stats.fps > 0.0f ? g_stats.fps * 0.9f + inst * 0.1f : inst;
+  }
+
+  // Uncapped or idle: one tick with the real elapsed time.
+  if (!g_target_fps || g_stats.idle) {
+    g_accum_us = 0;
+    g_dt = static_cast<float>(elapsed) / 1000000.0f;
+    return 1;
+  }
+
+  const uint32_t step_us = 1000000u / g_target_fps;
+  g_dt = static_cast<float>(step_us) / 1000000.0f;
+  g_accum_us += elapsed;
+  uint32_t steps = g_accum_us / step_us;
+  g_accum_us -= steps * step_us;
+  if (steps > CARDSTOCK_MAX_CATCHUP_TICKS) {
+    g_stats.dropped_ticks += steps - CARDSTOCK_MAX_CATCHUP_TICKS;
+    steps = CARDSTOCK_MAX_CATCHUP_TICKS;
+  }
+  return steps;
+}
+
+float tickSeconds() {
+  return g_dt;
+}
+
+void recordTick(uint32_t us) {
+  g_stats.tick_us += us;
+  g_stats.ticks++;
+}
+
+void recordDraw(uint32_t us, bool changed) {
+  g_stats.draw_us += us;
+  g_stats.idle = !changed && !g_input_changed;
+}
+
+void recordFlush(uint32_t us) {
+  g_stats.flush_us += us;
+}
+
+void endFrame() {
+  g_stats.frames++;
+  g_stats.sleep_us = 0;
+  if (!g_started) {
+    delay(1);
+    return;
+  }
+
+  // Sleep (vTaskDelay under delay()) until the next frame deadline, rounded
+  // up to whole RTOS ticks; the fixed-timestep accumulator absorbs the jitter.
+  const uint32_t period = frame_period_us();
+  const uint32_t used = micros() - g_frame_start_us;
+  uint32_t sleep_ms = 1;
+  if (period > used) sleep_ms = (period - used + 999) / 1000;
+
+  const uint32_t t0 = micros();
+  delay(sleep_ms);
+  g_stats.sleep_us = micros() - t0;
+}
+
+const Stats& stats() {
+  return g_stats;
+}
+
+}  // namespace FrameService
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Frame pacing for the Lua main loop.
+//
+// tick(dt) runs on a fixed timestep of 1/targetFps seconds; if a frame runs
+// long, up to CARDSTOCK_MAX_CATCHUP_TICKS steps are run back to back and the
+// rest of the backlog is dropped (counted in droppedTicks). After draw() the
+// loop task sleeps until the next frame deadline instead of spinning.
+//
+// When draw() reports that nothing changed (returns false) and no key state
+// changed, the scheduler goes idle: frames drop to idleFps, tick(dt) runs once
+// per idle frame with the real elapsed dt, and the task sleeps in between.
+// Any key change or a draw() that returns anything but false wakes it up.
+//
+// targetFps 0 restores the old behaviour: one variable-dt tick per loop,
+// no frame cap.
+namespace FrameService {
+
+struct Stats {
+  float fps = 0.0f;            // smoothed frames per second
+  uint32_t frame_us = 0;       // last frame: start-to-start time
+  uint32_t tick_us = 0;        // last frame: time spent in tick() calls
+  uint32_t draw_us = 0;        // last frame: time spent in draw()
+  uint32_t flush_us = 0;       // last frame: time spent handing the frame to the panel
+  uint32_t sleep_us = 0;       // last frame: time slept before the next frame
+  uint32_t ticks = 0;          // last frame: tick() calls made
+  uint32_t dropped_ticks = 0;  // total fixed steps dropped by catch-up limiting
+  uint32_t frames = 0;         // frames since the app was loaded
+  bool idle = false;
+};
+
+// Restart the timeline (call when a new app is loaded).
+void reset();
+
+void setTargetFps(uint16_t fps);
+uint16_t targetFps();
+void setIdleFps(uint16_t fps);
+uint16_t idleFps();
+
+// Starts a frame and returns how many tick() calls are due now. Each call
+// should be passed tickSeconds() as dt.
+uint32_t beginFrame(bool input_changed);
+float tickSeconds();
+
+// Timing hooks for the host loop.
+void recordTick(uint32_t us);
+void recordDraw(uint32_t us, bool changed);
+void recordFlush(uint32_t us);
+
+// Records frame stats and sleeps until the next frame deadline.
+void endFrame();
+
+const Stats& stats();
+
+}  // namespace FrameService
@@ -1,52 +1,1062 @@
 #include "GfxService.h"
 
-#include "M5Cardputer.h"
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "TextService.h"
+
+// Byte budget of the text-run cache (0 disables it).
+// Override with: -DCARDSTOCK_TEXT_CACHE_BYTES=...
+#ifndef CARDSTOCK_TEXT_CACHE_BYTES
+#define CARDSTOCK_TEXT_CACHE_BYTES (16 * 1024)
+#endif
+
+// Threaded render mode (render task + command ring). Disable with:
+// -DCARDSTOCK_RENDER_TASK=0
+#ifndef CARDSTOCK_RENDER_TASK
+#define CARDSTOCK_RENDER_TASK 1
+#endif
+
+// Command ring size in bytes; a power of two.
+// Override with: -DCARDSTOCK_RENDER_RING_BYTES=...
+#ifndef CARDSTOCK_RENDER_RING_BYTES
+#define CARDSTOCK_RENDER_RING_BYTES (16 * 1024)
+#endif
+
+// Core, stack bytes and priority of the render task. The Arduino loop task
+// runs on core 1.
+#ifndef CARDSTOCK_RENDER_CORE
+#define CARDSTOCK_RENDER_CORE 0
+#endif
+#ifndef CARDSTOCK_RENDER_STACK
+#define CARDSTOCK_RENDER_STACK (8 * 1024)
+#endif
+#ifndef CARDSTOCK_RENDER_PRIORITY
+#define CARDSTOCK_RENDER_PRIORITY 2
+#endif
 
 namespace GfxService {
 
+namespace {
+
+// -------------------------------
+// Dirty-region tracking
+// -------------------------------
+
+// Rectangles kept before the cheapest pair is forced to merge.
+static const int kMaxDirty = 16;
+// Pixels two rectangles may waste when merged into their bounding box.
+static const int32_t kMergeSlack = 256;
+
+static Rect g_dirty[kMaxDirty];
+static int g_dirty_count = 0;
+static uint32_t g_frame_direct_bytes = 0;  // bytes sent straight to the panel this frame
+
+static M5Canvas* g_fb = nullptr;     // buffer gfx calls draw into
+static M5Canvas* g_front = nullptr;  // double-buffered: buffer last handed to DMA
+static bool g_flush_pending = false; // DMA transfer in flight (bus held by startWrite)
+static uint32_t g_frame_wait_us = 0;
+static DamageStats g_stats;
+static CompositeStats g_composite_stats;
+
+static inline int32_t area(const Rect& r) {
+  return r.w * r.h;
+}
+
+static Rect unite(const Rect& a, const Rect& b) {
+  const int32_t x0 = std::min(a.x, b.x);
+  const int32_t y0 = std::min(a.y, b.y);
+  const int32_t x1 = std::max(a.x + a.w, b.x + b.w);
+  const int32_t y1 = std::max(a.y + a.h, b.y + b.h);
+  return Rect{x0, y0, x1 - x0, y1 - y0};
+}
+
+static int32_t overlap(const Rect& a, const Rect& b) {
+  const int32_t w = std::min(a.x + a.w, b.x + b.w) - std::max(a.x, b.x);
+  const int32_t h = std::min(a.y + a.h, b.y + b.h) - std::max(a.y, b.y);
+  return (w > 0 && h > 0) ? w * h : 0;
+}
+
+// Pixels the bounding box of a and b covers that neither of them does.
+static int32_t merge_waste(const Rect& a, const Rect& b) {
+  return area(unite(a, b)) - area(a) - area(b) + overlap(a, b);
+}
+
+static bool clip_to(Rect& r, int32_t sw, int32_t sh) {
+  if (r.w < 0) { r.x += r.w; r.w = -r.w; }
+  if (r.h < 0) { r.y += r.h; r.h = -r.h; }
+  const int32_t x0 = std::max<int32_t>(r.x, 0);
+  const int32_t y0 = std::max<int32_t>(r.y, 0);
+  const int32_t x1 = std::min<int32_t>(r.x + r.w, sw);
+  const int32_t y1 = std::min<int32_t>(r.y + r.h, sh);
+  if (x1 <= x0 || y1 <= y0) return false;
+  r = Rect{x0, y0, x1 - x0, y1 - y0};
+  return true;
+}
+
+static bool clip_to_screen(Rect& r) {
+  return clip_to(r, M5Cardputer.Display.width(), M5Cardputer.Display.height());
+}
+
+// Adds `r` to a list of at most kMaxDirty rectangles. Overlapping rectangles
+// are always merged, so every pixel in the list is covered exactly once.
+static void add_rect(Rect* rects, int& count, Rect r) {
+  for (;;) {
+    int hit = -1;
+    for (int i = 0; i < count; i++) {
+      if (overlap(rects[i], r) > 0 || merge_waste(rects[i], r) <= kMergeSlack) {
+        hit = i;
+        break;
+      }
+    }
+    if (hit < 0 && count < kMaxDirty) {
+      rects[count++] = r;
+      return;
+    }
+    if (hit < 0) {
+      // Full: fold into whichever rectangle grows the least.
+      hit = 0;
+      for (int i = 1; i < count; i++) {
+        if (merge_waste(rects[i], r) < merge_waste(rects[hit], r)) hit = i;
+      }
+    }
+    r = unite(rects[hit], r);
+    rects[hit] = rects[--count];
+  }
+}
+
+static void add_dirty(const Rect& r) {
+  add_rect(g_dirty, g_dirty_count, r);
+}
+
+// Height of a built-in numbered font (GLCD/TFT_eSPI numbering), for damage
+// bounds of drawString(..., font) calls.
+static int32_t numbered_font_height(int32_t font) {
+  switch (font) {
+    case 2: return 16;
+    case 4: return 26;
+    case 6:
+    case 7: return 48;
+    case 8: return 75;
+    default: return 8;
+  }
+}
+
+static void damage_text(int32_t x, int32_t y, int32_t w, int32_t font) {
+  LovyanGFX* t = target();
+  const int32_t h = font < 0 ? t->fontHeight()
+                             : static_cast<int32_t>(numbered_font_height(font) * t->getTextStyle().size_y);
+  damage(x, y, w, h);
+}
+
+// True when fill rect `b` sits flush against `a` so that both form one rectangle.
+static bool tiles_with(const Rect& a, const DrawOp& b) {
+  if (b.x == a.x && b.w == a.w) return b.y == a.y + a.h || b.y + b.h == a.y;
+  if (b.y == a.y && b.h == a.h) return b.x == a.x + a.w || b.x + b.w == a.x;
+  return false;
+}
+
+static bool is_rgb565(M5Canvas* c) {
+  return c && c->getBuffer() && c->getColorDepth() == lgfx::rgb565_2Byte;
+}
+
+// Copies the `src` pixels of tile rect (sx, sy) onto `dst` at r (already clipped).
+static void copy_rect565(M5Canvas* src, int32_t sx, int32_t sy, M5Canvas* dst, const Rect& r) {
+  const uint16_t* from = static_cast<const uint16_t*>(src->getBuffer()) + sy * src->width() + sx;
+  uint16_t* to = static_cast<uint16_t*>(dst->getBuffer()) + r.y * dst->width() + r.x;
+  const size_t row_bytes = static_cast<size_t>(r.w) * sizeof(uint16_t);
+  for (int32_t row = 0; row < r.h; row++) {
+    memcpy(to, from, row_bytes);
+    from += src->width();
+    to += dst->width();
+  }
+}
+
+// Like copy_rect565, skipping source pixels equal to `key` (buffer byte order).
+static void copy_rect565_keyed(M5Canvas* src, int32_t sx, int32_t sy, M5Canvas* dst, const Rect& r, uint16_t key) {
+  const uint16_t* from = static_cast<const uint16_t*>(src->getBuffer()) + sy * src->width() + sx;
+  uint16_t* to = static_cast<uint16_t*>(dst->getBuffer()) + r.y * dst->width() + r.x;
+  for (int32_t row = 0; row < r.h; row++) {
+    for (int32_t i = 0; i < r.w; i++) {
+      const uint16_t px = from[i];
+      if (px != key) to[i] = px;
+    }
+    from += src->width();
+    to += dst->width();
+  }
+}
+
+static bool is_palette(M5Canvas* c) {
+  return c && c->getBuffer() && c->getPalette() && (c->getColorDepth() & lgfx::has_palette) &&
+         (c->getColorDepth() & lgfx::bit_mask) <= 8;
+}
+
+// Fills lut[0 .. 2^bits - 1] with the palette of `src` as RGB565 in buffer
+// byte order; indices past the palette map to entry 0.
+static void palette_lut(M5Canvas* src, uint16_t* lut) {
+  const uint32_t bits = src->getColorDepth() & lgfx::bit_mask;
+  const lgfx::bgr888_t* pal = src->getPalette();
+  const uint32_t count = std::min<uint32_t>(src->getPaletteCount(), 1u << bits);
+  for (uint32_t i = 0; i < (1u << bits); i++) {
+    const lgfx::bgr888_t c = pal[i < count ? i : 0];
+    const uint16_t v = static_cast<uint16_t>(((c.r & 0xF8) << 8) | ((c.g & 0xFC) << 3) | (c.b >> 3));
+    lut[i] = static_cast<uint16_t>((v >> 8) | (v << 8));
+  }
+}
+
+// Expands the palette-indexed `src` pixels at (sx, sy) onto the 16-bit `dst`
+// at r (already clipped). Rows are packed MSB-first, padded to whole bytes.
+// Indices equal to `key` are skipped when it is >= 0.
+static void copy_rect_palette(M5Canvas* src, int32_t sx, int32_t sy, M5Canvas* dst, const Rect& r, int32_t key) {
+  const uint32_t bits = src->getColorDepth() & lgfx::bit_mask;
+  const uint32_t mask = (1u << bits) - 1;
+  const size_t stride = (static_cast<size_t>(src->width()) * bits + 7) / 8;
+
+  // Palette in buffer byte order, looked up once per blit.
+  uint16_t lut[256];
+  palette_lut(src, lut);
+
+  const uint8_t* from = static_cast<const uint8_t*>(src->getBuffer()) + sy * stride;
+  uint16_t* to = static_cast<uint16_t*>(dst->getBuffer()) + r.y * dst->width() + r.x;
+  for (int32_t row = 0; row < r.h; row++) {
+    for (int32_t i = 0; i < r.w; i++) {
+      const uint32_t bit = static_cast<uint32_t>(sx + i) * bits;
+      const uint32_t index = (from[bit >> 3] >> (8 - bits - (bit & 7))) & mask;
+      if (static_cast<int32_t>(index) != key) to[i] = lut[index];
+    }
+    from += stride;
+    to += dst->width();
+  }
+}
+
+// Sprite buffers hold RGB565 big-endian, as sent to the panel.
+static inline uint16_t to_buffer565(uint16_t c) {
+  return static_cast<uint16_t>((c >> 8) | (c << 8));
+}
+
+// -------------------------------
+// Layer compositor
+// -------------------------------
+
+// Pixels per strip when composed rows are pushed to a surface that isn't a
+// 16-bit canvas (the panel, or a sprite of another depth).
+static const int32_t kCompositeStripPixels = 1024;
+
+// A visible layer, prepared for composition.
+struct CompositeSource {
+  M5Canvas* canvas;
+  Rect r;              // in target coordinates
+  int32_t key;         // -1 = opaque; else buffer-order RGB565 or palette index
+  const uint16_t* lut; // palette layers
+};
+
+// Composes target row `y`, columns [x, x + w), of `sources` (bottom first)
+// over `background` into `out`, in buffer byte order. Returns the layer spans
+// copied.
+static uint32_t compose_row(const std::vector<CompositeSource>& sources, int32_t x, int32_t y, int32_t w,
+                            uint16_t background, uint16_t* out) {
+  std::fill(out, out + w, background);
+  uint32_t spans = 0;
+  for (const CompositeSource& src : sources) {
+    if (y < src.r.y || y >= src.r.y + src.r.h) continue;
+    const int32_t x0 = std::max(x, src.r.x);
+    const int32_t x1 = std::min(x + w, src.r.x + src.r.w);
+    if (x1 <= x0) continue;
+    const int32_t sx = x0 - src.r.x;
+    const int32_t sy = y - src.r.y;
+    const int32_t n = x1 - x0;
+    uint16_t* to = out + (x0 - x);
+    M5Canvas* c = src.canvas;
+
+    if (src.lut) {
+      const uint32_t bits = c->getColorDepth() & lgfx::bit_mask;
+      const uint32_t mask = (1u << bits) - 1;
+      const uint8_t* from =
+          static_cast<const uint8_t*>(c->getBuffer()) + sy * ((static_cast<size_t>(c->width()) * bits + 7) / 8);
+      for (int32_t i = 0; i < n; i++) {
+        const uint32_t bit = static_cast<uint32_t>(sx + i) * bits;
+        const uint32_t index = (from[bit >> 3] >> (8 - bits - (bit & 7))) & mask;
+        if (static_cast<int32_t>(index) != src.key) to[i] = src.lut[index];
+      }
+    } else if (is_rgb565(c)) {
+      const uint16_t* from = static_cast<const uint16_t*>(c->getBuffer()) + sy * c->width() + sx;
+      if (src.key < 0) {
+        memcpy(to, from, static_cast<size_t>(n) * sizeof(uint16_t));
+      } else {
+        for (int32_t i = 0; i < n; i++) {
+          if (from[i] != src.key) to[i] = from[i];
+        }
+      }
+    } else {
+      // Any other format: one readPixel (RGB565) per pixel.
+      for (int32_t i = 0; i < n; i++) {
+        const uint16_t px = c->readPixel(sx + i, sy);
+        if (src.key < 0 || px != src.key) to[i] = to_buffer565(px);
+      }
+    }
+    spans++;
+  }
+  return spans;
+}
+
+// -------------------------------
+// Text-run cache
+// -------------------------------
+
+struct TextRun {
+  uint32_t hash = 0;
+  String text;
+  const lgfx::IFont* font = nullptr;  // current font, when font_num < 0
+  int16_t font_num = -1;
+  float size_x = 1.0f, size_y = 1.0f;
+  uint32_t fore = 0, back = 0;        // rgb888, as in the text style
+  uint16_t w = 0, h = 0;
+  bool mask = false;                  // 1-bpp (transparent) vs RGB565 (opaque)
+  std::vector<uint8_t> pixels;
+  uint32_t last_use = 0;
+};
+
+// Runs drawn once so far: only their hash, byte length and width, in a fixed
+// ring. A run is cached on its second sighting, so strings that change every
+// frame (counters, clocks) neither allocate nor evict cached runs. The length
+// is part of the key so a hash collision between strings of different lengths
+// can't hand one the other's width.
+struct SeenRun {
+  uint32_t hash = 0;
+  uint32_t len = 0;
+  uint16_t w = 0;
+};
+
+static const uint32_t kTextCacheBudget = CARDSTOCK_TEXT_CACHE_BYTES;
+static std::vector<TextRun> g_runs;
+static uint32_t g_run_clock = 0;
+static const size_t kSeenRuns = 32;
+static SeenRun g_seen[kSeenRuns];
+static size_t g_seen_next = 0;
+static TextCacheStats g_text_stats;
+
+static uint32_t run_bytes(const TextRun& r) {
+  return static_cast<uint32_t>(sizeof(TextRun) + r.text.length() + r.pixels.size());
+}
+
+static uint32_t run_hash(const char* s, const lgfx::IFont* font, int32_t font_num, const lgfx::TextStyle& st) {
+  // FNV-1a over the string, then the style fields.
+  uint32_t h = 2166136261u;
+  for (const char* p = s; *p; p++) h = (h ^ static_cast<uint8_t>(*p)) * 16777619u;
+  const uint32_t fields[] = {static_cast<uint32_t>(reinterpret_cast<uintptr_t>(font)),
+                             static_cast<uint32_t>(font_num), st.fore_rgb888, st.back_rgb888,
+                             static_cast<uint32_t>(st.size_x * 16), static_cast<uint32_t>(st.size_y * 16)};
+  for (uint32_t f : fields) h = (h ^ f) * 16777619u;
+  return h;
+}
+
+static void evict_runs(uint32_t need) {
+  while (!g_runs.empty() && g_text_stats.bytes + need > kTextCacheBudget) {
+    size_t oldest = 0;
+    for (size_t i = 1; i < g_runs.size(); i++) {
+      if (g_runs[i].last_use < g_runs[oldest].last_use) oldest = i;
+    }
+    g_text_stats.bytes -= run_bytes(g_runs[oldest]);
+    g_runs[oldest] = std::move(g_runs.back());
+    g_runs.pop_back();
+    g_text_stats.evictions++;
+  }
+  g_text_stats.entries = static_cast<uint32_t>(g_runs.size());
+}
+
+static uint16_t rgb888_to_buffer565(uint32_t c) {
+  const uint16_t v = static_cast<uint16_t>(((c >> 8) & 0xF800) | ((c >> 5) & 0x07E0) | ((c >> 3) & 0x001F));
+  return to_buffer565(v);
+}
+
+// Renders `run` into its pixel buffer using the text state of `t`.
+static bool rasterize_run(TextRun& run, LovyanGFX* t) {
+  M5Canvas scratch(&M5Cardputer.Display);
+  scratch.setColorDepth(16);
+  if (!scratch.createSprite(run.w, run.h)) return false;
+  scratch.setFont(t->getFont());
+  scratch.setTextStyle(t->getTextStyle());
+  if (run.mask) {
+    scratch.fillSprite(0x0000);
+    scratch.setTextColor(0xFFFF);
+  } else {
+    scratch.fillSprite(run.back);  // uint32_t: rgb888, like the style
+  }
+  if (run.font_num < 0) {
+    scratch.drawString(run.text.c_str(), 0, 0);
+  } else {
+    scratch.drawString(run.text.c_str(), 0, 0, static_cast<uint8_t>(run.font_num));
+  }
+
+  const uint16_t* src = static_cast<const uint16_t*>(scratch.getBuffer());
+  const size_t count = static_cast<size_t>(run.w) * run.h;
+  if (run.mask) {
+    // Rows padded to whole bytes, MSB = leftmost pixel.
+    const size_t stride = (run.w + 7u) / 8u;
+    run.pixels.assign(stride * run.h, 0);
+    for (int32_t y = 0; y < run.h; y++) {
+      for (int32_t x = 0; x < run.w; x++) {
+        if (src[y * run.w + x]) run.pixels[y * stride + x / 8] |= static_cast<uint8_t>(0x80 >> (x & 7));
+      }
+    }
+  } else {
+    run.pixels.resize(count * 2);
+    memcpy(run.pixels.data(), src, count * 2);
+  }
+  scratch.deleteSprite();
+  return true;
+}
+
+// Copies a cached run onto `t` at (x, y). `fast` is the 16-bit canvas behind
+// `t` when there is one. Returns false if the run can't be drawn on `t`.
+static bool blit_run(const TextRun& run, LovyanGFX* t, M5Canvas* fast, int32_t x, int32_t y) {
+  if (!run.mask) {
+    // pushImage clips and converts for any target, including the panel.
+    t->pushImage(x, y, run.w, run.h, reinterpret_cast<const lgfx::swap565_t*>(run.pixels.data()));
+    return true;
+  }
+  if (!fast) return false;
+
+  Rect r{x, y, run.w, run.h};
+  if (!clip_to(r, fast->width(), fast->height())) return true;
+  const uint16_t fg = rgb888_to_buffer565(run.fore);
+  const size_t stride = (run.w + 7u) / 8u;
+  uint16_t* dst = static_cast<uint16_t*>(fast->getBuffer());
+  for (int32_t py = r.y; py < r.y + r.h; py++) {
+    const uint8_t* bits = run.pixels.data() + (py - y) * stride;
+    uint16_t* row = dst + py * fast->width();
+    for (int32_t px = r.x; px < r.x + r.w; px++) {
+      const int32_t bx = px - x;
+      if (bits[bx >> 3] & (0x80 >> (bx & 7))) row[px] = fg;
+    }
+  }
+  return true;
+}
+
+// Width the run with `hash` and `len` had when first drawn, or 0 if it hasn't been.
+static uint16_t seen_width(uint32_t hash, size_t len) {
+  for (const SeenRun& r : g_seen) {
+    if (r.w && r.hash == hash && r.len == len) return r.w;
+  }
+  return 0;
+}
+
+static void remember_seen(uint32_t hash, size_t len, int32_t w) {
+  g_seen[g_seen_next].hash = hash;
+  g_seen[g_seen_next].len = static_cast<uint32_t>(len);
+  g_seen[g_seen_next].w = static_cast<uint16_t>(w);
+  g_seen_next = (g_seen_next + 1) % kSeenRuns;
+}
+
+// drawString through the text-run cache. `dst` is the sprite `t` is, or
+// nullptr for the screen; `fast` is the 16-bit canvas behind `t`, if any.
+static int32_t draw_text(LovyanGFX* t, M5Canvas* dst, M5Canvas* fast, const char* s, int32_t x, int32_t y,
+                         int32_t font) {
+  const lgfx::TextStyle& st = t->getTextStyle();
+  // Cached runs assume top-left datum, and opaque ones hold RGB565 that an
+  // indexed sprite would get in the wrong colours.
+  if (!kTextCacheBudget || !*s || t->getTextDatum() != 0 || (dst && !is_rgb565(dst))) {
+    g_text_stats.bypasses++;
+    return font < 0 ? t->drawString(s, x, y) : t->drawString(s, x, y, font);
+  }
+
+  const lgfx::IFont* f = font < 0 ? t->getFont() : nullptr;
+  const uint32_t hash = run_hash(s, f, font, st);
+  TextRun* run = nullptr;
+  for (TextRun& r : g_runs) {
+    if (r.hash == hash && r.font == f && r.font_num == font && r.fore == st.fore_rgb888 &&
+        r.back == st.back_rgb888 && r.size_x == st.size_x && r.size_y == st.size_y && r.text == s) {
+      run = &r;
+      break;
+    }
+  }
+
+  const size_t len = strlen(s);
+  const uint16_t seen_w = run ? 0 : seen_width(hash, len);
+  if (seen_w) {
+    // Second sighting: worth rasterizing, unless it's a mask with nowhere to composite it.
+    TextRun fresh;
+    fresh.hash = hash;
+    fresh.font = f;
+    fresh.font_num = static_cast<int16_t>(font);
+    fresh.size_x = st.size_x;
+    fresh.size_y = st.size_y;
+    fresh.fore = st.fore_rgb888;
+    fresh.back = st.back_rgb888;
+    fresh.mask = st.fore_rgb888 == st.back_rgb888;
+    fresh.w = seen_w;
+    fresh.h = static_cast<uint16_t>(font < 0 ? t->fontHeight() : numbered_font_height(font) * st.size_y);
+    const size_t px = static_cast<size_t>(fresh.w) * fresh.h;
+    const uint32_t need = static_cast<uint32_t>(fresh.mask ? (fresh.w + 7u) / 8u * fresh.h : px * 2);
+    if (need <= kTextCacheBudget / 4 && (fast || !fresh.mask)) {
+      fresh.text = s;
+      evict_runs(run_bytes(fresh) + need);
+      if (rasterize_run(fresh, t)) {
+        g_text_stats.bytes += run_bytes(fresh);
+        g_runs.push_back(std::move(fresh));
+        run = &g_runs.back();
+        g_text_stats.entries = static_cast<uint32_t>(g_runs.size());
+      }
+    }
+  }
+
+  if (run) {
+    run->last_use = ++g_run_clock;
+    if (blit_run(*run, t, fast, x, y)) {
+      g_text_stats.hits++;
+      return run->w;
+    }
+  }
+
+  g_text_stats.misses++;
+  const int32_t w = font < 0 ? t->drawString(s, x, y) : t->drawString(s, x, y, font);
+  if (!run && !seen_w && w > 0 && w <= UINT16_MAX) remember_seen(hash, len, w);
+  return w;
+}
+
+static Rect polygon_bounds(const int32_t* xy, size_t points) {
+  int32_t x0 = xy[0], y0 = xy[1], x1 = xy[0], y1 = xy[1];
+  for (size_t i = 1; i < points; i++) {
+    x0 = std::min(x0, xy[i * 2]);
+    x1 = std::max(x1, xy[i * 2]);
+    y0 = std::min(y0, xy[i * 2 + 1]);
+    y1 = std::max(y1, xy[i * 2 + 1]);
+  }
+  return Rect{x0, y0, x1 - x0 + 1, y1 - y0 + 1};
+}
+
+static void wait_flush() {
+  if (!g_flush_pending) return;
+  const uint32_t t0 = micros();
+  M5GFX& d = M5Cardputer.Display;
+  d.waitDMA();
+  d.endWrite();
+  g_flush_pending = false;
+  g_frame_wait_us += micros() - t0;
+}
+
+// Queues DMA pushes of every damaged rectangle of `fb` and returns with the
+// bus still held; wait_flush() completes the transaction.
+static void start_flush(M5Canvas* fb) {
+  M5GFX& d = M5Cardputer.Display;
+  const auto* pixels = static_cast<const lgfx::swap565_t*>(fb->getBuffer());
+  d.startWrite();
+  for (int i = 0; i < g_dirty_count; i++) {
+    const Rect& r = g_dirty[i];
+    // The panel clips the push to the damaged rectangle, so only it goes over SPI.
+    d.setClipRect(r.x, r.y, r.w, r.h);
+    d.pushImageDMA(0, 0, fb->width(), fb->height(), pixels);
+  }
+  d.clearClipRect();
+  g_flush_pending = true;
+}
+
+// Double-buffered: bring `dst` up to date with the regions just flushed from `src`.
+static void copy_damage(M5Canvas* src, M5Canvas* dst) {
+  const uint16_t* from = static_cast<const uint16_t*>(src->getBuffer());
+  uint16_t* to = static_cast<uint16_t*>(dst->getBuffer());
+  const int32_t stride = src->width();
+  for (int i = 0; i < g_dirty_count; i++) {
+    const Rect& r = g_dirty[i];
+    for (int32_t y = r.y; y < r.y + r.h; y++) {
+      memcpy(to + y * stride + r.x, from + y * stride + r.x, static_cast<size_t>(r.w) * sizeof(uint16_t));
+    }
+  }
+}
+
+static void copy_text_state(LovyanGFX* from, LovyanGFX* to) {
+  to->setFont(from->getFont());
+  to->setTextStyle(from->getTextStyle());
+  to->setCursor(from->getCursorX(), from->getCursorY());
+  int32_t x, y, w, h;
+  from->getScrollRect(&x, &y, &w, &h);
+  to->setScrollRect(x, y, w, h);
+}
+
+static M5Canvas* new_screen_buffer() {
+  M5GFX& d = M5Cardputer.Display;
+  M5Canvas* fb = new (std::nothrow) M5Canvas(&d);
+  if (!fb) return nullptr;
+  fb->setColorDepth(16);
+  if (!fb->createSprite(d.width(), d.height())) {
+    delete fb;
+    return nullptr;
+  }
+  // The panel can't be read back, so start from black and repaint it all.
+  fb->fillScreen(0x0000);
+  return fb;
+}
+
+static void free_screen_buffer(M5Canvas*& fb) {
+  if (!fb) return;
+  fb->deleteSprite();
+  delete fb;
+  fb = nullptr;
+}
+
+// Surface a primitive draws into: a sprite, or the screen target.
+static LovyanGFX* surface(M5Canvas* dst) {
+  return dst ? static_cast<LovyanGFX*>(dst) : target();
+}
+
+static void damage_if_screen(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h) {
+  if (!dst) damage(x, y, w, h);
+}
+
+// Moves the r region of `c` by (dx, dy) inside its buffer, leaving the
+// uncovered strips as they were. Only for whole-byte pixel formats; |dx| and
+// |dy| must be smaller than the region.
+static bool scroll_buffer(M5Canvas* c, const Rect& r, int32_t dx, int32_t dy) {
+  if (!c || !c->getBuffer()) return false;
+  const uint32_t bits = c->getColorDepth() & lgfx::bit_mask;
+  if (bits < 8 || bits % 8) return false;
+
+  const size_t bpp = bits / 8;
+  const size_t stride = static_cast<size_t>(c->width()) * bpp;
+  const int32_t w = r.w - std::abs(dx);
+  const int32_t h = r.h - std::abs(dy);
+  uint8_t* from = static_cast<uint8_t*>(c->getBuffer()) + (r.y + std::max(0, -dy)) * stride +
+                  (r.x + std::max(0, -dx)) * bpp;
+  uint8_t* to = static_cast<uint8_t*>(c->getBuffer()) + (r.y + std::max(0, dy)) * stride +
+                (r.x + std::max(0, dx)) * bpp;
+  const size_t row_bytes = static_cast<size_t>(w) * bpp;
+  // Moving down copies bottom-up so no source row is overwritten before it is read.
+  for (int32_t i = 0; i < h; i++) {
+    const size_t row = static_cast<size_t>(dy > 0 ? h - 1 - i : i) * stride;
+    memmove(to + row, from + row, row_bytes);
+  }
+  return true;
+}
+
+// -------------------------------
+// Render task
+// -------------------------------
+
+// One recorded screen call. `payload` bytes (a string or polygon points)
+// follow it in the ring; records are padded to 4 bytes.
+struct RenderCmd {
+  enum Type : uint8_t {
+    kWrap,  // rest of the ring is unused; continue at its start
+    kClear, kFillRect, kLine, kHLine, kVLine, kRect, kCircle, kFillCircle, kRoundRect, kFillRoundRect,
+    kTriangle, kFillTriangle, kPolygon, kFillPolygon, kText, kCenterText, kPrint, kPrintln,
+    kCursor, kTextSize, kTextColor, kTextStyle, kScrollRect, kClearScrollRect, kScroll,
+    kBlit, kBlitRotateZoom, kDamage, kWaitFlush, kFramebuffer, kEndFrame,
+  };
+  enum Flags : uint8_t { kHasKey = 1 << 0, kHasText = 1 << 1 };
+
+  uint8_t type = kWrap;
+  uint8_t flags = 0;
+  uint16_t payload = 0;
+  uint16_t color = 0;  // draw colour, or the colour key with kHasKey
+  int16_t font = -1;
+  int32_t a[6] = {};
+  M5Canvas* sprite = nullptr;
+};
+
+static RenderCmd make_cmd(uint8_t type, uint16_t color = 0, int32_t a0 = 0, int32_t a1 = 0, int32_t a2 = 0,
+                          int32_t a3 = 0, int32_t a4 = 0, int32_t a5 = 0) {
+  RenderCmd c;
+  c.type = type;
+  c.color = color;
+  c.a[0] = a0;
+  c.a[1] = a1;
+  c.a[2] = a2;
+  c.a[3] = a3;
+  c.a[4] = a4;
+  c.a[5] = a5;
+  return c;
+}
+
+static RenderStats g_render_stats;
+static bool g_threaded = false;
+
+// Text state as recorded, for textTarget() and drawString widths while the
+// real target is owned by the render task. Stale after target() hands out
+// the real surface.
+static M5Canvas* g_text_shadow = nullptr;
+static bool g_shadow_stale = true;
+
+#if CARDSTOCK_RENDER_TASK
+
+static const uint32_t kRingBytes = CARDSTOCK_RENDER_RING_BYTES;
+static_assert((kRingBytes & (kRingBytes - 1)) == 0, "CARDSTOCK_RENDER_RING_BYTES must be a power of two");
+
+// Head and tail count bytes since the ring was created; the Lua task only
+// writes the head, the render task only the tail (after running a command).
+static uint8_t* g_ring = nullptr;
+static std::atomic<uint32_t> g_head{0};
+static std::atomic<uint32_t> g_tail{0};
+static TaskHandle_t g_render_task = nullptr;
+static SemaphoreHandle_t g_progress = nullptr;  // given by the render task while the Lua task waits
+static std::atomic<bool> g_render_idle{true};
+static std::atomic<bool> g_waiting{false};
+static std::atomic<uint32_t> g_frames_done{0};
+static uint32_t g_frames_recorded = 0;
+static uint32_t g_frame_commands = 0;
+static uint32_t g_frame_wait_lua_us = 0;
+static uint32_t g_frame_syncs = 0;
+static uint32_t g_render_busy_us = 0;
+
+static bool on_render_task() {
+  return g_render_task && xTaskGetCurrentTaskHandle() == g_render_task;
+}
+
+static bool recording() {
+  return g_threaded && !on_render_task();
+}
+
+static uint32_t record_bytes(size_t payload) {
+  return static_cast<uint32_t>((sizeof(RenderCmd) + payload + 3) & ~static_cast<size_t>(3));
+}
+
+// Blocks the Lua task until `done()` holds, woken by the render task as it
+// finishes commands.
+template <typename Pred>
+static void wait_render(Pred done) {
+  if (done()) return;
+  const uint32_t t0 = micros();
+  g_waiting = true;
+  while (!done()) xSemaphoreTake(g_progress, pdMS_TO_TICKS(10));
+  g_waiting = false;
+  g_frame_wait_lua_us += micros() - t0;
+}
+
+static void push(const RenderCmd& c, const void* payload) {
+  const uint32_t size = record_bytes(c.payload);
+  uint32_t head = g_head.load(std::memory_order_relaxed);
+  uint32_t off = head & (kRingBytes - 1);
+  const uint32_t skip = off + size > kRingBytes ? kRingBytes - off : 0;
+  wait_render([&] { return kRingBytes - (head - g_tail.load(std::memory_order_acquire)) >= skip + size; });
+
+  if (skip) {
+    g_ring[off] = RenderCmd::kWrap;
+    head += skip;
+    off = 0;
+  }
+  memcpy(g_ring + off, &c, sizeof(c));
+  if (c.payload) memcpy(g_ring + off + sizeof(c), payload, c.payload);
+  g_head.store(head + size, std::memory_order_release);
+
+  const uint32_t queued = head + size - g_tail.load(std::memory_order_relaxed);
+  if (queued > g_render_stats.ring_peak) g_render_stats.ring_peak = queued;
+  g_frame_commands++;
+  std::atomic_thread_fence(std::memory_order_seq_cst);  // pairs with the idle check in render_task
+  if (g_render_idle) xTaskNotifyGive(g_render_task);
+}
+
+static void execute(const RenderCmd& c, const uint8_t* payload);
+
+static void render_task(void*) {
+  for (;;) {
+    const uint32_t tail = g_tail.load(std::memory_order_relaxed);
+    if (tail == g_head.load(std::memory_order_acquire)) {
+      // Announce idleness before the final check so a push can't slip past.
+      g_render_idle = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (tail == g_head.load(std::memory_order_acquire)) ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      g_render_idle = false;
+      continue;
+    }
+
+    const uint32_t off = tail & (kRingBytes - 1);
+    if (g_ring[off] == RenderCmd::kWrap) {
+      g_tail.store(tail + (kRingBytes - off), std::memory_order_release);
+      continue;
+    }
+    RenderCmd c;
+    memcpy(&c, g_ring + off, sizeof(c));
+    const uint32_t t0 = micros();
+    execute(c, g_ring + off + sizeof(c));
+    g_render_busy_us += micros() - t0;
+    if (c.type == RenderCmd::kEndFrame) {
+      g_render_stats.render_us = g_render_busy_us;
+      g_render_busy_us = 0;
+      g_render_stats.frames++;
+      g_frames_done.fetch_add(1, std::memory_order_release);
+    }
+    g_tail.store(tail + record_bytes(c.payload), std::memory_order_release);
+    if (g_waiting) xSemaphoreGive(g_progress);
+  }
+}
+
+static bool start_render_task() {
+  if (!g_ring) {
+    g_ring = static_cast<uint8_t*>(heap_caps_malloc(kRingBytes, MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL));
+    if (!g_ring) return false;
+  }
+  if (!g_progress) g_progress = xSemaphoreCreateBinary();
+  if (!g_progress) return false;
+  if (!g_render_task &&
+      xTaskCreatePinnedToCore(render_task, "render", CARDSTOCK_RENDER_STACK, nullptr, CARDSTOCK_RENDER_PRIORITY,
+                              &g_render_task, CARDSTOCK_RENDER_CORE) != pdPASS) {
+    g_render_task = nullptr;
+    return false;
+  }
+  g_render_stats.ring_bytes = kRingBytes;
+  return true;
+}
+
+#else
+
+static bool recording() {
+  return false;
+}
+
+static uint32_t record_bytes(size_t) {
+  return 0;
+}
+
+static void push(const RenderCmd&, const void*) {}
+
+#endif  // CARDSTOCK_RENDER_TASK
+
+// Records `c` for the render task when it draws on the screen (`dst` null)
+// in threaded mode and returns true. Otherwise waits for the render task to
+// go idle and returns false, and the caller draws right away.
+static bool defer(M5Canvas* dst, RenderCmd c, const void* payload = nullptr, size_t n = 0) {
+  if (dst || !recording() || record_bytes(n) > CARDSTOCK_RENDER_RING_BYTES / 4) {
+    sync();
+    return false;
+  }
+  c.payload = static_cast<uint16_t>(n);
+  push(c, payload);
+  return true;
+}
+
+// Runs `c` on the render task (threaded mode), then waits for it; returns
+// false in sync mode.
+static bool run_on_render_task(const RenderCmd& c) {
+  if (!defer(nullptr, c)) return false;
+  sync();
+  return true;
+}
+
+static LovyanGFX* text_shadow() {
+  if (!g_text_shadow) g_text_shadow = new M5Canvas(&M5Cardputer.Display);
+  if (g_shadow_stale) {
+    sync();
+    copy_text_state(g_fb ? static_cast<LovyanGFX*>(g_fb) : &M5Cardputer.Display, g_text_shadow);
+    g_shadow_stale = false;
+  }
+  return g_text_shadow;
+}
+
+// Width drawString returns for `s` in `t`'s text state. Always measured, never
+// taken from the draw, so it doesn't depend on whether the render task is on:
+// with fractional text sizes M5GFX's own result can differ by a pixel.
+static int32_t text_width(const LovyanGFX* t, const char* s, int32_t font) {
+  TextService::Font f = TextService::fontOf(t);
+  if (font >= 0) f = TextService::numberedFont(font, f.size_x, f.size_y);
+  return TextService::width(f, s, strlen(s));
+}
+
+static int32_t float_bits(float v) {
+  int32_t i;
+  memcpy(&i, &v, sizeof(i));
+  return i;
+}
+
+#if CARDSTOCK_RENDER_TASK
+
+static float bits_float(int32_t i) {
+  float v;
+  memcpy(&v, &i, sizeof(v));
+  return v;
+}
+
+// Render task side: replays a recorded call (which now draws, since
+// recording() is false here).
+static void execute(const RenderCmd& c, const uint8_t* payload) {
+  const int32_t* a = c.a;
+  const char* text = reinterpret_cast<const char*>(payload);
+  const int32_t* xy = reinterpret_cast<const int32_t*>(payload);
+  const int32_t key = (c.flags & RenderCmd::kHasKey) ? c.color : -1;
+  switch (c.type) {
+    case RenderCmd::kClear: clear(c.color); break;
+    case RenderCmd::kFillRect: fillRect(a[0], a[1], a[2], a[3], c.color); break;
+    case RenderCmd::kLine: drawLine(nullptr, a[0], a[1], a[2], a[3], c.color); break;
+    case RenderCmd::kHLine: drawFastHLine(nullptr, a[0], a[1], a[2], c.color); break;
+    case RenderCmd::kVLine: drawFastVLine(nullptr, a[0], a[1], a[2], c.color); break;
+    case RenderCmd::kRect: drawRect(nullptr, a[0], a[1], a[2], a[3], c.color); break;
+    case RenderCmd::kCircle: drawCircle(nullptr, a[0], a[1], a[2], c.color); break;
+    case RenderCmd::kFillCircle: fillCircle(nullptr, a[0], a[1], a[2], c.color); break;
+    case RenderCmd::kRoundRect: drawRoundRect(nullptr, a[0], a[1], a[2], a[3], a[4], c.color); break;
+    case RenderCmd::kFillRoundRect: fillRoundRect(nullptr, a[0], a[1], a[2], a[3], a[4], c.color); break;
+    case RenderCmd::kTriangle: drawTriangle(nullptr, a[0], a[1], a[2], a[3], a[4], a[5], c.color); break;
+    case RenderCmd::kFillTriangle: fillTriangle(nullptr, a[0], a[1], a[2], a[3], a[4], a[5], c.color); break;
+    case RenderCmd::kPolygon: drawPolygon(nullptr, xy, static_cast<size_t>(a[0]), c.color); break;
+    case RenderCmd::kFillPolygon: fillPolygon(nullptr, xy, static_cast<size_t>(a[0]), c.color); break;
+    case RenderCmd::kText: drawString(text, a[0], a[1], c.font); break;
+    case RenderCmd::kCenterText: drawCenterString(text, a[0], a[1], c.font); break;
+    case RenderCmd::kPrint: print(text); break;
+    case RenderCmd::kPrintln: println((c.flags & RenderCmd::kHasText) ? text : nullptr); break;
+    case RenderCmd::kCursor: setCursor(a[0], a[1]); break;
+    case RenderCmd::kTextSize: setTextSize(static_cast<uint8_t>(a[0])); break;
+    case RenderCmd::kTextColor: setTextColor(nullptr, c.color, a[0]); break;
+    case RenderCmd::kTextStyle: {
+      lgfx::TextStyle style;
+      memcpy(&style, payload, sizeof(style));
+      setTextStyle(nullptr, style);
+      break;
+    }
+    case RenderCmd::kScrollRect: setScrollRect(nullptr, a[0], a[1], a[2], a[3]); break;
+    case RenderCmd::kClearScrollRect: clearScrollRect(nullptr); break;
+    case RenderCmd::kScroll: scroll(nullptr, a[0], a[1], c.color); break;
+    case RenderCmd::kBlit: blit(c.sprite, a[0], a[1], a[2], a[3], nullptr, a[4], a[5], key); break;
+    case RenderCmd::kBlitRotateZoom:
+      blitRotateZoom(c.sprite, nullptr, bits_float(a[0]), bits_float(a[1]), bits_float(a[2]), bits_float(a[3]),
+                     bits_float(a[4]), key);
+      break;
+    case RenderCmd::kDamage: damage(a[0], a[1], a[2], a[3]); break;
+    case RenderCmd::kWaitFlush: waitFlush(); break;
+    case RenderCmd::kFramebuffer: setFramebuffer(static_cast<uint8_t>(a[0])); break;
+    case RenderCmd::kEndFrame: endFrame(); break;
+    default: break;
+  }
+}
+
+#endif  // CARDSTOCK_RENDER_TASK
+
+}  // namespace
+
+  LovyanGFX* target() {
+    if (recording()) {
+      // Handing out the real surface: the render task must be done with it,
+      // and whatever the caller changes isn't in the shadow text state.
+      sync();
+      if (g_fb && !g_front) run_on_render_task(make_cmd(RenderCmd::kWaitFlush));
+      g_shadow_stale = true;
+      return g_fb ? static_cast<LovyanGFX*>(g_fb) : &M5Cardputer.Display;
+    }
+    if (g_fb) {
+      // Single-buffered: the DMA is still reading this buffer.
+      if (!g_front) wait_flush();
+      return g_fb;
+    }
+    return &M5Cardputer.Display;
+  }
+
+  const LovyanGFX* textTarget() {
+    if (recording()) return text_shadow();
+    if (g_fb) return g_fb;
+    return &M5Cardputer.Display;
+  }
+
+  void damage(int32_t x, int32_t y, int32_t w, int32_t h) {
+    if (defer(nullptr, make_cmd(RenderCmd::kDamage, 0, x, y, w, h))) return;
+    Rect r{x, y, w, h};
+    if (!clip_to_screen(r)) return;
+    if (!g_fb) g_frame_direct_bytes += static_cast<uint32_t>(area(r)) * 2;
+    add_dirty(r);
+  }
+
   void clear(uint16_t color) {
-    M5Cardputer.Display.fillScreen(color);
+    if (defer(nullptr, make_cmd(RenderCmd::kClear, color))) return;
+    target()->fillScreen(color);
+    damage(0, 0, width(), height());
   }
 
   void setCursor(int32_t x, int32_t y) {
-    M5Cardputer.Display.setCursor(x, y);
+    if (defer(nullptr, make_cmd(RenderCmd::kCursor, 0, x, y))) return;
+    target()->setCursor(x, y);
   }
 
   void setTextSize(uint8_t size) {
-    M5Cardputer.Display.setTextSize(size);
+    if (recording()) text_shadow()->setTextSize(size);
+    if (defer(nullptr, make_cmd(RenderCmd::kTextSize, 0, size))) return;
+    target()->setTextSize(size);
   }
 
   void setTextColor(uint16_t fg, int32_t bg) {
+    setTextColor(nullptr, fg, bg);
+  }
+
+  void setTextColor(M5Canvas* dst, uint16_t fg, int32_t bg) {
+    if (!dst && recording()) {
+      if (bg < 0) {
+        text_shadow()->setTextColor(fg);
+      } else {
+        text_shadow()->setTextColor(fg, static_cast<uint16_t>(bg));
+      }
+    }
+    if (defer(dst, make_cmd(RenderCmd::kTextColor, fg, bg))) return;
+    LovyanGFX* t = surface(dst);
     if (bg < 0) {
-      M5Cardputer.Display.setTextColor(fg);
+      t->setTextColor(fg);
     } else {
-      M5Cardputer.Display.setTextColor(fg, static_cast<uint16_t>(bg));
+      t->setTextColor(fg, static_cast<uint16_t>(bg));
     }
   }
 
+  void setTextStyle(M5Canvas* dst, const lgfx::TextStyle& style) {
+    if (!dst && recording()) text_shadow()->setTextStyle(style);
+    if (defer(dst, make_cmd(RenderCmd::kTextStyle), &style, sizeof(style))) return;
+    surface(dst)->setTextStyle(style);
+  }
+
   void print(const char* s) {
     if (!s) return;
-    M5Cardputer.Display.print(s);
+    if (defer(nullptr, make_cmd(RenderCmd::kPrint), s, strlen(s) + 1)) return;
+    LovyanGFX* t = target();
+    const int32_t x0 = t->getCursorX();
+    const int32_t y0 = t->getCursorY();
+    t->print(s);
+    if (t->getCursorY() == y0) {
+      damage(x0, y0, t->getCursorX() - x0, t->fontHeight());
+    } else {
+      damage(0, y0, width(), t->getCursorY() - y0 + t->fontHeight());
+    }
   }
 
   void println(const char* s) {
+    RenderCmd c = make_cmd(RenderCmd::kPrintln);
+    if (s) c.flags = RenderCmd::kHasText;
+    if (defer(nullptr, c, s, s ? strlen(s) + 1 : 0)) return;
+    LovyanGFX* t = target();
+    const int32_t y0 = t->getCursorY();
     if (!s) {
-      M5Cardputer.Display.println();
+      t->println();
       return;
     }
-    M5Cardputer.Display.println(s);
+    t->println(s);
+    damage(0, y0, width(), t->getCursorY() - y0);
   }
 
   int32_t drawString(const char* s, int32_t x, int32_t y, int32_t font) {
     if (!s) return 0;
-    if (font < 0) {
-      return M5Cardputer.Display.drawString(s, x, y);
+    if (recording()) {
+      const int32_t w = text_width(text_shadow(), s, font);
+      RenderCmd c = make_cmd(RenderCmd::kText, 0, x, y);
+      c.font = static_cast<int16_t>(font);
+      if (defer(nullptr, c, s, strlen(s) + 1)) return w;
     }
-    return M5Cardputer.Display.drawString(s, x, y, font);
+    LovyanGFX* t = target();
+    const int32_t w = draw_text(t, nullptr, g_fb && t == g_fb ? g_fb : nullptr, s, x, y, font);
+    damage_text(x, y, w, font);
+    return text_width(t, s, font);
+  }
+
+  int32_t drawString(M5Canvas* dst, const char* s, int32_t x, int32_t y, int32_t font) {
+    if (!dst) return drawString(s, x, y, font);
+    if (!s) return 0;
+    sync();
+    draw_text(dst, dst, is_rgb565(dst) ? dst : nullptr, s, x, y, font);
+    return text_width(dst, s, font);
   }
 
   void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
-    M5Cardputer.Display.fillRect(x, y, w, h, color);
+    if (defer(nullptr, make_cmd(RenderCmd::kFillRect, color, x, y, w, h))) return;
+    target()->fillRect(x, y, w, h, color);
+    damage(x, y, w, h);
   }
 
   int32_t width() {
@@ -59,11 +1069,681 @@ namespace GfxService {
 
   int32_t drawCenterString(const char* s, int32_t x, int32_t y, int32_t font) {
     if (!s) return 0;
+    if (recording()) {
+      const int32_t w = text_width(text_shadow(), s, font);
+      RenderCmd c = make_cmd(RenderCmd::kCenterText, 0, x, y);
+      c.font = static_cast<int16_t>(font);
+      if (defer(nullptr, c, s, strlen(s) + 1)) return w;
+    }
+    LovyanGFX* t = target();
+    int32_t w;
     if (font < 0) {
-      return M5Cardputer.Display.drawCenterString(s, x, y);
+      w = t->drawCenterString(s, x, y);
+    } else {
+      w = t->drawCenterString(s, x, y, font);
     }
-    return M5Cardputer.Display.drawCenterString(s, x, y, font);
+    damage_text(x - w / 2 - 1, y, w + 2, font);
+    return text_width(t, s, font);
+  }
+
+  // -------------------------------
+  // Vector primitives
+  // -------------------------------
+
+  void drawLine(M5Canvas* dst, int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint16_t color) {
+    if (defer(dst, make_cmd(RenderCmd::kLine, color, x0, y0, x1, y1))) return;
+    surface(dst)->drawLine(x0, y0, x1, y1, color);
+    damage_if_screen(dst, std::min(x0, x1), std::min(y0, y1), std::abs(x1 - x0) + 1, std::abs(y1 - y0) + 1);
+  }
+
+  void drawFastHLine(M5Canvas* dst, int32_t x, int32_t y, int32_t w, uint16_t color) {
+    if (defer(dst, make_cmd(RenderCmd::kHLine, color, x, y, w))) return;
+    surface(dst)->drawFastHLine(x, y, w, color);
+    damage_if_screen(dst, x, y, w, 1);
+  }
+
+  void drawFastVLine(M5Canvas* dst, int32_t x, int32_t y, int32_t h, uint16_t color) {
+    if (defer(dst, make_cmd(RenderCmd::kVLine, color, x, y, h))) return;
+    surface(dst)->drawFastVLine(x, y, h, color);
+    damage_if_screen(dst, x, y, 1, h);
+  }
+
+  void drawRect(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+    if (defer(dst, make_cmd(RenderCmd::kRect, color, x, y, w, h))) return;
+    surface(dst)->drawRect(x, y, w, h, color);
+    damage_if_screen(dst, x, y, w, h);
+  }
+
+  void fillRect(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color) {
+    if (!dst) return fillRect(x, y, w, h, color);
+    sync();
+    dst->fillRect(x, y, w, h, color);
+  }
+
+  void drawCircle(M5Canvas* dst, int32_t x, int32_t y, int32_t r, uint16_t color) {
+    if (defer(dst, make_cmd(RenderCmd::kCircle, color, x, y, r))) return;
+    surface(dst)->drawCircle(x, y, r, color);
+    damage_if_screen(dst, x - r, y - r, r * 2 + 1, r * 2 + 1);
+  }
+
+  void fillCircle(M5Canvas* dst, int32_t x, int32_t y, int32_t r, uint16_t color) {
+    if (defer(dst, make_cmd(RenderCmd::kFillCircle, color, x, y, r))) return;
+    surface(dst)->fillCircle(x, y, r, color);
+    damage_if_screen(dst, x - r, y - r, r * 2 + 1, r * 2 + 1);
+  }
+
+  void drawRoundRect(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color) {
+    if (defer(dst, make_cmd(RenderCmd::kRoundRect, color, x, y, w, h, r))) return;
+    surface(dst)->drawRoundRect(x, y, w, h, r, color);
+    damage_if_screen(dst, x, y, w, h);
   }
-}  // namespace GfxService
 
+  void fillRoundRect(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color) {
+    if (defer(dst, make_cmd(RenderCmd::kFillRoundRect, color, x, y, w, h, r))) return;
+    surface(dst)->fillRoundRect(x, y, w, h, r, color);
+    damage_if_screen(dst, x, y, w, h);
+  }
+
+  void drawTriangle(M5Canvas* dst, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2,
+                    uint16_t color) {
+    if (defer(dst, make_cmd(RenderCmd::kTriangle, color, x0, y0, x1, y1, x2, y2))) return;
+    surface(dst)->drawTriangle(x0, y0, x1, y1, x2, y2, color);
+    const int32_t bx = std::min({x0, x1, x2});
+    const int32_t by = std::min({y0, y1, y2});
+    damage_if_screen(dst, bx, by, std::max({x0, x1, x2}) - bx + 1, std::max({y0, y1, y2}) - by + 1);
+  }
+
+  void fillTriangle(M5Canvas* dst, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2,
+                    uint16_t color) {
+    if (defer(dst, make_cmd(RenderCmd::kFillTriangle, color, x0, y0, x1, y1, x2, y2))) return;
+    surface(dst)->fillTriangle(x0, y0, x1, y1, x2, y2, color);
+    const int32_t bx = std::min({x0, x1, x2});
+    const int32_t by = std::min({y0, y1, y2});
+    damage_if_screen(dst, bx, by, std::max({x0, x1, x2}) - bx + 1, std::max({y0, y1, y2}) - by + 1);
+  }
+
+  void drawPolygon(M5Canvas* dst, const int32_t* xy, size_t points, uint16_t color) {
+    if (!xy || points < 2) return;
+    if (defer(dst, make_cmd(RenderCmd::kPolygon, color, static_cast<int32_t>(points)), xy, points * 2 * sizeof(int32_t))) {
+      return;
+    }
+    LovyanGFX* t = surface(dst);
+    t->startWrite();
+    for (size_t i = 0; i < points; i++) {
+      const size_t j = (i + 1) % points;
+      t->drawLine(xy[i * 2], xy[i * 2 + 1], xy[j * 2], xy[j * 2 + 1], color);
+    }
+    t->endWrite();
+    const Rect b = polygon_bounds(xy, points);
+    damage_if_screen(dst, b.x, b.y, b.w, b.h);
+  }
+
+  void fillPolygon(M5Canvas* dst, const int32_t* xy, size_t points, uint16_t color) {
+    if (!xy || points < 3) return;
+    if (defer(dst, make_cmd(RenderCmd::kFillPolygon, color, static_cast<int32_t>(points)), xy,
+              points * 2 * sizeof(int32_t))) {
+      return;
+    }
+    LovyanGFX* t = surface(dst);
+    Rect b = polygon_bounds(xy, points);
+    if (!clip_to(b, t->width(), t->height())) return;
+
+    // Scanline fill: sample each row at its centre, collect edge crossings
+    // (top-inclusive, bottom-exclusive so shared vertices count once), sort
+    // them and fill between pairs.
+    int32_t stack_xs[32];
+    std::vector<int32_t> heap_xs;
+    int32_t* xs = stack_xs;
+    if (points > 32) {
+      heap_xs.resize(points);
+      xs = heap_xs.data();
+    }
+
+    t->startWrite();
+    for (int32_t y = b.y; y < b.y + b.h; y++) {
+      size_t n = 0;
+      for (size_t i = 0; i < points; i++) {
+        const size_t j = (i + 1) % points;
+        int32_t ax = xy[i * 2], ay = xy[i * 2 + 1];
+        int32_t bx = xy[j * 2], by = xy[j * 2 + 1];
+        if (ay == by) continue;
+        if (ay > by) {
+          std::swap(ax, bx);
+          std::swap(ay, by);
+        }
+        if (y < ay || y >= by) continue;
+        // x at row centre y + 0.5, rounded to the nearest pixel centre.
+        const int64_t num = static_cast<int64_t>(2 * (y - ay) + 1) * (bx - ax);
+        xs[n++] = ax + static_cast<int32_t>((num + (num >= 0 ? (by - ay) : -(by - ay))) / (2 * (by - ay)));
+      }
+      std::sort(xs, xs + n);
+      for (size_t k = 0; k + 1 < n; k += 2) {
+        const int32_t x0 = std::max(xs[k], b.x);
+        const int32_t x1 = std::min(xs[k + 1], b.x + b.w);
+        if (x1 > x0) t->drawFastHLine(x0, y, x1 - x0, color);
+      }
+    }
+    t->endWrite();
+    damage_if_screen(dst, b.x, b.y, b.w, b.h);
+  }
+
+  // -------------------------------
+  // Scrolling
+  // -------------------------------
 
+  void setScrollRect(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h) {
+    if (defer(dst, make_cmd(RenderCmd::kScrollRect, 0, x, y, w, h))) return;
+    LovyanGFX* t = surface(dst);
+    Rect r{x, y, w, h};
+    if (!clip_to(r, t->width(), t->height())) return;
+    t->setScrollRect(r.x, r.y, r.w, r.h);
+  }
+
+  void clearScrollRect(M5Canvas* dst) {
+    if (defer(dst, make_cmd(RenderCmd::kClearScrollRect))) return;
+    surface(dst)->clearScrollRect();
+  }
+
+  void scroll(M5Canvas* dst, int32_t dx, int32_t dy, uint16_t fill) {
+    if (!dx && !dy) return;
+    if (defer(dst, make_cmd(RenderCmd::kScroll, fill, dx, dy))) return;
+    LovyanGFX* t = surface(dst);
+    Rect r;
+    t->getScrollRect(&r.x, &r.y, &r.w, &r.h);
+    if (r.w <= 0 || r.h <= 0) return;
+
+    M5Canvas* canvas = dst ? dst : (g_fb && t == g_fb ? g_fb : nullptr);
+    if (std::abs(dx) >= r.w || std::abs(dy) >= r.h) {
+      t->fillRect(r.x, r.y, r.w, r.h, fill);
+    } else if (scroll_buffer(canvas, r, dx, dy)) {
+      t->startWrite();
+      if (dy > 0) t->fillRect(r.x, r.y, r.w, dy, fill);
+      if (dy < 0) t->fillRect(r.x, r.y + r.h + dy, r.w, -dy, fill);
+      if (dx > 0) t->fillRect(r.x, r.y, dx, r.h, fill);
+      if (dx < 0) t->fillRect(r.x + r.w + dx, r.y, -dx, r.h, fill);
+      t->endWrite();
+    } else {
+      // Panel or packed sub-byte sprite: M5GFX copies the region through
+      // readRect/pushImage and fills the uncovered strips with the base colour,
+      // which is put back afterwards (getBaseColor() is already RGB888, so it
+      // goes back in unconverted).
+      const uint32_t base = t->getBaseColor();
+      t->setBaseColor(fill);
+      t->scroll(dx, dy);
+      t->setBaseColor(base);
+    }
+    damage_if_screen(dst, r.x, r.y, r.w, r.h);
+  }
+
+  void pushSprite(M5Canvas* sprite, int32_t x, int32_t y, int32_t transparent) {
+    if (!sprite) return;
+    blit(sprite, 0, 0, sprite->width(), sprite->height(), nullptr, x, y, transparent);
+  }
+
+  void blit(M5Canvas* src, int32_t sx, int32_t sy, int32_t sw, int32_t sh, M5Canvas* dst, int32_t dx, int32_t dy,
+            int32_t transparent) {
+    if (!src || src == dst) return;
+    RenderCmd c = make_cmd(RenderCmd::kBlit, 0, sx, sy, sw, sh, dx, dy);
+    c.sprite = src;
+    if (transparent >= 0) {
+      c.flags = RenderCmd::kHasKey;
+      c.color = static_cast<uint16_t>(transparent);
+    }
+    if (defer(dst, c)) return;
+
+    // Clip the source region to the source, then the destination.
+    Rect s{sx, sy, sw, sh};
+    if (!clip_to(s, src->width(), src->height())) return;
+    dx += s.x - sx;
+    dy += s.y - sy;
+    LovyanGFX* t = dst ? static_cast<LovyanGFX*>(dst) : target();
+    Rect r{dx, dy, s.w, s.h};
+    if (!clip_to(r, t->width(), t->height())) return;
+    s.x += r.x - dx;
+    s.y += r.y - dy;
+
+    M5Canvas* fast = dst ? dst : (g_fb && t == g_fb ? g_fb : nullptr);
+    if (is_rgb565(fast) && is_rgb565(src)) {
+      if (transparent < 0) {
+        copy_rect565(src, s.x, s.y, fast, r);
+      } else {
+        copy_rect565_keyed(src, s.x, s.y, fast, r, to_buffer565(static_cast<uint16_t>(transparent)));
+      }
+    } else if (is_rgb565(fast) && is_palette(src)) {
+      copy_rect_palette(src, s.x, s.y, fast, r, transparent);
+    } else {
+      const bool whole = s.w == src->width() && s.h == src->height();
+      if (!whole) t->setClipRect(r.x, r.y, r.w, r.h);
+      if (transparent < 0) {
+        src->pushSprite(t, r.x - s.x, r.y - s.y);
+      } else {
+        src->pushSprite(t, r.x - s.x, r.y - s.y, static_cast<uint16_t>(transparent));
+      }
+      if (!whole) t->clearClipRect();
+    }
+    if (!dst) damage(r.x, r.y, r.w, r.h);
+  }
+
+  void blitRotateZoom(M5Canvas* src, M5Canvas* dst, float x, float y, float angle, float zoom_x, float zoom_y,
+                      int32_t transparent) {
+    if (!src || src == dst) return;
+    RenderCmd c = make_cmd(RenderCmd::kBlitRotateZoom, 0, float_bits(x), float_bits(y), float_bits(angle),
+                           float_bits(zoom_x), float_bits(zoom_y));
+    c.sprite = src;
+    if (transparent >= 0) {
+      c.flags = RenderCmd::kHasKey;
+      c.color = static_cast<uint16_t>(transparent);
+    }
+    if (defer(dst, c)) return;
+    LovyanGFX* t = dst ? static_cast<LovyanGFX*>(dst) : target();
+    if (transparent < 0) {
+      src->pushRotateZoom(t, x, y, angle, zoom_x, zoom_y);
+    } else {
+      src->pushRotateZoom(t, x, y, angle, zoom_x, zoom_y, static_cast<uint16_t>(transparent));
+    }
+    if (!dst) {
+      // Bounding box of the rotated, scaled sprite: its diagonal is an upper bound.
+      const float hw = src->width() * std::fabs(zoom_x) * 0.5f;
+      const float hh = src->height() * std::fabs(zoom_y) * 0.5f;
+      const int32_t radius = static_cast<int32_t>(std::sqrt(hw * hw + hh * hh)) + 1;
+      damage(static_cast<int32_t>(x) - radius, static_cast<int32_t>(y) - radius, radius * 2 + 1, radius * 2 + 1);
+    }
+  }
+
+  uint32_t composite(const Layer* layers, size_t count, const Rect* rects, size_t rect_count, uint16_t background,
+                     M5Canvas* dst) {
+    sync();
+    const uint32_t t0 = micros();
+    g_composite_stats = CompositeStats{};
+    LovyanGFX* t = surface(dst);
+    M5Canvas* canvas = dst ? dst : (g_fb && t == g_fb ? g_fb : nullptr);
+    const bool in_place = is_rgb565(canvas);
+
+    // Regions to rebuild, merged until none overlap.
+    Rect regions[kMaxDirty];
+    int region_count = 0;
+    for (size_t i = 0; i < rect_count; i++) {
+      Rect r = rects[i];
+      if (clip_to(r, t->width(), t->height())) add_rect(regions, region_count, r);
+    }
+    if (!region_count) return 0;
+
+    // Visible layers that touch any region, with palettes expanded once.
+    std::vector<CompositeSource> sources;
+    std::vector<uint16_t> luts;
+    sources.reserve(count);
+    size_t palettes = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (layers[i].visible && is_palette(layers[i].sprite)) palettes++;
+    }
+    luts.resize(palettes * 256);
+    palettes = 0;
+    for (size_t i = 0; i < count; i++) {
+      const Layer& l = layers[i];
+      if (!l.visible || !l.sprite || !l.sprite->getBuffer() || l.sprite == canvas) continue;
+      CompositeSource src{l.sprite, Rect{l.x, l.y, l.sprite->width(), l.sprite->height()}, l.transparent, nullptr};
+      bool touches = false;
+      for (int k = 0; k < region_count && !touches; k++) touches = overlap(src.r, regions[k]) > 0;
+      if (!touches) continue;
+      if (is_palette(l.sprite)) {
+        uint16_t* lut = luts.data() + palettes++ * 256;
+        palette_lut(l.sprite, lut);
+        src.lut = lut;
+      } else if (is_rgb565(l.sprite) && src.key >= 0) {
+        src.key = to_buffer565(static_cast<uint16_t>(src.key));
+      }
+      sources.push_back(src);
+    }
+
+    const uint16_t bg = to_buffer565(background);
+    std::vector<uint16_t> strip;
+    uint32_t pixels = 0;
+    t->startWrite();
+    for (int k = 0; k < region_count; k++) {
+      const Rect& r = regions[k];
+      if (in_place) {
+        uint16_t* base = static_cast<uint16_t*>(canvas->getBuffer());
+        for (int32_t y = r.y; y < r.y + r.h; y++) {
+          g_composite_stats.spans += compose_row(sources, r.x, y, r.w, bg, base + y * canvas->width() + r.x);
+        }
+      } else {
+        // Compose a strip of rows, then push it in one transfer.
+        const int32_t rows = std::max<int32_t>(1, kCompositeStripPixels / r.w);
+        strip.resize(static_cast<size_t>(rows) * r.w);
+        for (int32_t y = r.y; y < r.y + r.h; y += rows) {
+          const int32_t n = std::min(rows, r.y + r.h - y);
+          for (int32_t i = 0; i < n; i++) {
+            g_composite_stats.spans += compose_row(sources, r.x, y + i, r.w, bg, strip.data() + i * r.w);
+          }
+          t->pushImage(r.x, y, r.w, n, reinterpret_cast<const lgfx::swap565_t*>(strip.data()));
+        }
+      }
+      damage_if_screen(dst, r.x, r.y, r.w, r.h);
+      pixels += static_cast<uint32_t>(area(r));
+    }
+    t->endWrite();
+
+    g_composite_stats.rects = static_cast<uint32_t>(region_count);
+    g_composite_stats.layers = static_cast<uint32_t>(sources.size());
+    g_composite_stats.pixels = pixels;
+    g_composite_stats.bytes = dst ? 0 : pixels * 2;
+    g_composite_stats.us = micros() - t0;
+    return pixels;
+  }
+
+  const CompositeStats& compositeStats() {
+    sync();
+    return g_composite_stats;
+  }
+
+  uint32_t drawBatch(const DrawOp* ops, size_t count, const char* text, M5Canvas* const* sprites,
+                     M5Canvas* dst) {
+    if (!ops || !count) return 0;
+    sync();
+    LovyanGFX* t = dst ? static_cast<LovyanGFX*>(dst) : target();
+    const bool screen = !dst;
+    M5Canvas* fast = dst ? (is_rgb565(dst) ? dst : nullptr) : (g_fb && t == g_fb ? g_fb : nullptr);
+    const int32_t tw = t->width();
+    const int32_t th = t->height();
+
+    // Everything before the last clear gets painted over.
+    size_t first = 0;
+    for (size_t i = count; i-- > 0;) {
+      if (ops[i].type == DrawOp::kClear) {
+        first = i;
+        break;
+      }
+    }
+
+    const lgfx::TextStyle saved_style = t->getTextStyle();
+    uint32_t drawn = 0;
+    t->startWrite();
+    for (size_t i = first; i < count; i++) {
+      const DrawOp& op = ops[i];
+      switch (op.type) {
+        case DrawOp::kClear:
+          t->fillScreen(op.color);
+          if (screen) damage(0, 0, tw, th);
+          drawn++;
+          break;
+
+        case DrawOp::kFillRect: {
+          Rect r{op.x, op.y, op.w, op.h};
+          while (i + 1 < count && ops[i + 1].type == DrawOp::kFillRect && ops[i + 1].color == op.color &&
+                 tiles_with(r, ops[i + 1])) {
+            const DrawOp& next = ops[++i];
+            r = unite(r, Rect{next.x, next.y, next.w, next.h});
+          }
+          if (!clip_to(r, tw, th)) break;
+          t->fillRect(r.x, r.y, r.w, r.h, op.color);
+          if (screen) damage(r.x, r.y, r.w, r.h);
+          drawn++;
+          break;
+        }
+
+        case DrawOp::kDrawRect: {
+          Rect r{op.x, op.y, op.w, op.h};
+          if (!clip_to(r, tw, th)) break;
+          t->drawRect(op.x, op.y, op.w, op.h, op.color);
+          if (screen) damage(r.x, r.y, r.w, r.h);
+          drawn++;
+          break;
+        }
+
+        case DrawOp::kLine: {
+          Rect r{std::min(op.x, op.w), std::min(op.y, op.h), std::abs(op.w - op.x) + 1, std::abs(op.h - op.y) + 1};
+          if (!clip_to(r, tw, th)) break;
+          t->drawLine(op.x, op.y, op.w, op.h, op.color);
+          if (screen) damage(r.x, r.y, r.w, r.h);
+          drawn++;
+          break;
+        }
+
+        case DrawOp::kText: {
+          if (!text || op.y >= th || op.x >= tw) break;
+          const int32_t fh = op.font < 0 ? t->fontHeight()
+                                         : static_cast<int32_t>(numbered_font_height(op.font) *
+                                                                saved_style.size_y);
+          if (op.y + fh <= 0) break;
+          if (op.flags & DrawOp::kHasBg) {
+            t->setTextColor(op.color, op.bg);
+          } else {
+            t->setTextColor(op.color);
+          }
+          const char* s = text + op.arg;
+          const int32_t w = draw_text(t, dst, fast, s, op.x, op.y, op.font);
+          if (screen) damage(op.x, op.y, w, fh);
+          drawn++;
+          break;
+        }
+
+        case DrawOp::kBlit: {
+          M5Canvas* src = sprites ? sprites[op.arg] : nullptr;
+          if (!src || src == dst) break;
+          Rect r{op.x, op.y, src->width(), src->height()};
+          if (!clip_to(r, tw, th)) break;
+          if (op.flags & DrawOp::kTransparent) {
+            src->pushSprite(t, op.x, op.y, op.bg);
+          } else {
+            src->pushSprite(t, op.x, op.y);
+          }
+          if (screen) damage(r.x, r.y, r.w, r.h);
+          drawn++;
+          break;
+        }
+      }
+    }
+    t->endWrite();
+    t->setTextStyle(saved_style);
+    return drawn;
+  }
+
+  uint32_t drawTiles(const TileLayer& layer, int32_t x, int32_t y, int32_t w, int32_t h, M5Canvas* dst) {
+    M5Canvas* ts = layer.tileset;
+    if (!ts || layer.tile_w <= 0 || layer.tile_h <= 0 || (!layer.cells8 && !layer.cells16)) return 0;
+    const int32_t per_row = ts->width() / layer.tile_w;
+    const int32_t tile_count = per_row * (ts->height() / layer.tile_h);
+    if (tile_count <= 0) return 0;
+    sync();
+
+    LovyanGFX* t = dst ? static_cast<LovyanGFX*>(dst) : target();
+    Rect view{x, y, w, h};
+    if (!clip_to(view, t->width(), t->height())) return 0;
+
+    // A framebuffer or sprite target can take raw row copies.
+    M5Canvas* fast = dst ? dst : (g_fb && t == g_fb ? g_fb : nullptr);
+    if (!is_rgb565(fast) || !is_rgb565(ts)) fast = nullptr;
+
+    // Map pixel at the viewport's top-left, and the cell range it covers.
+    const int32_t mx0 = layer.scroll_x + (view.x - x);
+    const int32_t my0 = layer.scroll_y + (view.y - y);
+    const int32_t c0 = mx0 > 0 ? mx0 / layer.tile_w : 0;
+    const int32_t r0 = my0 > 0 ? my0 / layer.tile_h : 0;
+    const int32_t c1 = std::min(layer.cols, (mx0 + view.w + layer.tile_w - 1) / layer.tile_w);
+    const int32_t r1 = std::min(layer.rows, (my0 + view.h + layer.tile_h - 1) / layer.tile_h);
+
+    uint32_t drawn = 0;
+    if (!fast) t->startWrite();
+    for (int32_t row = r0; row < r1; row++) {
+      for (int32_t col = c0; col < c1; col++) {
+        const int32_t i = row * layer.cols + col;
+        const int32_t cell = layer.cells8 ? layer.cells8[i] : layer.cells16[i];
+        if (cell <= 0 || cell > tile_count) continue;
+
+        const int32_t tx = view.x + col * layer.tile_w - mx0;
+        const int32_t ty = view.y + row * layer.tile_h - my0;
+        const int32_t sx = ((cell - 1) % per_row) * layer.tile_w;
+        const int32_t sy = ((cell - 1) / per_row) * layer.tile_h;
+
+        // Clip the tile to the viewport.
+        const int32_t x0 = std::max(tx, view.x);
+        const int32_t y0 = std::max(ty, view.y);
+        const int32_t x1 = std::min(tx + layer.tile_w, view.x + view.w);
+        const int32_t y1 = std::min(ty + layer.tile_h, view.y + view.h);
+        if (x1 <= x0 || y1 <= y0) continue;
+        const Rect r{x0, y0, x1 - x0, y1 - y0};
+
+        if (fast) {
+          copy_rect565(ts, sx + (x0 - tx), sy + (y0 - ty), fast, r);
+        } else {
+          t->setClipRect(r.x, r.y, r.w, r.h);
+          ts->pushSprite(t, tx - sx, ty - sy);
+        }
+        drawn++;
+      }
+    }
+    if (!fast) {
+      t->clearClipRect();
+      t->endWrite();
+    }
+    if (!dst) damage(view.x, view.y, view.w, view.h);
+    return drawn;
+  }
+
+  void endFrame() {
+#if CARDSTOCK_RENDER_TASK
+    if (recording()) {
+      push(make_cmd(RenderCmd::kEndFrame), nullptr);
+      g_frames_recorded++;
+      g_render_stats.commands = g_frame_commands;
+      g_render_stats.wait_us = g_frame_wait_lua_us;
+      g_render_stats.syncs = g_frame_syncs;
+      g_frame_commands = 0;
+      g_frame_wait_lua_us = 0;
+      g_frame_syncs = 0;
+      // At most one frame queued behind the one being rendered.
+      wait_render([] { return g_frames_done.load(std::memory_order_acquire) + 1 >= g_frames_recorded; });
+      return;
+    }
+#endif
+    uint32_t pixels = 0;
+    for (int i = 0; i < g_dirty_count; i++) pixels += static_cast<uint32_t>(area(g_dirty[i]));
+
+    if (g_fb && g_dirty_count) {
+      wait_flush();  // one transfer in flight at a time
+      const uint32_t t1 = micros();
+      start_flush(g_fb);
+      if (g_front) {
+        copy_damage(g_fb, g_front);
+        copy_text_state(g_fb, g_front);
+        std::swap(g_fb, g_front);
+      }
+      g_stats.flush_us = micros() - t1;
+    } else {
+      g_stats.flush_us = 0;
+    }
+
+    g_stats.rects = static_cast<uint32_t>(g_dirty_count);
+    g_stats.pixels = pixels;
+    g_stats.bytes = g_fb ? pixels * 2 : g_frame_direct_bytes;
+    g_stats.total_bytes += g_stats.bytes;
+    g_stats.frames++;
+    g_stats.dma_wait_us = g_frame_wait_us;
+
+    g_dirty_count = 0;
+    g_frame_direct_bytes = 0;
+    g_frame_wait_us = 0;
+  }
+
+  void waitFlush() {
+    if (run_on_render_task(make_cmd(RenderCmd::kWaitFlush))) return;
+    wait_flush();
+  }
+
+  void reset() {
+    setRenderMode(RenderMode::kSync);
+    setFramebuffer(0);
+    g_dirty_count = 0;
+    g_frame_direct_bytes = 0;
+  }
+
+  uint8_t setFramebuffer(uint8_t buffers) {
+    if (buffers > 2) buffers = 2;
+    if (buffers == framebuffer()) return buffers;
+    if (run_on_render_task(make_cmd(RenderCmd::kFramebuffer, 0, buffers))) {
+      g_shadow_stale = true;
+      return framebuffer();
+    }
+
+    M5GFX& d = M5Cardputer.Display;
+    if (g_fb) {
+      // Push anything still pending and let the DMA finish before freeing.
+      wait_flush();
+      if (g_dirty_count) {
+        start_flush(g_fb);
+        wait_flush();
+      }
+      g_dirty_count = 0;
+      copy_text_state(g_fb, &d);
+      free_screen_buffer(g_front);
+      free_screen_buffer(g_fb);
+    }
+    if (buffers == 0) return 0;
+
+    g_fb = new_screen_buffer();
+    if (!g_fb) return 0;
+    if (buffers == 2) g_front = new_screen_buffer();  // stays single-buffered if this fails
+    copy_text_state(&d, g_fb);
+    g_frame_direct_bytes = 0;
+    damage(0, 0, width(), height());
+    return framebuffer();
+  }
+
+  uint8_t framebuffer() {
+    sync();
+    if (!g_fb) return 0;
+    return g_front ? 2 : 1;
+  }
+
+  const TextCacheStats& textCacheStats() {
+    sync();
+    g_text_stats.budget = kTextCacheBudget;
+    return g_text_stats;
+  }
+
+  const DamageStats& damageStats() {
+    sync();
+    return g_stats;
+  }
+
+  // -------------------------------
+  // Render task
+  // -------------------------------
+
+  RenderMode setRenderMode(RenderMode mode) {
+#if CARDSTOCK_RENDER_TASK
+    if ((mode == RenderMode::kThreaded) == g_threaded) return renderMode();
+    if (mode == RenderMode::kThreaded) {
+      wait_flush();  // the render task owns the bus from here on
+      if (!start_render_task()) return RenderMode::kSync;
+      g_shadow_stale = true;
+      g_frames_recorded = g_frames_done.load();
+      g_threaded = true;
+    } else {
+      run_on_render_task(make_cmd(RenderCmd::kWaitFlush));
+      g_threaded = false;
+    }
+#else
+    (void)mode;
+#endif
+    return renderMode();
+  }
+
+  RenderMode renderMode() {
+    return g_threaded ? RenderMode::kThreaded : RenderMode::kSync;
+  }
+
+  void sync() {
+#if CARDSTOCK_RENDER_TASK
+    if (!recording()) return;
+    const uint32_t head = g_head.load(std::memory_order_relaxed);
+    if (g_tail.load(std::memory_order_acquire) == head) return;
+    g_frame_syncs++;
+    wait_render([head] { return g_tail.load(std::memory_order_acquire) == head; });
+#endif
+  }
+
+  const RenderStats& renderStats() {
+    return g_render_stats;
+  }
+}  // namespace GfxService
@@ -2,23 +2,250 @@
 
 #include <Arduino.h>
 
+#include "M5Cardputer.h"
+
 // Thin wrapper around the device display so Lua bindings don't touch hardware globals directly.
+//
+// Every draw call records the screen rectangle it touched. In frame-buffer
+// mode the calls land in a RAM copy of the screen instead of the panel, and
+// endFrame() starts a DMA transfer of only the merged damaged rectangles and
+// returns without waiting for it, so the next tick() runs during the transfer.
+// With one buffer, the first draw call of the next frame waits for the DMA;
+// with two, drawing continues in the other buffer (brought up to date by
+// copying the flushed regions across) and only the next flush waits.
 namespace GfxService {
 
+struct Rect {
+  int32_t x, y, w, h;
+};
+
 void clear(uint16_t color = 0x0000 /* BLACK */);
 void setCursor(int32_t x, int32_t y);
 void setTextSize(uint8_t size);
 void setTextColor(uint16_t fg, int32_t bg = -1);  // bg < 0 => don't set background
+// Text colours / whole text style of `dst`, or the screen when null.
+void setTextColor(M5Canvas* dst, uint16_t fg, int32_t bg = -1);
+void setTextStyle(M5Canvas* dst, const lgfx::TextStyle& style);
 void print(const char* s);
 void println(const char* s);
 void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color = 0x0000 /* BLACK */);
 
-// Returns the pixel width of the rendered string (per M5GFX/LovyanGFX convention).
+// Vector primitives onto `dst`, or the screen when null. Clipping happens in
+// C and filled shapes are drawn as horizontal spans.
+void drawLine(M5Canvas* dst, int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint16_t color);
+void drawFastHLine(M5Canvas* dst, int32_t x, int32_t y, int32_t w, uint16_t color);
+void drawFastVLine(M5Canvas* dst, int32_t x, int32_t y, int32_t h, uint16_t color);
+void drawRect(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color);
+void fillRect(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h, uint16_t color);
+void drawCircle(M5Canvas* dst, int32_t x, int32_t y, int32_t r, uint16_t color);
+void fillCircle(M5Canvas* dst, int32_t x, int32_t y, int32_t r, uint16_t color);
+void drawRoundRect(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color);
+void fillRoundRect(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h, int32_t r, uint16_t color);
+void drawTriangle(M5Canvas* dst, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2,
+                  uint16_t color);
+void fillTriangle(M5Canvas* dst, int32_t x0, int32_t y0, int32_t x1, int32_t y1, int32_t x2, int32_t y2,
+                  uint16_t color);
+// `xy` holds `points` (x, y) pairs. drawPolygon closes the outline;
+// fillPolygon uses the even-odd rule.
+void drawPolygon(M5Canvas* dst, const int32_t* xy, size_t points, uint16_t color);
+void fillPolygon(M5Canvas* dst, const int32_t* xy, size_t points, uint16_t color);
+
+// Returns the pixel width of the string as TextService measures it, so the
+// result is the same with or without the render task.
+// Strings drawn repeatedly with the same font, size and colours are served
+// from the text-run cache (see TextCacheStats).
 int32_t drawString(const char* s, int32_t x, int32_t y, int32_t font = -1);
+int32_t drawString(M5Canvas* dst, const char* s, int32_t x, int32_t y, int32_t font = -1);
 int32_t drawCenterString(const char* s, int32_t x, int32_t y, int32_t font = -1);
 
+// Scroll region of `dst` (the screen when null), clipped to the surface; the
+// whole surface by default.
+void setScrollRect(M5Canvas* dst, int32_t x, int32_t y, int32_t w, int32_t h);
+void clearScrollRect(M5Canvas* dst);
+
+// Moves the contents of the scroll region by (dx, dy) and fills the uncovered
+// strips with `fill`, so a console only has to draw its new line. Sprites and
+// the frame buffer are moved with one memmove per row; on the bare panel the
+// region is read back and rewritten over SPI by M5GFX.
+void scroll(M5Canvas* dst, int32_t dx, int32_t dy, uint16_t fill = 0x0000 /* BLACK */);
+
+// Push a sprite onto the screen (the frame buffer when enabled). Pixels equal
+// to `transparent` (RGB565) are skipped when it is >= 0.
+void pushSprite(M5Canvas* sprite, int32_t x, int32_t y, int32_t transparent = -1);
+
+// Copies the (sx, sy, sw, sh) region of `src` to (dx, dy) on `dst`, or on the
+// screen when `dst` is null. Copies into a 16-bit canvas go row by row through
+// RAM: straight from 16-bit sources, and through a palette lookup from 1, 2, 4
+// and 8-bit palette sources. `transparent` >= 0 is a colour key (RGB565, or a
+// palette index for palette sources). Anything else is a clipped pushSprite.
+void blit(M5Canvas* src, int32_t sx, int32_t sy, int32_t sw, int32_t sh, M5Canvas* dst, int32_t dx, int32_t dy,
+          int32_t transparent = -1);
+
+// Draws `src` rotated by `angle` degrees and scaled by (zoom_x, zoom_y) with
+// its centre at (x, y) on `dst` (the screen when null).
+void blitRotateZoom(M5Canvas* src, M5Canvas* dst, float x, float y, float angle, float zoom_x, float zoom_y,
+                    int32_t transparent = -1);
+
+// One sprite of a composited scene, drawn with its top-left at (x, y).
+struct Layer {
+  M5Canvas* sprite = nullptr;
+  int32_t x = 0, y = 0;
+  int32_t transparent = -1;  // colour key (RGB565, or palette index for palette sprites); -1 = opaque
+  bool visible = true;
+};
+
+// Rebuilds the `rects` regions of `dst` (the screen when null) from `layers`,
+// bottom first, over `background`. Overlapping regions are merged first, and
+// each region is composed a scanline at a time in RAM from the layers that
+// cover it, then written once: in place into a 16-bit canvas or the frame
+// buffer, else pushed to the surface in strips. Only 16-bit and palette
+// sprites are read straight from their buffers. Returns the pixels written.
+uint32_t composite(const Layer* layers, size_t count, const Rect* rects, size_t rect_count,
+                   uint16_t background = 0x0000 /* BLACK */, M5Canvas* dst = nullptr);
+
+struct CompositeStats {
+  uint32_t rects = 0;   // last composite: regions rebuilt after merging
+  uint32_t pixels = 0;  // last composite: pixels written
+  uint32_t bytes = 0;   // last composite: bytes written to the screen (0 for sprites)
+  uint32_t layers = 0;  // last composite: layers that touched a region
+  uint32_t spans = 0;   // last composite: layer row spans copied
+  uint32_t us = 0;      // last composite: time taken
+};
+
+const CompositeStats& compositeStats();
+
 int32_t width();
 int32_t height();
-}  // namespace GfxService
 
+// End of frame, driven by the host after draw(): starts the damage flush in
+// frame-buffer mode and rolls over the damage stats.
+void endFrame();
+
+// Blocks until an in-flight flush has finished and releases the bus; call
+// before drawing on M5Cardputer.Display directly.
+void waitFlush();
+
+// Back to defaults for a freshly loaded app (synchronous rendering, frame
+// buffer off, no damage).
+void reset();
+
+// kSync draws on the calling task. kThreaded records screen draw calls
+// (clear, fillRect, the vector primitives, text and print, sprite pushes and
+// blits onto the screen, scrolling, damage and endFrame) into a lock-free
+// single-producer/single-consumer ring that a render task pinned to the other
+// core executes, so the host's next tick() overlaps with rasterizing and
+// flushing the last frame. Calls that read results back or touch a sprite
+// (drawing into sprites, batches, tilemaps, the compositor, target(), stats)
+// first wait for the ring to drain, so a sprite is never changed while a
+// queued blit still reads it. endFrame() lets at most one recorded frame
+// queue up behind the one being rendered.
+enum class RenderMode : uint8_t { kSync, kThreaded };
 
+// Returns the mode in effect: kSync when the render task can't be started or
+// the build has -DCARDSTOCK_RENDER_TASK=0.
+RenderMode setRenderMode(RenderMode mode);
+RenderMode renderMode();
+
+// Blocks until the render task has executed everything recorded so far; a
+// no-op in kSync mode and on the render task itself.
+void sync();
+
+struct RenderStats {
+  uint32_t frames = 0;      // frames executed by the render task since boot
+  uint32_t commands = 0;    // last frame: commands recorded
+  uint32_t render_us = 0;   // last rendered frame: render task time spent on it
+  uint32_t wait_us = 0;     // last frame: time the recording task was blocked on the render task
+  uint32_t syncs = 0;       // last frame: waits for the ring to drain
+  uint32_t ring_peak = 0;   // most bytes queued at once
+  uint32_t ring_bytes = 0;  // ring size (0 until threaded mode is first used)
+};
+
+const RenderStats& renderStats();
+
+// Frame-buffer mode: 0 = draw straight to the panel, 1 = one screen-sized
+// buffer, 2 = double-buffered. Returns the mode actually in effect, which is
+// lower than requested when the buffers can't be allocated.
+uint8_t setFramebuffer(uint8_t buffers);
+uint8_t framebuffer();
+
+// Surface gfx calls draw into, and damage reporting for code that draws into
+// it directly. In threaded mode target() waits for the render task first.
+LovyanGFX* target();
+// Same surface, for reading the font and text style only: doesn't wait for
+// an in-flight flush. In threaded mode this is a copy of the text state as
+// recorded so far (it has no pixels and no size).
+const LovyanGFX* textTarget();
+void damage(int32_t x, int32_t y, int32_t w, int32_t h);
+
+// One command of a draw batch. Coordinates are in the target's space; for
+// kLine, (w, h) holds the end point.
+struct DrawOp {
+  enum Type : uint8_t { kClear, kFillRect, kDrawRect, kLine, kText, kBlit };
+  enum Flags : uint8_t { kHasBg = 1 << 0, kTransparent = 1 << 1 };
+
+  uint8_t type = kClear;
+  uint8_t flags = 0;
+  int8_t font = -1;    // kText: numbered font, -1 = current font
+  uint16_t color = 0;  // fill / line / text colour
+  uint16_t bg = 0;     // kText background, kBlit transparent colour (per flags)
+  int16_t x = 0, y = 0, w = 0, h = 0;
+  uint32_t arg = 0;    // kText: offset into the string pool, kBlit: sprite slot
+};
+
+// Runs `count` ops in order inside one write transaction onto `dst` (the
+// screen when null). Ops that are painted over by a later clear or fall
+// outside the target are skipped, and runs of same-coloured fill rects that
+// tile into one rectangle are merged. `text` is a pool of NUL-terminated
+// strings and `sprites` a table of blit sources (null entries are skipped).
+// Returns the number of primitives actually drawn.
+uint32_t drawBatch(const DrawOp* ops, size_t count, const char* text, M5Canvas* const* sprites,
+                   M5Canvas* dst = nullptr);
+
+// A grid of tile indices drawn from a tileset sprite laid out left to right,
+// top to bottom. Cell value 0 is empty; value n draws tileset tile n - 1.
+struct TileLayer {
+  M5Canvas* tileset = nullptr;
+  const uint8_t* cells8 = nullptr;    // one of cells8/cells16, row-major
+  const uint16_t* cells16 = nullptr;
+  int32_t cols = 0, rows = 0;         // map size in cells
+  int32_t tile_w = 0, tile_h = 0;
+  int32_t scroll_x = 0, scroll_y = 0; // map pixel shown at the viewport's top-left
+};
+
+// Draws the tiles of `layer` that are visible in the viewport (x, y, w, h) of
+// `dst` (the screen when null). When the tileset and target are both 16-bit
+// canvases tiles are copied row by row straight between the buffers; other
+// targets go through clipped sprite pushes. Returns the number of tiles drawn.
+uint32_t drawTiles(const TileLayer& layer, int32_t x, int32_t y, int32_t w, int32_t h, M5Canvas* dst = nullptr);
+
+// Text-run cache: the second time a string is drawn with the same font, size
+// and colours it is rasterized once into RAM (RGB565 when it has a
+// background, a 1-bpp mask when transparent) and later draws copy the run
+// instead of rendering glyph by glyph. Least recently used runs are evicted
+// to stay under CARDSTOCK_TEXT_CACHE_BYTES. Transparent runs can only be
+// composited into RAM, so on the bare panel they are drawn as usual.
+struct TextCacheStats {
+  uint32_t hits = 0;       // draws served from a cached run
+  uint32_t misses = 0;     // draws rendered normally (first sighting or cache full)
+  uint32_t bypasses = 0;   // draws not eligible for the cache
+  uint32_t evictions = 0;
+  uint32_t entries = 0;
+  uint32_t bytes = 0;      // current cache size, including bookkeeping
+  uint32_t budget = 0;
+};
+
+const TextCacheStats& textCacheStats();
+
+struct DamageStats {
+  uint32_t rects = 0;        // last frame: damaged rectangles after merging
+  uint32_t pixels = 0;       // last frame: damaged pixels
+  uint32_t bytes = 0;        // last frame: bytes pushed to the panel
+  uint32_t total_bytes = 0;  // since boot
+  uint32_t frames = 0;       // since boot
+  uint32_t flush_us = 0;     // last frame: CPU time spent starting the flush
+  uint32_t dma_wait_us = 0;  // last frame: time spent waiting for the previous DMA transfer
+};
+
+const DamageStats& damageStats();
+
+}  // namespace GfxService
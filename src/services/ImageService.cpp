@@ -0,0 +1,317 @@
+// SD.h has to come before M5GFX so it enables its fs::FS image decoders.
+#include <SD.h>
+
+#include "ImageService.h"
+#include "SdService.h"
+
+#include <new>
+
+// Largest image accepted, in pixels (2 bytes each once decoded).
+// Override with: -DCARDSTOCK_IMAGE_MAX_PIXELS=...
+#ifndef CARDSTOCK_IMAGE_MAX_PIXELS
+#define CARDSTOCK_IMAGE_MAX_PIXELS (320 * 240)
+#endif
+
+// Decoded-image cache switch. Disable with: -DCARDSTOCK_IMAGE_CACHE=0
+#ifndef CARDSTOCK_IMAGE_CACHE
+#define CARDSTOCK_IMAGE_CACHE 1
+#endif
+
+// Log per-image load time and cache hits to Serial.
+// Enable with: -DCARDSTOCK_IMAGE_STATS
+
+namespace ImageService {
+
+namespace {
+
+static const char* kCacheRoot = "/cache/img";
+
+enum class Format : uint8_t { kUnknown, kPng, kBmp, kJpeg };
+
+// Header in front of every cached decode; the pixels follow as stored in the
+// canvas buffer (RGB565, big-endian).
+struct CacheHeader {
+  char magic[4];
+  uint16_t format;
+  uint16_t reserved;
+  uint16_t width;
+  uint16_t height;
+  uint32_t src_size;
+  uint32_t src_mtime;
+};
+
+static const char kCacheMagic[4] = {'C', 'S', 'I', 'M'};
+static const uint16_t kCacheFormat = 1;
+
+static Stats g_stats;
+
+static String cache_path_for(const String& normalized) {
+  // "/icons/app.png" -> "/cache/img/icons/app.png.565"
+  return String(kCacheRoot) + normalized + ".565";
+}
+
+static uint16_t be16(const uint8_t* p) {
+  return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+static uint32_t be32(const uint8_t* p) {
+  return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+         (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+static int32_t le32(const uint8_t* p) {
+  return static_cast<int32_t>(static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+                              (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24));
+}
+
+// Walks JPEG marker segments up to the first start-of-frame and reads the
+// frame size from it.
+static bool jpeg_size(File& f, int32_t& w, int32_t& h) {
+  uint8_t b[7];
+  f.seek(2);
+  for (;;) {
+    if (!SdService::readExact(f, b, 2) || b[0] != 0xFF) return false;
+    uint8_t marker = b[1];
+    while (marker == 0xFF) {  // fill bytes
+      if (!SdService::readExact(f, &marker, 1)) return false;
+    }
+    if (!SdService::readExact(f, b, 2)) return false;
+    const uint16_t len = be16(b);
+    if (len < 2) return false;
+    // SOF0..SOF15, except DHT (C4), JPG (C8) and DAC (CC).
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      if (!SdService::readExact(f, b, 5)) return false;
+      h = be16(b + 1);
+      w = be16(b + 3);
+      return true;
+    }
+    if (!f.seek(f.position() + len - 2)) return false;
+  }
+}
+
+// Identifies the image by its magic bytes and reads its dimensions without
+// decoding it.
+static Format sniff(File& f, int32_t& w, int32_t& h) {
+  uint8_t head[26];
+  if (!SdService::readExact(f, head, sizeof(head))) return Format::kUnknown;
+
+  static const uint8_t kPngSig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  if (memcmp(head, kPngSig, sizeof(kPngSig)) == 0 && memcmp(head + 12, "IHDR", 4) == 0) {
+    w = static_cast<int32_t>(be32(head + 16));
+    h = static_cast<int32_t>(be32(head + 20));
+    return Format::kPng;
+  }
+  if (head[0] == 'B' && head[1] == 'M') {
+    w = le32(head + 18);
+    h = le32(head + 22);
+    if (h < 0) h = -h;  // top-down bitmap
+    return Format::kBmp;
+  }
+  if (head[0] == 0xFF && head[1] == 0xD8) {
+    return jpeg_size(f, w, h) ? Format::kJpeg : Format::kUnknown;
+  }
+  return Format::kUnknown;
+}
+
+static M5Canvas* new_canvas(int32_t w, int32_t h) {
+  M5Canvas* c = new (std::nothrow) M5Canvas(&M5Cardputer.Display);
+  if (!c) return nullptr;
+  c->setColorDepth(16);
+  if (!c->createSprite(w, h)) {
+    delete c;
+    return nullptr;
+  }
+  return c;
+}
+
+static void free_canvas(M5Canvas* c) {
+  c->deleteSprite();
+  delete c;
+}
+
+static CacheHeader make_header(File& src, int32_t w, int32_t h) {
+  CacheHeader hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, kCacheMagic, sizeof(hdr.magic));
+  hdr.format = kCacheFormat;
+  hdr.width = static_cast<uint16_t>(w);
+  hdr.height = static_cast<uint16_t>(h);
+  hdr.src_size = static_cast<uint32_t>(src.size());
+  hdr.src_mtime = static_cast<uint32_t>(src.getLastWrite());
+  return hdr;
+}
+
+// Returns a canvas filled from `cache_path` if it holds a decode of a source
+// matching `want`.
+static M5Canvas* load_cached(const String& cache_path, const CacheHeader& want) {
+  File f = SD.open(cache_path.c_str(), FILE_READ);
+  if (!f) return nullptr;
+
+  CacheHeader have;
+  M5Canvas* c = nullptr;
+  if (SdService::readExact(f, reinterpret_cast<uint8_t*>(&have), sizeof(have)) && memcmp(&have, &want, sizeof(have)) == 0) {
+    c = new_canvas(want.width, want.height);
+    const size_t len = static_cast<size_t>(want.width) * want.height * 2;
+    if (c && !SdService::readExact(f, static_cast<uint8_t*>(c->getBuffer()), len)) {
+      // Truncated blob; caller decodes the source and overwrites it.
+      free_canvas(c);
+      c = nullptr;
+    }
+  }
+  f.close();
+  return c;
+}
+
+struct CacheBlob {
+  const CacheHeader* header;
+  M5Canvas* canvas;
+};
+
+static bool write_blob(File& f, void* ctx) {
+  const CacheBlob* b = static_cast<const CacheBlob*>(ctx);
+  const size_t len = static_cast<size_t>(b->header->width) * b->header->height * 2;
+  return f.write(reinterpret_cast<const uint8_t*>(b->header), sizeof(CacheHeader)) == sizeof(CacheHeader) &&
+         f.write(static_cast<const uint8_t*>(b->canvas->getBuffer()), len) == len;
+}
+
+// Best effort: a full or read-only card just means the next load decodes again.
+static void store_cached(const String& cache_path, const CacheHeader& header, M5Canvas* c) {
+  CacheBlob blob{&header, c};
+  SdService::writeFile(cache_path, write_blob, &blob);
+}
+
+static bool decode(M5Canvas* c, Format fmt, const char* path) {
+  switch (fmt) {
+    case Format::kPng: return c->drawPngFile(SD, path, 0, 0);
+    case Format::kBmp: return c->drawBmpFile(SD, path, 0, 0);
+    case Format::kJpeg: return c->drawJpgFile(SD, path, 0, 0);
+    default: return false;
+  }
+}
+
+}  // namespace
+
+  M5Canvas* load(const char* path, String& out_err) {
+    const uint32_t t0 = micros();
+    const String normalized = SdService::normalizePath(path ? path : "");
+
+    File src = SD.open(normalized.c_str(), FILE_READ);
+    if (!src || src.isDirectory()) {
+      out_err = String("cannot open ") + normalized;
+      g_stats.failures++;
+      return nullptr;
+    }
+
+    int32_t w = 0;
+    int32_t h = 0;
+    const Format fmt = sniff(src, w, h);
+    const CacheHeader header = make_header(src, w, h);
+    src.close();
+
+    if (fmt == Format::kUnknown) {
+      out_err = String("not a PNG, BMP or JPEG image: ") + normalized;
+      g_stats.failures++;
+      return nullptr;
+    }
+    if (w <= 0 || h <= 0 || w > 0xFFFF || h > 0xFFFF ||
+        static_cast<int64_t>(w) * h > CARDSTOCK_IMAGE_MAX_PIXELS) {
+      out_err = String("image too large: ") + normalized + " (" + String(w) + "x" + String(h) + ")";
+      g_stats.failures++;
+      return nullptr;
+    }
+
+    const String cache_path = cache_path_for(normalized);
+#if CARDSTOCK_IMAGE_CACHE
+    if (M5Canvas* c = load_cached(cache_path, header)) {
+      const uint32_t elapsed = micros() - t0;
+      g_stats.cached_loads++;
+      g_stats.cached_us += elapsed;
+#ifdef CARDSTOCK_IMAGE_STATS
+      Serial.println(String("image ") + normalized + ": cached, " + String(static_cast<unsigned long>(elapsed)) + " us");
+#endif
+      return c;
+    }
+#endif
+
+    M5Canvas* c = new_canvas(w, h);
+    if (!c) {
+      out_err = String("out of memory for ") + String(w) + "x" + String(h) + " image";
+      g_stats.failures++;
+      return nullptr;
+    }
+    if (!decode(c, fmt, normalized.c_str())) {
+      free_canvas(c);
+      out_err = String("decode failed: ") + normalized;
+      g_stats.failures++;
+      return nullptr;
+    }
+
+#if CARDSTOCK_IMAGE_CACHE
+    store_cached(cache_path, header, c);
+#endif
+    const uint32_t elapsed = micros() - t0;
+    g_stats.cold_loads++;
+    g_stats.cold_us += elapsed;
+#ifdef CARDSTOCK_IMAGE_STATS
+    Serial.println(String("image ") + normalized + ": decoded " + String(w) + "x" + String(h) + ", " +
+                   String(static_cast<unsigned long>(elapsed)) + " us");
+#endif
+    return c;
+  }
+
+  void invalidate(const char* path) {
+    if (!path) {
+      SdService::removeTree(kCacheRoot);
+      return;
+    }
+    SD.remove(cache_path_for(SdService::normalizePath(path)).c_str());
+  }
+
+  const Stats& stats() {
+    return g_stats;
+  }
+
+  void bench(const char* dir) {
+    File d = SD.open(dir, FILE_READ);
+    if (!d || !d.isDirectory()) {
+      Serial.println(String("bench img: no directory ") + dir);
+      return;
+    }
+
+    uint32_t count = 0;
+    uint64_t cold_total = 0;
+    uint64_t cached_total = 0;
+    for (File entry = d.openNextFile(); entry; entry = d.openNextFile()) {
+      if (entry.isDirectory()) continue;
+      String path = entry.path();
+      entry.close();
+
+      String err;
+      invalidate(path.c_str());
+      uint32_t t0 = micros();
+      M5Canvas* c = load(path.c_str(), err);
+      const uint32_t cold = micros() - t0;
+      if (!c) continue;  // not an image
+      free_canvas(c);
+
+      t0 = micros();
+      c = load(path.c_str(), err);
+      const uint32_t cached = micros() - t0;
+      if (c) free_canvas(c);
+
+      Serial.println(String("bench img ") + path + ": cold " + String(cold / 1000.0f, 2) + " ms, cached " +
+                     String(cached / 1000.0f, 2) + " ms");
+      count++;
+      cold_total += cold;
+      cached_total += cached;
+    }
+    d.close();
+
+    if (count) {
+      Serial.println(String("bench img: ") + String(static_cast<unsigned long>(count)) + " icons, avg cold " +
+                     String(cold_total / 1000.0f / count, 2) + " ms, avg cached " +
+                     String(cached_total / 1000.0f / count, 2) + " ms");
+    }
+  }
+
+}  // namespace ImageService
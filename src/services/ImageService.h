@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "M5Cardputer.h"
+
+// Image loading from SD into sprites.
+//
+// PNG, BMP and JPEG files are decoded by M5GFX straight from the open file
+// into a 16-bit canvas, a block at a time, so the compressed file is never
+// held in RAM. The decoded pixels are then written to an on-SD cache
+// ("/icons/app.png" -> "/cache/img/icons/app.png.565"), keyed by the source
+// size and mtime, and later loads of the same file are one sequential read
+// straight into the canvas buffer.
+namespace ImageService {
+
+// Decodes `path` into a new canvas parented to the display. Returns nullptr
+// and sets `out_err` if the file can't be read, isn't a supported image or
+// doesn't fit in memory.
+M5Canvas* load(const char* path, String& out_err);
+
+// Drops the cached decode of `path` (nullptr drops them all). Call after the
+// source is rewritten: FAT mtimes are 2 s apart, so a same-size rewrite
+// within that window looks unchanged to the cache key.
+void invalidate(const char* path);
+
+struct Stats {
+  uint32_t cold_loads = 0;    // decoded from the source file
+  uint32_t cached_loads = 0;  // read back from the decoded-image cache
+  uint32_t failures = 0;
+  uint64_t cold_us = 0;       // total time spent in cold loads
+  uint64_t cached_us = 0;     // total time spent in cached loads
+};
+
+const Stats& stats();
+
+// Launch-time benchmark: loads every image in `dir` cold (cache dropped) and
+// then cached, logging per-image and average ms to Serial.
+void bench(const char* dir);
+
+}  // namespace ImageService
@@ -2,20 +2,263 @@
 
 #include "M5Cardputer.h"
 
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <vector>
+
+// Scan the keyboard from its own task rather than once per loop().
+// Disable with: -DCARDSTOCK_KEY_SCAN_TASK=0
+#ifndef CARDSTOCK_KEY_SCAN_TASK
+#define CARDSTOCK_KEY_SCAN_TASK 1
+#endif
+
+// Scan period; a keypress is ~30-80 ms. Override with: -DCARDSTOCK_KEY_SCAN_MS=8
+#ifndef CARDSTOCK_KEY_SCAN_MS
+#define CARDSTOCK_KEY_SCAN_MS 4
+#endif
+
+// Core and priority of the scanning task (above the render task, so a long
+// raster doesn't delay scans). Override with: -DCARDSTOCK_KEY_SCAN_CORE=1
+#ifndef CARDSTOCK_KEY_SCAN_CORE
+#define CARDSTOCK_KEY_SCAN_CORE 0
+#endif
+#ifndef CARDSTOCK_KEY_SCAN_PRIORITY
+#define CARDSTOCK_KEY_SCAN_PRIORITY 3
+#endif
+
+// Events held until poll(); newer ones are dropped when it's full.
+// Override with: -DCARDSTOCK_KEY_QUEUE=128
+#ifndef CARDSTOCK_KEY_QUEUE
+#define CARDSTOCK_KEY_QUEUE 64
+#endif
+
+// Held-key repeat: delay before the first repeat and interval after it.
+// Disable with: -DCARDSTOCK_KEY_REPEAT_DELAY_MS=0
+#ifndef CARDSTOCK_KEY_REPEAT_DELAY_MS
+#define CARDSTOCK_KEY_REPEAT_DELAY_MS 450
+#endif
+#ifndef CARDSTOCK_KEY_REPEAT_MS
+#define CARDSTOCK_KEY_REPEAT_MS 60
+#endif
+
 namespace KeyboardService {
+    namespace {
+        // The matrix is 4 rows of 14 keys; bit y * 14 + x is set while that key is down.
+        static const int kCols = 14;
+        static const int kRows = 4;
+
+        // Legends of the Cardputer layout, row by row, in matrix order.
+        static const char* const kKeyNames[kKeys] = {
+            "`", "1", "2", "3", "4", "5", "6", "7", "8", "9", "0", "-", "=", "del",
+            "tab", "q", "w", "e", "r", "t", "y", "u", "i", "o", "p", "[", "]", "\\",
+            "fn", "shift", "a", "s", "d", "f", "g", "h", "j", "k", "l", ";", "'", "enter",
+            "ctrl", "opt", "alt", "z", "x", "c", "v", "b", "n", "m", ",", ".", "/", " ",
+        };
+
+        static SemaphoreHandle_t g_lock = nullptr; // guards M5Cardputer.Keyboard and everything below
+        static uint64_t g_down = 0;
+        static uint64_t g_pressed_since_update = 0;
+        static int g_repeat_bit = -1;
+        static int64_t g_repeat_at = 0;
+
+        static Event g_queue[CARDSTOCK_KEY_QUEUE];
+        static size_t g_queue_head = 0; // oldest event
+        static size_t g_queue_count = 0;
+        static uint32_t g_activity_events = 0;
+        static int64_t g_epoch_us = 0;
+        static Stats g_stats;
+
+        // Public functions take the lock; the helpers here expect it held.
+        struct Lock {
+            Lock() { if (g_lock) xSemaphoreTake(g_lock, portMAX_DELAY); }
+            ~Lock() { if (g_lock) xSemaphoreGive(g_lock); }
+        };
+
+        static_assert(kRows * kCols == kKeys, "key matrix size");
+
+        static uint64_t key_bit(int x, int y) {
+            return static_cast<uint64_t>(1) << (y * kCols + x);
+        }
+
+        static void push(EventType type, int bit, int64_t now) {
+            if (g_queue_count == CARDSTOCK_KEY_QUEUE) {
+                g_stats.dropped++;
+                return;
+            }
+            Point2D_t p;
+            p.x = bit % kCols;
+            p.y = bit / kCols;
+            Event& e = g_queue[(g_queue_head + g_queue_count) % CARDSTOCK_KEY_QUEUE];
+            e.time_us = now;
+            e.type = type;
+            e.x = static_cast<uint8_t>(p.x);
+            e.y = static_cast<uint8_t>(p.y);
+            e.key = M5Cardputer.Keyboard.getKey(p);
+            g_queue_count++;
+            g_stats.events++;
+            if (g_queue_count > g_stats.peak) g_stats.peak = static_cast<uint32_t>(g_queue_count);
+        }
+
+        // Diffs the freshly updated key list against the last scan and queues
+        // the changes. Called with the lock held.
+        static void scan() {
+            const int64_t now = esp_timer_get_time();
+            uint64_t down = 0;
+            for (const Point2D_t& p : M5Cardputer.Keyboard.keyList()) {
+                if (p.x >= 0 && p.x < kCols && p.y >= 0 && p.y < kRows) down |= key_bit(p.x, p.y);
+            }
+            g_stats.scans++;
+
+            const uint64_t changed = down ^ g_down;
+            for (int bit = 0; changed >> bit; bit++) {
+                if (!((changed >> bit) & 1)) continue;
+                const bool pressed = (down >> bit) & 1;
+                push(pressed ? EventType::kPress : EventType::kRelease, bit, now);
+                if (pressed) {
+                    g_repeat_bit = bit;
+                    g_repeat_at = now + CARDSTOCK_KEY_REPEAT_DELAY_MS * 1000LL;
+                } else if (bit == g_repeat_bit) {
+                    g_repeat_bit = -1;
+                }
+            }
+            if (CARDSTOCK_KEY_REPEAT_DELAY_MS > 0 && g_repeat_bit >= 0 && now >= g_repeat_at) {
+                push(EventType::kRepeat, g_repeat_bit, now);
+                g_repeat_at += CARDSTOCK_KEY_REPEAT_MS * 1000LL;
+                if (g_repeat_at < now) g_repeat_at = now + CARDSTOCK_KEY_REPEAT_MS * 1000LL;
+            }
+
+            g_pressed_since_update |= down & ~g_down;
+            g_down = down;
+        }
+
+#if CARDSTOCK_KEY_SCAN_TASK
+        static TaskHandle_t g_scan_task = nullptr;
+
+        static void scan_task(void*) {
+            TickType_t wake = xTaskGetTickCount();
+            for (;;) {
+                {
+                    Lock lock;
+                    M5Cardputer.Keyboard.updateKeyList();
+                    M5Cardputer.Keyboard.updateKeysState();
+                    scan();
+                }
+                vTaskDelayUntil(&wake, pdMS_TO_TICKS(CARDSTOCK_KEY_SCAN_MS));
+            }
+        }
+#endif
+    }
+
+    void begin() {
+#if CARDSTOCK_KEY_SCAN_TASK
+        if (g_scan_task) return;
+        if (!g_lock) g_lock = xSemaphoreCreateMutex();
+        if (!g_lock) return;
+        if (xTaskCreatePinnedToCore(scan_task, "keys", 3072, nullptr, CARDSTOCK_KEY_SCAN_PRIORITY, &g_scan_task,
+                                    CARDSTOCK_KEY_SCAN_CORE) != pdPASS) {
+            g_scan_task = nullptr;
+        }
+#endif
+    }
+
+    void update() {
+        Lock lock;
+        M5Cardputer.update();
+        scan();
+        // Presses that came and went since the last update(): invisible to
+        // anything that only looks at the state once a frame.
+        for (uint64_t gone = g_pressed_since_update & ~g_down; gone; gone &= gone - 1) g_stats.missed++;
+        g_pressed_since_update = 0;
+    }
+
     bool isChanged() {
+        Lock lock;
         return M5Cardputer.Keyboard.isChange();
     }
     uint8_t isPressed() {
+        Lock lock;
         return M5Cardputer.Keyboard.isPressed();
     }
     bool isKeyPressed(char c) {
+        Lock lock;
         return M5Cardputer.Keyboard.isKeyPressed(c);
     }
     uint8_t getKey(int32_t x, int32_t y) {
         Point2D_t keyCoord;
         keyCoord.x = static_cast<int>(x);
         keyCoord.y = static_cast<int>(y);
+        Lock lock;
         return M5Cardputer.Keyboard.getKey(keyCoord);
     }
-}
\ No newline at end of file
+    bool hasActivity() {
+        static std::vector<Point2D_t> last;
+        Lock lock;
+        const std::vector<Point2D_t>& now = M5Cardputer.Keyboard.keyList();
+        bool changed = now.size() != last.size();
+        for (size_t i = 0; !changed && i < now.size(); i++) {
+            changed = now[i].x != last[i].x || now[i].y != last[i].y;
+        }
+        if (changed) last = now;
+        if (g_stats.events != g_activity_events) {
+            g_activity_events = g_stats.events;
+            changed = true;
+        }
+        return changed;
+    }
+
+    uint64_t keyMask() {
+        Lock lock;
+        return g_down;
+    }
+    uint8_t modifiers(uint64_t mask) {
+        static const struct { int index; uint8_t flag; } kModifiers[] = {
+            {29, kShift}, {42, kCtrl}, {44, kAlt}, {43, kOpt}, {28, kFn},
+        };
+        uint8_t mods = 0;
+        for (const auto& m : kModifiers) {
+            if ((mask >> m.index) & 1) mods |= m.flag;
+        }
+        return mods;
+    }
+    const char* keyName(int index) {
+        return index >= 0 && index < kKeys ? kKeyNames[index] : nullptr;
+    }
+    int keyIndex(const char* name) {
+        for (int i = 0; i < kKeys; i++) {
+            if (strcmp(kKeyNames[i], name) == 0) return i;
+        }
+        return -1;
+    }
+
+    size_t poll(Event* out, size_t max) {
+        Lock lock;
+        size_t n = 0;
+        for (; n < max && g_queue_count; n++) {
+            out[n] = g_queue[g_queue_head];
+            g_queue_head = (g_queue_head + 1) % CARDSTOCK_KEY_QUEUE;
+            g_queue_count--;
+        }
+        return n;
+    }
+    size_t pending() {
+        Lock lock;
+        return g_queue_count;
+    }
+    void clear() {
+        Lock lock;
+        g_queue_head = 0;
+        g_queue_count = 0;
+        g_epoch_us = esp_timer_get_time();
+    }
+    int64_t epoch() {
+        Lock lock;
+        return g_epoch_us;
+    }
+
+    const Stats& stats() {
+        return g_stats;
+    }
+}
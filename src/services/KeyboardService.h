@@ -2,9 +2,60 @@
 
 #include <Arduino.h>
 
+// Keyboard state and events.
+//
+// begin() starts a scanning task that samples the key matrix every
+// CARDSTOCK_KEY_SCAN_MS, independent of the Lua frame rate, and turns every
+// change into a timestamped press/release event (plus repeat events while a
+// key is held) in a fixed-size queue; poll() drains it. Keys pressed and
+// released between two frames still produce events, where the polled state
+// below only ever sees what is down when update() runs. Without begin() (or
+// with -DCARDSTOCK_KEY_SCAN_TASK=0) update() does the scanning, once a frame.
 namespace KeyboardService {
+    void begin(); // starts the scanning task; call after M5Cardputer.begin()
+    void update(); // once per loop(), in place of M5Cardputer.update()
+
     bool isChanged();
     uint8_t isPressed(); // returns number of pressed keys
     bool isKeyPressed(char c); // returns true if the key is pressed
     uint8_t getKey(int32_t x, int32_t y); // returns the key code of the pressed key at (x,y)
-}
\ No newline at end of file
+    bool hasActivity(); // true if the pressed-key set differs from the last call or new events were queued since; unlike isChanged() it doesn't consume the change
+
+    // Snapshot of the whole matrix as of the last scan: bit y * 14 + x is set
+    // while the key at (x, y) is down (kKeys bits in all).
+    static const int kKeys = 56;
+    uint64_t keyMask();
+
+    // Modifier keys held in a keyMask() snapshot.
+    enum Modifier : uint8_t { kShift = 1, kCtrl = 2, kAlt = 4, kOpt = 8, kFn = 16 };
+    uint8_t modifiers(uint64_t mask);
+
+    // Unshifted legend of key `index` ("a", "1", "enter", "shift", " ", ...),
+    // and the index of a legend, or -1.
+    const char* keyName(int index);
+    int keyIndex(const char* name);
+
+    enum class EventType : uint8_t { kPress, kRelease, kRepeat };
+
+    struct Event {
+        int64_t time_us; // esp_timer time of the scan that saw it
+        EventType type;
+        uint8_t x, y;    // matrix position
+        uint8_t key;     // key code, as getKey(x, y) at that moment
+    };
+
+    size_t poll(Event* out, size_t max); // moves up to `max` queued events, oldest first, to `out`
+    size_t pending();
+    void clear(); // drops queued events and restarts epoch() (on app switch)
+    int64_t epoch(); // esp_timer time of the last clear(); apps see event times relative to it
+
+    struct Stats {
+        uint32_t scans = 0;
+        uint32_t events = 0;  // queued since boot
+        uint32_t dropped = 0; // lost because the queue was full
+        uint32_t missed = 0;  // presses released before update() saw them: what per-frame polling loses
+        uint32_t peak = 0;    // most events queued at once
+    };
+
+    const Stats& stats();
+}
@@ -0,0 +1,181 @@
+#include "PixelService.h"
+
+#include <algorithm>
+
+namespace PixelService {
+
+namespace {
+
+static inline uint16_t swap16(uint16_t c) {
+  return static_cast<uint16_t>((c >> 8) | (c << 8));
+}
+
+static bool clip(GfxService::Rect& r, int32_t w, int32_t h) {
+  if (r.w < 0) { r.x += r.w; r.w = -r.w; }
+  if (r.h < 0) { r.y += r.h; r.h = -r.h; }
+  const int32_t x0 = std::max<int32_t>(r.x, 0);
+  const int32_t y0 = std::max<int32_t>(r.y, 0);
+  const int32_t x1 = std::min<int32_t>(r.x + r.w, w);
+  const int32_t y1 = std::min<int32_t>(r.y + r.h, h);
+  if (x1 <= x0 || y1 <= y0) return false;
+  r = GfxService::Rect{x0, y0, x1 - x0, y1 - y0};
+  return true;
+}
+
+// Clips a copy of the `r` region of `src` to (dx, dy) on `dst` against both.
+static bool clip_copy(const View& src, GfxService::Rect& r, const View& dst, int32_t& dx, int32_t& dy) {
+  const GfxService::Rect want = r;
+  if (!clip(r, src.width, src.height)) return false;
+  dx += r.x - want.x;
+  dy += r.y - want.y;
+  GfxService::Rect d{dx, dy, r.w, r.h};
+  if (!clip(d, dst.width, dst.height)) return false;
+  r.x += d.x - dx;
+  r.y += d.y - dy;
+  r.w = d.w;
+  r.h = d.h;
+  dx = d.x;
+  dy = d.y;
+  return true;
+}
+
+// Luma (0-255) of a buffer-order RGB565 pixel.
+static inline uint32_t luma(uint16_t px) {
+  const uint16_t c = swap16(px);
+  const uint32_t r = (c >> 8) & 0xF8;
+  const uint32_t g = (c >> 3) & 0xFC;
+  const uint32_t b = (c << 3) & 0xF8;
+  return (r * 77 + g * 150 + b * 29) >> 8;
+}
+
+// Per-channel mix of two buffer-order RGB565 pixels.
+static inline uint16_t mix(uint16_t s, uint16_t d, uint32_t a) {
+  const uint32_t sc = swap16(s);
+  const uint32_t dc = swap16(d);
+  const uint32_t ia = 255 - a;
+  const uint32_t r = (((sc >> 11) & 0x1F) * a + ((dc >> 11) & 0x1F) * ia + 127) / 255;
+  const uint32_t g = (((sc >> 5) & 0x3F) * a + ((dc >> 5) & 0x3F) * ia + 127) / 255;
+  const uint32_t b = ((sc & 0x1F) * a + (dc & 0x1F) * ia + 127) / 255;
+  return swap16(static_cast<uint16_t>((r << 11) | (g << 5) | b));
+}
+
+}  // namespace
+
+  View of(M5Canvas* c) {
+    View v;
+    if (!c || !c->getBuffer() || c->getColorDepth() != lgfx::rgb565_2Byte) return v;
+    v.px = static_cast<uint16_t*>(c->getBuffer());
+    v.width = c->width();
+    v.height = c->height();
+    return v;
+  }
+
+  uint16_t get(const View& v, int32_t x, int32_t y) {
+    if (x < 0 || y < 0 || x >= v.width || y >= v.height) return 0;
+    return swap16(v.px[y * v.width + x]);
+  }
+
+  void set(const View& v, int32_t x, int32_t y, uint16_t color) {
+    if (x < 0 || y < 0 || x >= v.width || y >= v.height) return;
+    v.px[y * v.width + x] = swap16(color);
+  }
+
+  void plot(const View& v, const int32_t* xy, size_t points, uint16_t color) {
+    const uint16_t c = swap16(color);
+    for (size_t i = 0; i < points; i++) {
+      const int32_t x = xy[i * 2], y = xy[i * 2 + 1];
+      if (x >= 0 && y >= 0 && x < v.width && y < v.height) v.px[y * v.width + x] = c;
+    }
+  }
+
+  void fill(const View& v, GfxService::Rect r, uint16_t color) {
+    if (!clip(r, v.width, v.height)) return;
+    const uint16_t c = swap16(color);
+    for (int32_t y = r.y; y < r.y + r.h; y++) {
+      uint16_t* row = v.px + y * v.width + r.x;
+      std::fill(row, row + r.w, c);
+    }
+  }
+
+  void copyRect(const View& src, GfxService::Rect r, const View& dst, int32_t dx, int32_t dy, int32_t key) {
+    if (!clip_copy(src, r, dst, dx, dy)) return;
+    // Same buffer and moving down: copy bottom-up so rows aren't overwritten
+    // before they are read.
+    const bool up = src.px == dst.px && dy > r.y;
+    const uint16_t k = swap16(static_cast<uint16_t>(key));
+    for (int32_t i = 0; i < r.h; i++) {
+      const int32_t row = up ? r.h - 1 - i : i;
+      const uint16_t* from = src.px + (r.y + row) * src.width + r.x;
+      uint16_t* to = dst.px + (dy + row) * dst.width + dx;
+      if (key < 0) {
+        memmove(to, from, static_cast<size_t>(r.w) * sizeof(uint16_t));
+      } else if (to <= from) {
+        for (int32_t x = 0; x < r.w; x++) {
+          if (from[x] != k) to[x] = from[x];
+        }
+      } else {
+        for (int32_t x = r.w - 1; x >= 0; x--) {
+          if (from[x] != k) to[x] = from[x];
+        }
+      }
+    }
+  }
+
+  void blend(const View& src, GfxService::Rect r, const View& dst, int32_t dx, int32_t dy, uint8_t alpha,
+             int32_t key) {
+    if (alpha == 255) {
+      copyRect(src, r, dst, dx, dy, key);
+      return;
+    }
+    if (alpha == 0 || !clip_copy(src, r, dst, dx, dy)) return;
+    const bool up = src.px == dst.px && dy > r.y;
+    const uint16_t k = swap16(static_cast<uint16_t>(key));
+    for (int32_t i = 0; i < r.h; i++) {
+      const int32_t row = up ? r.h - 1 - i : i;
+      const uint16_t* from = src.px + (r.y + row) * src.width + r.x;
+      uint16_t* to = dst.px + (dy + row) * dst.width + dx;
+      const bool back = to > from;
+      for (int32_t n = 0; n < r.w; n++) {
+        const int32_t x = back ? r.w - 1 - n : n;
+        if (key < 0 || from[x] != k) to[x] = mix(from[x], to[x], alpha);
+      }
+    }
+  }
+
+  void paletteMap(const View& v, GfxService::Rect r, const std::vector<std::pair<uint16_t, uint16_t>>& map) {
+    if (map.empty() || !clip(r, v.width, v.height)) return;
+    // Lookups in buffer byte order; runs of the same colour reuse the last hit.
+    std::vector<std::pair<uint16_t, uint16_t>> lut;
+    lut.reserve(map.size());
+    for (const auto& m : map) lut.emplace_back(swap16(m.first), swap16(m.second));
+    std::sort(lut.begin(), lut.end());
+
+    uint16_t last_from = 0, last_to = 0;
+    bool last_hit = false, have_last = false;
+    for (int32_t y = r.y; y < r.y + r.h; y++) {
+      uint16_t* row = v.px + y * v.width + r.x;
+      for (int32_t x = 0; x < r.w; x++) {
+        const uint16_t px = row[x];
+        if (!have_last || px != last_from) {
+          auto it = std::lower_bound(lut.begin(), lut.end(), std::make_pair(px, static_cast<uint16_t>(0)));
+          last_from = px;
+          last_hit = it != lut.end() && it->first == px;
+          last_to = last_hit ? it->second : px;
+          have_last = true;
+        }
+        if (last_hit) row[x] = last_to;
+      }
+    }
+  }
+
+  void threshold(const View& v, GfxService::Rect r, uint8_t level, uint16_t lo, uint16_t hi) {
+    if (!clip(r, v.width, v.height)) return;
+    const uint16_t l = swap16(lo);
+    const uint16_t h = swap16(hi);
+    for (int32_t y = r.y; y < r.y + r.h; y++) {
+      uint16_t* row = v.px + y * v.width + r.x;
+      for (int32_t x = 0; x < r.w; x++) row[x] = luma(row[x]) >= level ? h : l;
+    }
+  }
+
+}  // namespace PixelService
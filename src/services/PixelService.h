@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <vector>
+
+#include "M5Cardputer.h"
+#include "GfxService.h"
+
+// Bulk pixel kernels over the raw buffer of a 16-bit sprite.
+//
+// A View points straight at the canvas buffer, so nothing is copied in or
+// out; every kernel clips its rectangle to the view and works a row at a
+// time. Colours in and out are plain RGB565; the byte swap to the buffer's
+// big-endian order happens inside the kernels.
+namespace PixelService {
+
+struct View {
+  uint16_t* px = nullptr;  // buffer byte order (big-endian RGB565)
+  int32_t width = 0;
+  int32_t height = 0;
+};
+
+// A view over `c`, or an empty one unless it is a 16-bit canvas with a buffer.
+View of(M5Canvas* c);
+
+uint16_t get(const View& v, int32_t x, int32_t y);
+void set(const View& v, int32_t x, int32_t y, uint16_t color);
+
+// Sets every (x, y) pair of `xy` (`points` pairs) that falls inside the view.
+void plot(const View& v, const int32_t* xy, size_t points, uint16_t color);
+
+void fill(const View& v, GfxService::Rect r, uint16_t color);
+
+// Copies the `r` region of `src` to (dx, dy) on `dst`; the two may be the
+// same view and overlap. Pixels equal to `key` are skipped when it is >= 0.
+void copyRect(const View& src, GfxService::Rect r, const View& dst, int32_t dx, int32_t dy, int32_t key = -1);
+
+// Mixes the `r` region of `src` onto `dst` at (dx, dy):
+// dst = (src * alpha + dst * (255 - alpha)) / 255 per channel.
+void blend(const View& src, GfxService::Rect r, const View& dst, int32_t dx, int32_t dy, uint8_t alpha,
+           int32_t key = -1);
+
+// Replaces each colour found in `map` (from, to pairs sorted by from) in `r`.
+void paletteMap(const View& v, GfxService::Rect r, const std::vector<std::pair<uint16_t, uint16_t>>& map);
+
+// Pixels in `r` whose luma (0-255) is >= level become `hi`, the rest `lo`.
+void threshold(const View& v, GfxService::Rect r, uint8_t level, uint16_t lo, uint16_t hi);
+
+}  // namespace PixelService
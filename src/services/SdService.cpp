@@ -0,0 +1,68 @@
+#include "SdService.h"
+
+namespace SdService {
+
+  String normalizePath(const String& path) {
+    if (!path.length()) return "";
+    String out = path;
+    if (out[0] != '/') out = String("/") + out;
+    while (out.length() > 1 && out[out.length() - 1] == '/') out.remove(out.length() - 1);
+    return out;
+  }
+
+  bool readExact(File& f, uint8_t* dst, size_t len) {
+    size_t read_total = 0;
+    while (read_total < len) {
+      int n = f.read(dst + read_total, len - read_total);
+      if (n <= 0) break;
+      read_total += static_cast<size_t>(n);
+    }
+    return read_total == len;
+  }
+
+  bool ensureParentDirs(const String& path) {
+    int slash = path.indexOf('/', 1);
+    while (slash > 0) {
+      const String dir = path.substring(0, slash);
+      if (!SD.exists(dir.c_str()) && !SD.mkdir(dir.c_str())) return false;
+      slash = path.indexOf('/', slash + 1);
+    }
+    return true;
+  }
+
+  bool writeFile(const String& path, bool (*write)(File& f, void* ctx), void* ctx) {
+    if (!ensureParentDirs(path)) return false;
+
+    const String tmp_path = path + ".tmp";
+    File f = SD.open(tmp_path.c_str(), FILE_WRITE);
+    if (!f) return false;
+    bool ok = write(f, ctx);
+    f.close();
+
+    if (ok) {
+      SD.remove(path.c_str());
+      ok = SD.rename(tmp_path.c_str(), path.c_str());
+    }
+    if (!ok) SD.remove(tmp_path.c_str());
+    return ok;
+  }
+
+  bool removeTree(const String& path) {
+    File dir = SD.open(path.c_str(), FILE_READ);
+    if (!dir) return true;
+    if (!dir.isDirectory()) {
+      dir.close();
+      return SD.remove(path.c_str());
+    }
+    bool ok = true;
+    for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+      const String child = normalizePath(String(entry.path()));
+      const bool is_dir = entry.isDirectory();
+      entry.close();
+      if (!(is_dir ? removeTree(child) : SD.remove(child.c_str()))) ok = false;
+    }
+    dir.close();
+    return SD.rmdir(path.c_str()) && ok;
+  }
+
+}  // namespace SdService
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SD.h>
+
+// SD card helpers shared by the loaders and their on-SD caches.
+namespace SdService {
+
+// `path` as an absolute SD path: leading "/" added, trailing "/" stripped
+// ("" stays "").
+String normalizePath(const String& path);
+
+// Reads exactly `len` bytes from `f`; false on a short read.
+bool readExact(File& f, uint8_t* dst, size_t len);
+
+// Creates every missing directory above `path` (SD.mkdir isn't recursive).
+bool ensureParentDirs(const String& path);
+
+// Writes `path` through a temp file that is renamed over it once `write` has
+// filled it, so a power cut never leaves a truncated file behind. `write`
+// returns false on failure; the temp file is then removed and `path` left as
+// it was. Creates missing parent directories.
+bool writeFile(const String& path, bool (*write)(File& f, void* ctx), void* ctx);
+
+// Removes `path` and, if it is a directory, everything below it. A missing
+// `path` counts as removed.
+bool removeTree(const String& path);
+
+}  // namespace SdService
@@ -0,0 +1,205 @@
+#include "TextService.h"
+
+#include <cmath>
+
+// Fonts whose glyph width tables are kept in RAM (95 bytes each).
+#ifndef CARDSTOCK_TEXT_FONT_TABLES
+#define CARDSTOCK_TEXT_FONT_TABLES 8
+#endif
+
+namespace TextService {
+
+namespace {
+
+struct WidthTable {
+  const lgfx::IFont* font = nullptr;
+  int16_t height = 0;
+  uint8_t advance[95];  // ' '..'~' at size 1
+  uint32_t last_use = 0;
+};
+
+static std::vector<WidthTable> g_tables;
+static uint32_t g_clock = 0;
+
+// Off-screen canvas used only for its font metrics; never gets a buffer.
+static M5Canvas& metrics() {
+  static M5Canvas* canvas = new M5Canvas(&M5Cardputer.Display);
+  return *canvas;
+}
+
+static const WidthTable& table_for(const lgfx::IFont* font) {
+  for (WidthTable& t : g_tables) {
+    if (t.font == font) {
+      t.last_use = ++g_clock;
+      return t;
+    }
+  }
+
+  WidthTable* t;
+  if (g_tables.size() < CARDSTOCK_TEXT_FONT_TABLES) {
+    g_tables.emplace_back();
+    t = &g_tables.back();
+  } else {
+    t = &g_tables[0];
+    for (WidthTable& c : g_tables) {
+      if (c.last_use < t->last_use) t = &c;
+    }
+  }
+
+  M5Canvas& m = metrics();
+  m.setTextSize(1);
+  char glyph[2] = {0, 0};
+  for (int c = 0; c < 95; c++) {
+    glyph[0] = static_cast<char>(' ' + c);
+    t->advance[c] = static_cast<uint8_t>(std::min<int32_t>(m.textWidth(glyph, font), 255));
+  }
+  t->font = font;
+  t->height = static_cast<int16_t>(m.fontHeight(font));
+  t->last_use = ++g_clock;
+  return *t;
+}
+
+// Length of the UTF-8 sequence starting with byte `c`.
+static size_t utf8_len(uint8_t c) {
+  if (c < 0x80) return 1;
+  if ((c & 0xE0) == 0xC0) return 2;
+  if ((c & 0xF0) == 0xE0) return 3;
+  if ((c & 0xF8) == 0xF0) return 4;
+  return 1;
+}
+
+// Width at size 1 of the character at s[i] (which is `n` bytes long).
+static int32_t char_width(const WidthTable& t, const lgfx::IFont* font, const char* s, size_t n) {
+  const uint8_t c = static_cast<uint8_t>(*s);
+  if (n == 1 && c >= 0x20 && c < 0x7F) return t.advance[c - 0x20];
+  char buf[5] = {0, 0, 0, 0, 0};
+  memcpy(buf, s, n);
+  M5Canvas& m = metrics();
+  m.setTextSize(1);
+  return m.textWidth(buf, font);
+}
+
+static int32_t scaled(int32_t w, float size) {
+  return static_cast<int32_t>(std::lround(w * size));
+}
+
+}  // namespace
+
+  Font fontOf(const LovyanGFX* t) {
+    Font f;
+    f.font = t->getFont();
+    f.size_x = t->getTextStyle().size_x;
+    f.size_y = t->getTextStyle().size_y;
+    return f;
+  }
+
+  Font numberedFont(int32_t number, float size_x, float size_y) {
+    M5Canvas& m = metrics();
+    m.setTextFont(number);
+    Font f;
+    f.font = m.getFont();
+    f.size_x = size_x;
+    f.size_y = size_y;
+    return f;
+  }
+
+  int32_t width(const Font& f, const char* s, size_t len) {
+    const WidthTable& t = table_for(f.font);
+    int32_t w = 0;
+    for (size_t i = 0; i < len;) {
+      const size_t n = std::min(utf8_len(static_cast<uint8_t>(s[i])), len - i);
+      w += char_width(t, f.font, s + i, n);
+      i += n;
+    }
+    return scaled(w, f.size_x);
+  }
+
+  int32_t height(const Font& f) {
+    return scaled(table_for(f.font).height, f.size_y);
+  }
+
+  void layout(const Font& f, const char* s, const LayoutOptions& opts, std::vector<Line>& out) {
+    out.clear();
+    if (!s) return;
+    const WidthTable& t = table_for(f.font);
+    const int32_t limit = opts.max_width > 0 ? static_cast<int32_t>(opts.max_width / f.size_x) : INT32_MAX;
+    const size_t total = strlen(s);
+
+    size_t pos = 0;
+    bool more = true;
+    while (more) {
+      if (opts.max_lines > 0 && static_cast<int32_t>(out.size()) == opts.max_lines) break;
+
+      // Scan forward until a newline, the end, or the line overflows.
+      Line line;
+      line.start = pos;
+      int32_t w = 0;
+      size_t i = pos;
+      size_t brk = pos;  // last space seen on this line (pos: none)
+      int32_t brk_w = 0;
+      bool overflow = false;
+      while (i < total && s[i] != '\n') {
+        const size_t n = std::min(utf8_len(static_cast<uint8_t>(s[i])), total - i);
+        const int32_t cw = char_width(t, f.font, s + i, n);
+        if (w + cw > limit && i > pos) {
+          overflow = true;
+          if (s[i] == ' ') {
+            brk = i;
+            brk_w = w;
+          }
+          break;
+        }
+        if (s[i] == ' ') {
+          brk = i;
+          brk_w = w;
+        }
+        w += cw;
+        i += n;
+      }
+
+      if (overflow) {
+        if (brk > pos) {
+          // Wrap at the last space and drop the spaces at the break.
+          line.len = brk - pos;
+          w = brk_w;
+          i = brk;
+          while (i < total && s[i] == ' ') i++;
+        } else {
+          line.len = i - pos;
+        }
+        pos = i;
+        more = pos < total;
+      } else {
+        line.len = i - pos;
+        pos = i + 1;
+        more = pos < total;  // stopped at a newline that isn't the last byte
+      }
+      line.width = scaled(w, f.size_x);
+      out.push_back(line);
+    }
+
+    // Text was cut: end the last line with an ellipsis that fits in the box.
+    if (more && opts.ellipsize && !out.empty()) {
+      Line& last = out.back();
+      const int32_t ell = 3 * t.advance['.' - 0x20];
+      int32_t w = 0;
+      size_t keep = 0;
+      for (size_t i = 0; i < last.len;) {
+        const size_t n = std::min(utf8_len(static_cast<uint8_t>(s[last.start + i])), last.len - i);
+        const int32_t cw = char_width(t, f.font, s + last.start + i, n);
+        if (w + cw + ell > limit) break;
+        w += cw;
+        i += n;
+        keep = i;
+      }
+      while (keep > 0 && s[last.start + keep - 1] == ' ') {
+        keep--;
+        w -= t.advance[0];
+      }
+      last.len = keep;
+      last.width = scaled(w + ell, f.size_x);
+      last.ellipsized = true;
+    }
+  }
+
+}  // namespace TextService
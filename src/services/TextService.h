@@ -0,0 +1,50 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <vector>
+
+#include "M5Cardputer.h"
+
+// Text measurement and layout without drawing.
+//
+// Widths come from per-font glyph advance tables built on first use (printable
+// ASCII, measured once at size 1) and scaled by the text size, so measuring a
+// string never touches the panel or a frame buffer. Bytes outside printable
+// ASCII (UTF-8 sequences) are measured through M5GFX one codepoint at a time.
+namespace TextService {
+
+struct Font {
+  const lgfx::IFont* font = nullptr;
+  float size_x = 1.0f;
+  float size_y = 1.0f;
+};
+
+// The font and text size `t` currently draws with.
+Font fontOf(const LovyanGFX* t);
+
+// A built-in numbered font (as accepted by drawString(..., font)) at `size`.
+Font numberedFont(int32_t number, float size_x, float size_y);
+
+int32_t width(const Font& f, const char* s, size_t len);
+int32_t height(const Font& f);
+
+struct Line {
+  size_t start = 0;        // byte offset into the source text
+  size_t len = 0;          // bytes of the source shown on this line
+  int32_t width = 0;       // pixels, including the ellipsis if any
+  bool ellipsized = false; // the line ends in "..." because text was cut
+};
+
+struct LayoutOptions {
+  int32_t max_width = 0;   // box width in pixels (<= 0: no wrapping)
+  int32_t max_lines = 0;   // 0: unlimited
+  bool ellipsize = true;   // end the last line with "..." when text is cut
+};
+
+// Breaks `s` into lines no wider than max_width: at newlines, at the last
+// space that fits, or mid-word when a single word is wider than the box.
+// Spaces at a wrap point are dropped.
+void layout(const Font& f, const char* s, const LayoutOptions& opts, std::vector<Line>& out);
+
+}  // namespace TextService
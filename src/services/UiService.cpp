@@ -0,0 +1,574 @@
+#include "UiService.h"
+
+#include <algorithm>
+#include <string>
+
+#include "GfxService.h"
+#include "TextService.h"
+
+namespace UiService {
+
+namespace {
+
+using GfxService::Rect;
+
+struct Widget {
+  bool alive = false;
+  Kind kind = Kind::kPanel;
+  Id parent = 0;
+  std::vector<Id> children;
+  Rect bounds{0, 0, 0, 0};  // relative to the parent
+  Rect drawn{0, 0, 0, 0};   // absolute area at the last draw (w = 0: not on screen)
+  bool visible = true;
+  bool dirty = true;
+  uint16_t fg = 0xFFFF, bg = 0x0000, accent = 0x041F;
+  int32_t font = -1;
+  Align align = Align::kLeft;
+  String text;
+
+  // Progress.
+  int32_t value = 0, max = 100;
+
+  // Lists and menus. Lists hold the text of rows [window_first,
+  // window_first + window.size()) only; `held` marks which of those are set.
+  int32_t count = 0;
+  int32_t row_h = 0;
+  int32_t top = 0;
+  int32_t selected = -1;
+  std::vector<String> items;  // menu
+  int32_t window_first = 0;
+  std::vector<String> window;
+  std::vector<bool> held;
+  std::vector<int32_t> dirty_rows;
+
+  // Text boxes: wrapped lines, rebuilt when the text or width changes.
+  std::vector<TextService::Line> lines;
+  int32_t lines_width = -1;
+};
+
+static std::vector<Widget> g_widgets;  // Id n lives at index n - 1
+static std::vector<Id> g_root;         // top-level widgets, in draw order
+static std::vector<Rect> g_exposed;    // areas uncovered since the last render
+static uint16_t g_background = 0x0000;
+static bool g_all_dirty = true;
+static Stats g_stats;
+
+static Widget* find(Id id) {
+  if (id <= 0 || id > static_cast<Id>(g_widgets.size())) return nullptr;
+  Widget& w = g_widgets[id - 1];
+  return w.alive ? &w : nullptr;
+}
+
+static std::vector<Id>& children_of(Id parent) {
+  Widget* p = find(parent);
+  return p ? p->children : g_root;
+}
+
+static void detach(Id id, Id parent) {
+  std::vector<Id>& list = children_of(parent);
+  list.erase(std::remove(list.begin(), list.end(), id), list.end());
+}
+
+static bool intersects(const Rect& a, const Rect& b) {
+  return a.w > 0 && a.h > 0 && b.w > 0 && b.h > 0 && a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h &&
+         b.y < a.y + a.h;
+}
+
+// Remembers the area `w` last covered so whatever is below gets redrawn.
+static void expose(Widget& w) {
+  if (w.drawn.w > 0) g_exposed.push_back(w.drawn);
+  w.drawn = Rect{0, 0, 0, 0};
+  for (Id c : w.children) {
+    if (Widget* child = find(c)) expose(*child);
+  }
+}
+
+static void mark(Widget& w) {
+  w.dirty = true;
+  w.dirty_rows.clear();
+}
+
+static TextService::Font font_for(const Widget& w, const LovyanGFX* t) {
+  TextService::Font f = TextService::fontOf(t);
+  if (w.font >= 0) f = TextService::numberedFont(w.font, f.size_x, f.size_y);
+  return f;
+}
+
+static int32_t row_height(const Widget& w, const LovyanGFX* t) {
+  if (w.row_h > 0) return w.row_h;
+  return TextService::height(font_for(w, t)) + 2;
+}
+
+static int32_t visible_rows(const Widget& w, const LovyanGFX* t) {
+  return std::max<int32_t>(1, w.bounds.h / std::max<int32_t>(1, row_height(w, t)));
+}
+
+// Keeps `top` in range and the selection on screen.
+static void clamp_scroll(Widget& w, const LovyanGFX* t) {
+  const int32_t rows = visible_rows(w, t);
+  if (w.selected >= 0) {
+    if (w.selected < w.top) w.top = w.selected;
+    if (w.selected >= w.top + rows) w.top = w.selected - rows + 1;
+  }
+  w.top = std::max<int32_t>(0, std::min(w.top, w.count - rows));
+}
+
+// Moves a list's row window to the rows now on screen, keeping the text of
+// rows that stay visible.
+static void sync_window(Widget& w, const LovyanGFX* t) {
+  const int32_t first = w.top;
+  const int32_t n = std::max<int32_t>(0, std::min(visible_rows(w, t), w.count - first));
+  if (first == w.window_first && n == static_cast<int32_t>(w.window.size())) return;
+
+  std::vector<String> window(n);
+  std::vector<bool> held(n, false);
+  for (int32_t i = 0; i < n; i++) {
+    const int32_t old = first + i - w.window_first;
+    if (old >= 0 && old < static_cast<int32_t>(w.window.size()) && w.held[old]) {
+      window[i] = std::move(w.window[old]);
+      held[i] = true;
+    }
+  }
+  g_stats.rows_held -= static_cast<uint32_t>(std::count(w.held.begin(), w.held.end(), true));
+  g_stats.rows_held += static_cast<uint32_t>(std::count(held.begin(), held.end(), true));
+  w.window_first = first;
+  w.window.swap(window);
+  w.held.swap(held);
+}
+
+static Rect absolute(const Widget& w) {
+  Rect r = w.bounds;
+  for (const Widget* p = find(w.parent); p; p = find(p->parent)) {
+    r.x += p->bounds.x;
+    r.y += p->bounds.y;
+  }
+  return r;
+}
+
+static bool shown(const Widget& w) {
+  for (const Widget* p = &w; p; p = find(p->parent)) {
+    if (!p->visible) return false;
+  }
+  return true;
+}
+
+// Draws one line of text into (x, y, w, h), cut to fit with "...".
+static void draw_text_line(M5Canvas* dst, const LovyanGFX* t, const Widget& wd, const TextService::Font& f,
+                           const char* s, uint16_t fg, uint16_t bg, const Rect& r, int32_t pad) {
+  if (!s || !*s) return;
+  TextService::LayoutOptions lo;
+  lo.max_width = r.w - pad * 2;
+  lo.max_lines = 1;
+  std::vector<TextService::Line> lines;
+  TextService::layout(f, s, lo, lines);
+  if (lines.empty()) return;
+  const TextService::Line& line = lines[0];
+
+  std::string buf(s + line.start, line.len);
+  if (line.ellipsized) buf += "...";
+  int32_t x = r.x + pad;
+  if (wd.align == Align::kCenter) x = r.x + (r.w - line.width) / 2;
+  if (wd.align == Align::kRight) x = r.x + r.w - pad - line.width;
+  const int32_t y = r.y + (r.h - TextService::height(f)) / 2;
+  GfxService::setTextColor(dst, fg, bg);
+  GfxService::drawString(dst, buf.c_str(), x, y, wd.font);
+}
+
+static const char* row_text(const Widget& w, int32_t row) {
+  if (w.kind == Kind::kMenu) {
+    return row < static_cast<int32_t>(w.items.size()) ? w.items[row].c_str() : "";
+  }
+  const int32_t i = row - w.window_first;
+  if (i < 0 || i >= static_cast<int32_t>(w.window.size()) || !w.held[i]) return "";
+  return w.window[i].c_str();
+}
+
+static Rect row_rect(const Widget& w, const Rect& r, int32_t row, int32_t rh) {
+  return Rect{r.x, r.y + (row - w.top) * rh, r.w, rh};
+}
+
+static void draw_row(M5Canvas* dst, const LovyanGFX* t, const Widget& w, const Rect& r, const TextService::Font& f,
+                     int32_t row, int32_t rh) {
+  const Rect rr = row_rect(w, r, row, rh);
+  const bool sel = row == w.selected;
+  const uint16_t bg = sel ? w.accent : w.bg;
+  GfxService::fillRect(dst, rr.x, rr.y, rr.w, rr.h, bg);
+  draw_text_line(dst, t, w, f, row_text(w, row), w.fg, bg, rr, 2);
+  g_stats.rows_drawn++;
+}
+
+static void draw_widget(M5Canvas* dst, const LovyanGFX* t, Widget& w, const Rect& r) {
+  const TextService::Font f = font_for(w, t);
+  switch (w.kind) {
+    case Kind::kPanel:
+      GfxService::fillRect(dst, r.x, r.y, r.w, r.h, w.bg);
+      break;
+
+    case Kind::kLabel:
+      GfxService::fillRect(dst, r.x, r.y, r.w, r.h, w.bg);
+      draw_text_line(dst, t, w, f, w.text.c_str(), w.fg, w.bg, r, 0);
+      break;
+
+    case Kind::kList:
+    case Kind::kMenu: {
+      const int32_t rh = row_height(w, t);
+      const int32_t rows = std::min(visible_rows(w, t), w.count - w.top);
+      for (int32_t i = 0; i < rows; i++) draw_row(dst, t, w, r, f, w.top + i, rh);
+      const int32_t used = std::max<int32_t>(0, rows) * rh;
+      if (used < r.h) GfxService::fillRect(dst, r.x, r.y + used, r.w, r.h - used, w.bg);
+      break;
+    }
+
+    case Kind::kProgress: {
+      GfxService::fillRect(dst, r.x, r.y, r.w, r.h, w.bg);
+      GfxService::drawRect(dst, r.x, r.y, r.w, r.h, w.fg);
+      const int32_t inner = std::max<int32_t>(0, r.w - 4);
+      const int32_t v = std::max<int32_t>(0, std::min(w.value, w.max));
+      const int32_t fill = w.max > 0 ? static_cast<int32_t>(static_cast<int64_t>(inner) * v / w.max) : 0;
+      if (fill > 0) GfxService::fillRect(dst, r.x + 2, r.y + 2, fill, r.h - 4, w.accent);
+      if (w.text.length()) {
+        // Caption over the bar: transparent text so both halves show through.
+        GfxService::setTextColor(dst, w.fg);
+        const int32_t tw = TextService::width(f, w.text.c_str(), w.text.length());
+        GfxService::drawString(dst, w.text.c_str(), r.x + (r.w - tw) / 2, r.y + (r.h - TextService::height(f)) / 2,
+                               w.font);
+      }
+      break;
+    }
+
+    case Kind::kTextBox: {
+      GfxService::fillRect(dst, r.x, r.y, r.w, r.h, w.bg);
+      if (w.lines_width != r.w) {
+        TextService::LayoutOptions lo;
+        lo.max_width = r.w - 4;
+        lo.ellipsize = false;
+        TextService::layout(f, w.text.c_str(), lo, w.lines);
+        w.lines_width = r.w;
+      }
+      const int32_t lh = std::max<int32_t>(1, TextService::height(f));
+      const int32_t rows = r.h / lh;
+      w.top = std::max<int32_t>(0, std::min(w.top, static_cast<int32_t>(w.lines.size()) - rows));
+      GfxService::setTextColor(dst, w.fg, w.bg);
+      std::string buf;
+      for (int32_t i = 0; i < rows && w.top + i < static_cast<int32_t>(w.lines.size()); i++) {
+        const TextService::Line& line = w.lines[w.top + i];
+        buf.assign(w.text.c_str() + line.start, line.len);
+        int32_t x = r.x + 2;
+        if (w.align == Align::kCenter) x = r.x + (r.w - line.width) / 2;
+        if (w.align == Align::kRight) x = r.x + r.w - 2 - line.width;
+        GfxService::drawString(dst, buf.c_str(), x, r.y + i * lh, w.font);
+      }
+      break;
+    }
+  }
+}
+
+static void visit(Id id, bool force, M5Canvas* dst, const LovyanGFX* t, std::vector<Rect>& redrawn) {
+  Widget* w = find(id);
+  if (!w || !w->visible) return;
+  const Rect r = absolute(*w);
+
+  bool full = force || w->dirty || g_all_dirty;
+  for (size_t i = 0; i < redrawn.size() && !full; i++) full = intersects(r, redrawn[i]);
+
+  if (full) {
+    draw_widget(dst, t, *w, r);
+    redrawn.push_back(r);
+    w->drawn = r;
+    g_stats.drawn++;
+  } else if (!w->dirty_rows.empty()) {
+    const TextService::Font f = font_for(*w, t);
+    const int32_t rh = row_height(*w, t);
+    const int32_t rows = visible_rows(*w, t);
+    for (int32_t row : w->dirty_rows) {
+      if (row < w->top || row >= w->top + rows || row >= w->count) continue;
+      draw_row(dst, t, *w, r, f, row, rh);
+      redrawn.push_back(row_rect(*w, r, row, rh));
+    }
+    g_stats.drawn++;
+  }
+  w->dirty = false;
+  w->dirty_rows.clear();
+
+  // Copy: drawing never changes the tree, but keep iteration independent of it.
+  const std::vector<Id> children = w->children;
+  for (Id c : children) visit(c, full, dst, t, redrawn);
+}
+
+}  // namespace
+
+  Id create(Kind kind, Id parent) {
+    if (parent && !find(parent)) parent = 0;
+    size_t slot = 0;
+    while (slot < g_widgets.size() && g_widgets[slot].alive) slot++;
+    if (slot == g_widgets.size()) g_widgets.emplace_back();
+    Widget& w = g_widgets[slot];
+    w = Widget();
+    w.alive = true;
+    w.kind = kind;
+    w.parent = parent;
+    const Id id = static_cast<Id>(slot + 1);
+    children_of(parent).push_back(id);
+    g_stats.widgets++;
+    return id;
+  }
+
+  void destroy(Id id) {
+    Widget* w = find(id);
+    if (!w) return;
+    expose(*w);
+    detach(id, w->parent);
+    // Orphans go to the root, hidden, until they are destroyed themselves.
+    for (Id c : w->children) {
+      if (Widget* child = find(c)) {
+        child->parent = 0;
+        child->visible = false;
+        g_root.push_back(c);
+      }
+    }
+    g_stats.rows_held -= static_cast<uint32_t>(std::count(w->held.begin(), w->held.end(), true));
+    *w = Widget();
+    g_stats.widgets--;
+  }
+
+  bool exists(Id id) {
+    return find(id) != nullptr;
+  }
+
+  Kind kind(Id id) {
+    Widget* w = find(id);
+    return w ? w->kind : Kind::kPanel;
+  }
+
+  void setBounds(Id id, int32_t x, int32_t y, int32_t w, int32_t h) {
+    Widget* wd = find(id);
+    if (!wd) return;
+    const Rect r{x, y, std::max<int32_t>(0, w), std::max<int32_t>(0, h)};
+    if (r.x == wd->bounds.x && r.y == wd->bounds.y && r.w == wd->bounds.w && r.h == wd->bounds.h) return;
+    expose(*wd);
+    wd->bounds = r;
+    mark(*wd);
+    // Children move with their parent.
+    for (Id c : wd->children) {
+      if (Widget* child = find(c)) mark(*child);
+    }
+  }
+
+  void setVisible(Id id, bool visible) {
+    Widget* w = find(id);
+    if (!w || w->visible == visible) return;
+    w->visible = visible;
+    if (visible) {
+      mark(*w);
+    } else {
+      expose(*w);
+    }
+  }
+
+  void setColors(Id id, uint16_t fg, uint16_t bg, uint16_t accent) {
+    Widget* w = find(id);
+    if (!w || (w->fg == fg && w->bg == bg && w->accent == accent)) return;
+    w->fg = fg;
+    w->bg = bg;
+    w->accent = accent;
+    mark(*w);
+  }
+
+  void setFont(Id id, int32_t font) {
+    Widget* w = find(id);
+    if (!w || w->font == font) return;
+    w->font = font;
+    w->lines_width = -1;
+    mark(*w);
+  }
+
+  void setAlign(Id id, Align align) {
+    Widget* w = find(id);
+    if (!w || w->align == align) return;
+    w->align = align;
+    mark(*w);
+  }
+
+  void setText(Id id, const char* text) {
+    Widget* w = find(id);
+    if (!w || w->text == text) return;
+    w->text = text;
+    w->lines_width = -1;
+    mark(*w);
+  }
+
+  void setValue(Id id, int32_t value, int32_t max) {
+    Widget* w = find(id);
+    if (!w || (w->value == value && w->max == max)) return;
+    w->value = value;
+    w->max = max;
+    mark(*w);
+  }
+
+  void setItems(Id id, std::vector<String>&& items) {
+    Widget* w = find(id);
+    if (!w) return;
+    w->items = std::move(items);
+    w->count = static_cast<int32_t>(w->items.size());
+    if (w->selected >= w->count) w->selected = w->count - 1;
+    mark(*w);
+  }
+
+  void setCount(Id id, int32_t count) {
+    Widget* w = find(id);
+    if (!w) return;
+    g_stats.rows_held -= static_cast<uint32_t>(std::count(w->held.begin(), w->held.end(), true));
+    w->count = std::max<int32_t>(0, count);
+    w->window.clear();
+    w->held.clear();
+    w->window_first = 0;
+    if (w->selected >= w->count) w->selected = w->count - 1;
+    mark(*w);
+  }
+
+  void setRowHeight(Id id, int32_t h) {
+    Widget* w = find(id);
+    if (!w || w->row_h == h) return;
+    w->row_h = std::max<int32_t>(0, h);
+    mark(*w);
+  }
+
+  void select(Id id, int32_t index) {
+    Widget* w = find(id);
+    if (!w || (w->kind != Kind::kList && w->kind != Kind::kMenu)) return;
+    index = w->count ? std::max<int32_t>(-1, std::min(index, w->count - 1)) : -1;
+    if (index == w->selected) return;
+    const int32_t old = w->selected;
+    const int32_t old_top = w->top;
+    w->selected = index;
+    clamp_scroll(*w, GfxService::textTarget());
+    if (w->top != old_top) {
+      mark(*w);
+    } else if (!w->dirty) {
+      w->dirty_rows.push_back(old);
+      w->dirty_rows.push_back(index);
+    }
+  }
+
+  int32_t selected(Id id) {
+    Widget* w = find(id);
+    return w ? w->selected : -1;
+  }
+
+  int32_t count(Id id) {
+    Widget* w = find(id);
+    return w ? w->count : 0;
+  }
+
+  void scroll(Id id, int32_t delta) {
+    Widget* w = find(id);
+    if (!w || !delta) return;
+    const int32_t old_top = w->top;
+    w->top = std::max<int32_t>(0, w->top + delta);
+    if (w->kind == Kind::kList || w->kind == Kind::kMenu) {
+      const int32_t sel = w->selected;
+      w->selected = -1;  // let the view move away from the selection
+      clamp_scroll(*w, GfxService::textTarget());
+      w->selected = sel;
+    }
+    if (w->top != old_top) mark(*w);
+  }
+
+  void invalidate(Id id) {
+    if (!id) {
+      g_all_dirty = true;
+      return;
+    }
+    Widget* w = find(id);
+    if (!w) return;
+    if (w->kind == Kind::kList) {
+      g_stats.rows_held -= static_cast<uint32_t>(std::count(w->held.begin(), w->held.end(), true));
+      std::fill(w->held.begin(), w->held.end(), false);
+    }
+    mark(*w);
+  }
+
+  void missingRows(std::vector<std::pair<Id, int32_t>>& out) {
+    out.clear();
+    const LovyanGFX* t = GfxService::textTarget();
+    for (size_t i = 0; i < g_widgets.size(); i++) {
+      Widget& w = g_widgets[i];
+      if (!w.alive || w.kind != Kind::kList || !shown(w)) continue;
+      clamp_scroll(w, t);
+      sync_window(w, t);
+      for (size_t k = 0; k < w.window.size(); k++) {
+        if (!w.held[k]) out.emplace_back(static_cast<Id>(i + 1), w.window_first + static_cast<int32_t>(k));
+      }
+    }
+  }
+
+  void setRow(Id id, int32_t row, const char* text) {
+    Widget* w = find(id);
+    if (!w || w->kind != Kind::kList) return;
+    const int32_t i = row - w->window_first;
+    if (i < 0 || i >= static_cast<int32_t>(w->window.size())) return;  // scrolled away: not kept
+    if (!w->held[i]) g_stats.rows_held++;
+    w->window[i] = text ? text : "";
+    w->held[i] = true;
+    if (!w->dirty) w->dirty_rows.push_back(row);
+  }
+
+  void setBackground(uint16_t color) {
+    if (color == g_background) return;
+    g_background = color;
+    g_all_dirty = true;
+  }
+
+  uint32_t render(M5Canvas* dst) {
+    const uint32_t t0 = micros();
+    g_stats.drawn = 0;
+    g_stats.rows_drawn = 0;
+
+    // Drawing goes through GfxService (which may queue it for the render
+    // task); `t` is only read for fonts and the text style.
+    const LovyanGFX* t = dst ? static_cast<const LovyanGFX*>(dst) : GfxService::textTarget();
+    const lgfx::TextStyle style = t->getTextStyle();
+
+    std::vector<Rect> redrawn;
+    if (g_all_dirty) {
+      GfxService::fillRect(dst, 0, 0, dst ? dst->width() : GfxService::width(),
+                           dst ? dst->height() : GfxService::height(), g_background);
+    } else {
+      for (const Rect& r : g_exposed) {
+        GfxService::fillRect(dst, r.x, r.y, r.w, r.h, g_background);
+        redrawn.push_back(r);
+      }
+    }
+    g_exposed.clear();
+
+    // Lists scrolled since missingRows() still need a valid window.
+    for (Widget& w : g_widgets) {
+      if (w.alive && w.kind == Kind::kList) {
+        clamp_scroll(w, t);
+        sync_window(w, t);
+      }
+    }
+
+    const std::vector<Id> roots = g_root;
+    for (Id id : roots) visit(id, false, dst, t, redrawn);
+    g_all_dirty = false;
+
+    GfxService::setTextStyle(dst, style);
+    g_stats.render_us = micros() - t0;
+    return g_stats.drawn;
+  }
+
+  void reset() {
+    g_widgets.clear();
+    g_root.clear();
+    g_exposed.clear();
+    g_background = 0x0000;
+    g_all_dirty = true;
+    g_stats = Stats();
+  }
+
+  const Stats& stats() {
+    return g_stats;
+  }
+
+}  // namespace UiService
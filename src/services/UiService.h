@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <utility>
+#include <vector>
+
+#include "M5Cardputer.h"
+
+// Retained widget tree drawn through GfxService.
+//
+// Widgets live here, not in Lua: scripts create them once and change their
+// properties, and render() redraws only widgets whose properties changed,
+// widgets that overlap something redrawn, and the children of anything
+// redrawn. Moving list or menu selection without scrolling redraws just the
+// two rows involved. List views are virtualized: they hold a row count and
+// the text of the rows currently on screen only, which the host fills in
+// from missingRows() before each render().
+namespace UiService {
+
+enum class Kind : uint8_t { kPanel, kLabel, kList, kMenu, kProgress, kTextBox };
+enum class Align : uint8_t { kLeft, kCenter, kRight };
+
+// Widget handle; 0 is the root (the whole surface) and never a widget.
+using Id = int32_t;
+
+Id create(Kind kind, Id parent = 0);
+// Children of a destroyed widget move to the root, hidden.
+void destroy(Id id);
+bool exists(Id id);
+Kind kind(Id id);
+
+// Position and size relative to the parent.
+void setBounds(Id id, int32_t x, int32_t y, int32_t w, int32_t h);
+void setVisible(Id id, bool visible);
+// fg: text and borders, bg: fill, accent: selected row and progress bar.
+void setColors(Id id, uint16_t fg, uint16_t bg, uint16_t accent);
+void setFont(Id id, int32_t font);  // numbered font, -1 = the surface's current font
+void setAlign(Id id, Align align);
+
+void setText(Id id, const char* text);           // label, text box, progress caption
+void setValue(Id id, int32_t value, int32_t max); // progress
+void setItems(Id id, std::vector<String>&& items); // menu
+void setCount(Id id, int32_t count);              // list; forgets the rows it holds
+void setRowHeight(Id id, int32_t h);              // list, menu; 0 = font height + 2
+
+// Lists and menus: the selected row (0-based, -1 = none), kept on screen.
+void select(Id id, int32_t index);
+int32_t selected(Id id);
+int32_t count(Id id);
+// Lists and menus scroll by rows, text boxes by lines.
+void scroll(Id id, int32_t delta);
+
+// Redraw `id` (and, for lists, fetch its rows again) at the next render; 0
+// redraws everything.
+void invalidate(Id id);
+
+// (list, row) pairs that the next render() will show but has no text for.
+void missingRows(std::vector<std::pair<Id, int32_t>>& out);
+void setRow(Id id, int32_t row, const char* text);
+
+void setBackground(uint16_t color);
+
+// Draws what changed onto `dst` (the screen when null). Returns the number of
+// widgets drawn, counting a row-only list update as one.
+uint32_t render(M5Canvas* dst = nullptr);
+
+// Destroys every widget (new app).
+void reset();
+
+struct Stats {
+  uint32_t widgets = 0;      // alive
+  uint32_t drawn = 0;        // last render: widgets drawn
+  uint32_t rows_drawn = 0;   // last render: list/menu rows drawn
+  uint32_t rows_held = 0;    // list rows currently held in RAM
+  uint32_t render_us = 0;    // last render
+};
+
+const Stats& stats();
+
+}  // namespace UiService